@@ -37,3 +37,5 @@ else:
 from tensorflow_neuron.python import predictor
 from tensorflow_neuron.python.fuse import fuse
 from tensorflow_neuron.python.performance import measure_performance
+from tensorflow_neuron.python import diagnostics
+from tensorflow_neuron.python.output_stream import read_output_stream
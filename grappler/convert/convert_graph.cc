@@ -18,6 +18,9 @@ limitations under the License.
 #include "tensorflow/core/graph/graph.h"
 #include "tensorflow/core/graph/node_builder.h"
 #include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/lib/strings/proto_serialization.h"
+#include "tensorflow/core/lib/strings/str_util.h"
+#include "tensorflow/core/platform/fingerprint.h"
 #include "tensorflow/neuron/grappler/convert/segment.h"
 #include "tensorflow/neuron/grappler/graph_constructor_wrapper.h"
 #include "tensorflow/neuron/runtime/macros.h"
@@ -27,6 +30,8 @@ namespace neuron {
 namespace convert {
 
 const char kNeuronInferredShapes[] = "_aws_neuron_inferred_shapes";
+const char kNeuronStructuralHash[] = "_aws_neuron_structural_hash";
+const char kNeuronCacheKey[] = "_aws_neuron_cache_key";
 
 // Copied from tensorflow/compiler/tf2tensorrt/convert/convert_nodes.h
 // Helper class for the segmenter to determine whether an output edge from the
@@ -127,6 +132,128 @@ static bool IsPlaceholder(const NodeDef& node) {
          op == "PlaceholderWithDefault";
 }
 
+// Returns a fingerprint of a Neuron subgraph that does not depend on node
+// names, so that segments cut from repeated blocks of a model hash equally.
+// Nodes are numbered in depth-first order from the outputs, following inputs
+// in order; two subgraphs with equal hashes are interchangeable once their
+// inputs and outputs are matched by position. Constants are hashed by value.
+static std::string StructuralHash(
+    const GraphDef& graph_def, const std::vector<std::string>& input_names,
+    const std::vector<std::string>& output_names) {
+  std::map<std::string, const NodeDef*> name_to_node;
+  for (const NodeDef& node : graph_def.node()) {
+    name_to_node[node.name()] = &node;
+  }
+  std::unordered_map<std::string, int> name_to_id;
+  std::vector<const NodeDef*> ordered_nodes;
+  auto number_from = [&](const std::string& root_name) {
+    auto root = name_to_node.find(root_name);
+    if (root == name_to_node.end() || name_to_id.count(root_name)) {
+      return;
+    }
+    std::vector<std::pair<const NodeDef*, int>> stack;
+    name_to_id[root_name] = ordered_nodes.size();
+    ordered_nodes.push_back(root->second);
+    stack.emplace_back(root->second, 0);
+    while (!stack.empty()) {
+      const NodeDef* node = stack.back().first;
+      int input_idx = stack.back().second++;
+      if (input_idx >= node->input_size()) {
+        stack.pop_back();
+        continue;
+      }
+      StringPiece input(node->input(input_idx));
+      str_util::ConsumePrefix(&input, "^");
+      std::string input_name = ParseTensorName(std::string(input)).first;
+      auto input_node = name_to_node.find(input_name);
+      if (input_node != name_to_node.end() && !name_to_id.count(input_name)) {
+        name_to_id[input_name] = ordered_nodes.size();
+        ordered_nodes.push_back(input_node->second);
+        stack.emplace_back(input_node->second, 0);
+      }
+    }
+  };
+  for (const std::string& name : output_names) {
+    number_from(ParseTensorName(name).first);
+  }
+  for (const auto& name_node : name_to_node) {
+    number_from(name_node.first);
+  }
+  auto canonical_tensor = [&](const std::string& name) {
+    StringPiece tensor(name);
+    bool is_control = str_util::ConsumePrefix(&tensor, "^");
+    std::pair<string, int> name_port = ParseTensorName(std::string(tensor));
+    std::string id = name_to_id.count(name_port.first)
+                         ? std::to_string(name_to_id[name_port.first])
+                         : name_port.first;
+    return is_control ? strings::StrCat("^", id)
+                      : strings::StrCat(id, ":", name_port.second);
+  };
+  std::string canonical;
+  for (const NodeDef* node : ordered_nodes) {
+    strings::StrAppend(&canonical, "node ", node->op(), "\n");
+    std::map<std::string, const AttrValue*> sorted_attrs;
+    for (const auto& name_attr : node->attr()) {
+      // colocation constraints refer to nodes by name
+      if (name_attr.first != "_class") {
+        sorted_attrs[name_attr.first] = &name_attr.second;
+      }
+    }
+    for (const auto& name_attr : sorted_attrs) {
+      std::string value;
+      SerializeToStringDeterministic(*name_attr.second, &value);
+      strings::StrAppend(&canonical, "attr ", name_attr.first, " ",
+                         value.size(), " ", value, "\n");
+    }
+    for (const std::string& input : node->input()) {
+      strings::StrAppend(&canonical, "input ", canonical_tensor(input), "\n");
+    }
+  }
+  for (const std::string& name : input_names) {
+    strings::StrAppend(&canonical, "subgraph_input ", canonical_tensor(name),
+                       "\n");
+  }
+  for (const std::string& name : output_names) {
+    strings::StrAppend(&canonical, "subgraph_output ", canonical_tensor(name),
+                       "\n");
+  }
+  Fprint128 fingerprint = Fingerprint128(canonical);
+  return strings::StrCat(strings::Hex(fingerprint.high64, strings::kZeroPad16),
+                         strings::Hex(fingerprint.low64, strings::kZeroPad16));
+}
+
+// Returns a key under which the compiled form of a Neuron subgraph may be
+// cached across runs: a fingerprint of its nodes in name order, serialized
+// deterministically, and of its input and output tensors.
+static std::string CompileCacheKey(
+    const GraphDef& graph_def, const std::vector<std::string>& input_names,
+    const std::vector<PartialTensorShape>& input_shapes,
+    const std::vector<std::string>& output_names,
+    const std::vector<PartialTensorShape>& output_shapes) {
+  std::map<std::string, const NodeDef*> name_to_node;
+  for (const NodeDef& node : graph_def.node()) {
+    name_to_node[node.name()] = &node;
+  }
+  std::string content;
+  for (const auto& name_node : name_to_node) {
+    std::string node_string;
+    SerializeToStringDeterministic(*name_node.second, &node_string);
+    strings::StrAppend(&content, "node ", node_string.size(), " ",
+                       node_string, "\n");
+  }
+  for (size_t idx = 0; idx < input_names.size(); ++idx) {
+    strings::StrAppend(&content, "input ", input_names[idx], " ",
+                       input_shapes[idx].DebugString(), "\n");
+  }
+  for (size_t idx = 0; idx < output_names.size(); ++idx) {
+    strings::StrAppend(&content, "output ", output_names[idx], " ",
+                       output_shapes[idx].DebugString(), "\n");
+  }
+  Fprint128 fingerprint = Fingerprint128(content);
+  return strings::StrCat(strings::Hex(fingerprint.high64, strings::kZeroPad16),
+                         strings::Hex(fingerprint.low64, strings::kZeroPad16));
+}
+
 // This function creates subgraph graph def and adds to main graph.
 tensorflow::Status ConvertSubGraphToNeuronNodeDef(SubGraphParams& sg_params) {
   string neuron_op_name =
@@ -401,6 +528,13 @@ tensorflow::Status ConvertSubGraphToNeuronNodeDef(SubGraphParams& sg_params) {
 
   neuron_op_name = "neuron_op_" + hex_string;
   VLOG(1) << "Hashed neuron_op_name: " << neuron_op_name;
+  std::string structural_hash = StructuralHash(
+      subgraph_graph_def, input_names, neuron_node_output_names);
+  VLOG(1) << "Structural hash of " << neuron_op_name << ": "
+          << structural_hash;
+  std::string cache_key =
+      CompileCacheKey(subgraph_graph_def, input_names, input_shapes,
+                      neuron_node_output_names, neuron_node_output_shapes);
 
   Node* neuron_node;
   TF_CHECK_OK(NodeBuilder(neuron_op_name, "NeuronOp")
@@ -413,6 +547,8 @@ tensorflow::Status ConvertSubGraphToNeuronNodeDef(SubGraphParams& sg_params) {
                   .Attr("output_dtypes", neuron_node_output_dtypes)
                   .Attr("output_shapes", neuron_node_output_shapes)
                   .Attr(kNeuronInferredShapes, neuron_node_output_shapes)
+                  .Attr(kNeuronStructuralHash, structural_hash)
+                  .Attr(kNeuronCacheKey, cache_key)
                   .Finalize(sg_params.graph, &neuron_node));
 
   sg_params.neuron_node = neuron_node;
@@ -726,6 +862,142 @@ static Status FindConstantFoldableNodes(
   return Status::OK();
 }
 
+// Number of elements of an inferred output shape, with unknown dimensions
+// counted as 1; 0 if the shape has not been inferred.
+static int64 InferredNumElements(const Node* node, int port) {
+  std::vector<PartialTensorShape> shapes;
+  if (!GetNodeAttr(node->attrs(), kNeuronInferredShapes, &shapes).ok() ||
+      port < 0 || port >= (int)shapes.size() || shapes[port].unknown_rank()) {
+    return 0;
+  }
+  int64 num_elements = 1;
+  for (int64 dim_size : shapes[port].dim_sizes()) {
+    num_elements *= std::max<int64>(dim_size, 1);
+  }
+  return num_elements;
+}
+
+// Bytes of the tensor on a data edge according to the inferred shapes of its
+// source node. Unknown dimensions count as 1, and a tensor without an inferred
+// shape counts as 0 bytes.
+static int64 InferredEdgeBytes(const Edge* edge) {
+  if (edge->IsControlEdge()) {
+    return 0;
+  }
+  const Node* src = edge->src();
+  int64 num_elements = InferredNumElements(src, edge->src_output());
+  return num_elements * DataTypeSize(src->output_type(edge->src_output()));
+}
+
+// Inferred shape of a data input of `node`; false if it is not known.
+static bool InferredInputShape(const Node* node, int input,
+                               PartialTensorShape* shape) {
+  const Edge* edge = nullptr;
+  if (!node->input_edge(input, &edge).ok()) {
+    return false;
+  }
+  std::vector<PartialTensorShape> shapes;
+  const Node* src = edge->src();
+  if (!GetNodeAttr(src->attrs(), kNeuronInferredShapes, &shapes).ok() ||
+      edge->src_output() >= (int)shapes.size() ||
+      shapes[edge->src_output()].unknown_rank()) {
+    return false;
+  }
+  *shape = shapes[edge->src_output()];
+  return true;
+}
+
+// Rough count of the arithmetic a node performs: multiply-accumulates for
+// matrix multiplications and convolutions, and one operation per output
+// element otherwise.
+static int64 EstimateNodeWork(const Node* node) {
+  int64 output_elements = 0;
+  for (int port = 0; port < node->num_outputs(); ++port) {
+    output_elements += InferredNumElements(node, port);
+  }
+  auto dim_or_one = [](const PartialTensorShape& shape, int dim) {
+    if (dim < 0 || dim >= shape.dims()) return (int64)1;
+    return std::max<int64>(shape.dim_size(dim), 1);
+  };
+  const std::string& op = node->type_string();
+  PartialTensorShape shape;
+  if (op == "MatMul" && InferredInputShape(node, 0, &shape)) {
+    bool transpose_a = false;
+    GetNodeAttr(node->attrs(), "transpose_a", &transpose_a).IgnoreError();
+    return output_elements * dim_or_one(shape, transpose_a ? 0 : 1);
+  }
+  if ((op == "BatchMatMul" || op == "BatchMatMulV2") &&
+      InferredInputShape(node, 0, &shape)) {
+    bool adj_x = false;
+    GetNodeAttr(node->attrs(), "adj_x", &adj_x).IgnoreError();
+    int rank = shape.dims();
+    return output_elements * dim_or_one(shape, adj_x ? rank - 2 : rank - 1);
+  }
+  if ((op == "Conv2D" || op == "Conv3D") &&
+      InferredInputShape(node, 1, &shape) && shape.dims() > 0) {
+    // filter elements per output channel
+    int64 filter_elements = 1;
+    for (int dim = 0; dim < shape.dims() - 1; ++dim) {
+      filter_elements *= dim_or_one(shape, dim);
+    }
+    return output_elements * filter_elements;
+  }
+  if (op == "DepthwiseConv2dNative" && InferredInputShape(node, 1, &shape)) {
+    return output_elements * dim_or_one(shape, 0) * dim_or_one(shape, 1);
+  }
+  return output_elements;
+}
+
+// Keeps segments whose estimated work is at least `transfer_cost_ratio` times
+// the bytes of the distinct tensors crossing their boundary. Segments without
+// any inferred shape are judged by node count alone, and every kept segment
+// must still have at least `minimum_segment_size` effective nodes.
+static void SelectSegmentsByTransferCost(
+    tensorflow::tensorrt::segment::SegmentNodesVector* segments,
+    const int minimum_segment_size, const double transfer_cost_ratio) {
+  tensorflow::tensorrt::segment::SegmentNodesVector selected;
+  for (std::set<const Node*>& segment : *segments) {
+    std::set<std::pair<const Node*, int> > boundary_tensors;
+    int64 boundary_bytes = 0;
+    int64 work = 0;
+    for (const Node* node : segment) {
+      work += EstimateNodeWork(node);
+      for (const Edge* edge : node->in_edges()) {
+        if (edge->IsControlEdge() || edge->src()->IsSource() ||
+            segment.count(edge->src())) {
+          continue;
+        }
+        auto tensor = std::make_pair(edge->src(), edge->src_output());
+        if (boundary_tensors.insert(tensor).second) {
+          boundary_bytes += InferredEdgeBytes(edge);
+        }
+      }
+      for (const Edge* edge : node->out_edges()) {
+        if (edge->IsControlEdge() || edge->dst()->IsSink() ||
+            segment.count(edge->dst())) {
+          continue;
+        }
+        auto tensor = std::make_pair(edge->src(), edge->src_output());
+        if (boundary_tensors.insert(tensor).second) {
+          boundary_bytes += InferredEdgeBytes(edge);
+        }
+      }
+    }
+    bool keep = tensorflow::tensorrt::segment::NumEffectiveNodes(segment) >=
+                minimum_segment_size;
+    if (keep && (0 != work || 0 != boundary_bytes)) {
+      keep = (double)work >= transfer_cost_ratio * (double)boundary_bytes;
+    }
+    VLOG(1) << (keep ? "Keeping" : "Dropping") << " segment of "
+            << segment.size() << " nodes with estimated work " << work
+            << " and " << boundary_bytes << " boundary bytes";
+    if (keep) {
+      selected.push_back(std::move(segment));
+    }
+  }
+  segments->swap(selected);
+}
+
 // This function is the base function which does:
 // Step 1: Find Neuron Segments.
 // Step 2: Calls functions to create Neuron subgraphs.
@@ -737,7 +1009,10 @@ Status CreateNeuronGraphDef(GraphDef* new_graph_def, const GraphDef& graph_def,
                             const double prune_small_subgraphs_ratio,
                             const std::set<std::string>& supported_op_types,
                             const std::set<std::string>& no_fuse_ops,
-                            const std::set<std::string>& force_fuse_ops) {
+                            const std::set<std::string>& force_fuse_ops,
+                            const bool cost_based_partitioning,
+                            const int64 segment_overhead_bytes,
+                            const double transfer_cost_ratio) {
   // Segment the graph into subgraphs that can be converted to Neuron op
   tensorflow::tensorrt::segment::SegmentOptions segment_options;
 
@@ -786,6 +1061,15 @@ Status CreateNeuronGraphDef(GraphDef* new_graph_def, const GraphDef& graph_def,
   TF_RETURN_IF_ERROR(BuildNodeMap(graph, &node_map));
 
   segment_options.minimum_segment_size = minimum_segment_size;
+  if (transfer_cost_ratio > 0.0) {
+    // small segments are scored after segmentation, but the partition cost
+    // still expects the user's minimum_segment_size
+    segment_options.keep_small_segments = true;
+  }
+  if (cost_based_partitioning) {
+    segment_options.edge_bytes_fn = InferredEdgeBytes;
+    segment_options.segment_overhead_bytes = segment_overhead_bytes;
+  }
 
   // Setup exclude_node_list
   for (int i = 0; i < graph.num_node_ids(); ++i) {
@@ -819,6 +1103,10 @@ Status CreateNeuronGraphDef(GraphDef* new_graph_def, const GraphDef& graph_def,
       &graph, [](const Node* node) { return Status::OK(); },
       [](const Edge* edge) { return true; }, OutputEdgeValidator(),
       segment_options, &segments));
+  if (transfer_cost_ratio > 0.0) {
+    SelectSegmentsByTransferCost(&segments, minimum_segment_size,
+                                 transfer_cost_ratio);
+  }
   if (segments.size() > 1) {
     VLOG(1) << "MULTIPLE Neuron candidate conversion: " << segments.size();
     if (prune_small_subgraphs_ratio < 0.0 ||
@@ -78,7 +78,10 @@ Status CreateNeuronGraphDef(GraphDef* new_graph_def, const GraphDef& graph_def,
                             const double prune_small_subgraphs_ratio,
                             const std::set<std::string>& supported_op_types,
                             const std::set<std::string>& no_fuse_ops,
-                            const std::set<std::string>& force_fuse_ops);
+                            const std::set<std::string>& force_fuse_ops,
+                            const bool cost_based_partitioning = false,
+                            const int64 segment_overhead_bytes = 1 << 20,
+                            const double transfer_cost_ratio = 0.0);
 
 }  // namespace convert
 }  // namespace neuron
@@ -15,8 +15,11 @@ limitations under the License.
 
 #include "segment.h"
 
+#include <algorithm>
+#include <limits>
 #include <queue>
 #include <set>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
@@ -287,8 +290,117 @@ void StableDFS(const SimpleGraph& g, bool reverse,
   }
 }
 
-bool CanContractEdge(const SimpleEdge* edge,
-                     const std::unique_ptr<SimpleGraph>& graph) {
+// Topological ranks of the nodes of a SimpleGraph, kept valid while edges are
+// contracted. Every path u -> ... -> v has rank(u) < rank(v), so a search
+// for a path between two nodes never leaves the nodes ranked in between.
+//
+// Contracting src -> dst only reorders the nodes ranked between them, in the
+// manner of Pearce and Kelly's dynamic topological sort: those that reach dst
+// move before the merged node and those reachable from src move after it.
+//
+// Graphs with cycles, such as while loops, have no topological order; their
+// searches are not pruned and ranks are left alone.
+class TopologicalRanks {
+ public:
+  // `reverse_order` lists the nodes in reverse topological order
+  TopologicalRanks(const SimpleGraph& graph,
+                   const std::vector<const SimpleNode*>& reverse_order)
+      : rank_(graph.num_node_ids(), 0), visit_mark_(graph.num_node_ids(), 0) {
+    int rank = reverse_order.size();
+    for (const SimpleNode* node : reverse_order) {
+      rank_[node->id()] = --rank;
+    }
+    for (const SimpleNode* node : reverse_order) {
+      for (const SimpleEdge* edge : node->out_edges()) {
+        if (edge && rank_[node->id()] >= rank_[edge->dst()->id()]) {
+          VLOG(1) << "graph has a cycle through " << node->name()
+                  << "; not pruning reachability searches";
+          acyclic_ = false;
+          return;
+        }
+      }
+    }
+  }
+
+  // Whether there is a path from src to dst other than direct src -> dst edges
+  bool HasIndirectPath(const SimpleNode* src, const SimpleNode* dst) {
+    return Search(dst, /*reverse=*/true, src, nullptr);
+  }
+
+  // Must be called before src -> dst is contracted into src
+  void Contract(const SimpleNode* src, const SimpleNode* dst) {
+    if (!acyclic_) return;
+    std::vector<const SimpleNode*> to_dst;
+    std::vector<const SimpleNode*> from_src;
+    Search(dst, /*reverse=*/true, src, &to_dst);
+    Search(src, /*reverse=*/false, dst, &from_src);
+    auto by_rank = [this](const SimpleNode* lhs, const SimpleNode* rhs) {
+      return rank_[lhs->id()] < rank_[rhs->id()];
+    };
+    std::sort(to_dst.begin(), to_dst.end(), by_rank);
+    std::sort(from_src.begin(), from_src.end(), by_rank);
+    std::vector<int> ranks;
+    ranks.reserve(to_dst.size() + from_src.size() + 2);
+    ranks.push_back(rank_[src->id()]);
+    ranks.push_back(rank_[dst->id()]);
+    for (const SimpleNode* node : to_dst) ranks.push_back(rank_[node->id()]);
+    for (const SimpleNode* node : from_src) ranks.push_back(rank_[node->id()]);
+    std::sort(ranks.begin(), ranks.end());
+    // one rank is left unused since src and dst become one node
+    auto next_rank = ranks.begin();
+    for (const SimpleNode* node : to_dst) rank_[node->id()] = *next_rank++;
+    rank_[src->id()] = *next_rank++;
+    for (const SimpleNode* node : from_src) rank_[node->id()] = *next_rank++;
+  }
+
+ private:
+  // DFS from the neighbors of `start` other than `end`, through nodes ranked
+  // strictly between the two; returns whether `end` is reached. Visited nodes
+  // are appended to `visited` if it is not null.
+  bool Search(const SimpleNode* start, bool reverse, const SimpleNode* end,
+              std::vector<const SimpleNode*>* visited) {
+    int lower = rank_[start->id()];
+    int upper = rank_[end->id()];
+    if (reverse) std::swap(lower, upper);
+    if (!acyclic_) {
+      lower = std::numeric_limits<int>::min();
+      upper = std::numeric_limits<int>::max();
+    }
+    ++current_mark_;
+    std::vector<const SimpleNode*> stack;
+    auto push_neighbors = [&](const SimpleNode* node, bool skip_end) {
+      const std::vector<SimpleEdge*>& edges =
+          reverse ? node->in_edges() : node->out_edges();
+      for (const SimpleEdge* edge : edges) {
+        if (!edge) continue;
+        const SimpleNode* next = reverse ? edge->src() : edge->dst();
+        if (skip_end && next == end) continue;
+        stack.push_back(next);
+      }
+    };
+    push_neighbors(start, /*skip_end=*/true);
+    while (!stack.empty()) {
+      const SimpleNode* node = stack.back();
+      stack.pop_back();
+      if (node == end) return true;
+      int rank = rank_[node->id()];
+      if (rank <= lower || rank >= upper) continue;
+      if (visit_mark_[node->id()] == current_mark_) continue;
+      visit_mark_[node->id()] = current_mark_;
+      if (visited) visited->push_back(node);
+      push_neighbors(node, /*skip_end=*/false);
+    }
+    return false;
+  }
+
+  bool acyclic_ = true;
+  std::vector<int> rank_;
+  // nodes visited by the current search are marked with current_mark_
+  std::vector<uint64> visit_mark_;
+  uint64 current_mark_ = 0;
+};
+
+bool CanContractEdge(const SimpleEdge* edge, TopologicalRanks* ranks) {
   const auto src = edge->src();
   const auto dst = edge->dst();
 
@@ -297,17 +409,6 @@ bool CanContractEdge(const SimpleEdge* edge,
   // than 'edge' (or any other direct edge from 'src' to 'dst'), then
   // combining 'src' and 'dst' will cause a cycle along that path.
   //
-  // In practice, to avoid modifying the graph and to take advantage
-  // of existing graph functions, we perform an equivalent.
-  //   1. Get all nodes incoming to 'dst', excluding 'src'
-  //   2. Reverse DFS from those nodes
-  //   3. If reverse DFS reaches 'src' then we have a cycle
-  //
-  // TODO(aaroey): there are several problems with the current approach:
-  // 1. src->dst->src, this is not detected but it should be;
-  // 2. src->dst->...(any node sequence that doesn't contain src)...->dst, this
-  //    is detected but it should not be.
-  //
   // Note that it's fine that dst connects back to src indirectly (i.e. through
   // a path with length > 1 that consists of intermedia nodes other than src).
   // While loops is one example.
@@ -317,25 +418,10 @@ bool CanContractEdge(const SimpleEdge* edge,
   // 2. if there is a path in the subgraph from X to Y (X and Y are both nodes
   //    in the subgraph), then all paths from X to Y are in the subgraph.
   //
-  // To achieve this goal, the correct way seems to be:
-  // 1. remove any direct edge from src->dst;
-  // 2. detect if src can reach dst, if so they cannot be merged.
-  std::vector<const SimpleNode*> dfs_start_nodes;
-  for (const SimpleNode* node : dst->in_nodes()) {
-    if (node != src) {
-      dfs_start_nodes.push_back(node);
-    }
-  }
-  bool has_cycle = false;
-  StableDFS(*graph, /*reverse=*/true, dfs_start_nodes, /*enter=*/nullptr,
-            [&has_cycle, src](const SimpleNode* n) {
-              if (n == src) {
-                has_cycle = true;
-                return false;
-              }
-              return true;
-            });
-  return !has_cycle;
+  // The search walks back from the inputs of 'dst' other than 'src' and only
+  // visits nodes ranked between 'src' and 'dst', as no other node can be on a
+  // path between them.
+  return !ranks->HasIndirectPath(src, dst);
 }
 }  // namespace
 
@@ -397,6 +483,111 @@ void ContractEdge(SimpleEdge* edge, SimpleGraph* graph,
   }
 }
 
+namespace {
+
+// Contracts edges between candidates in descending order of the bytes they
+// carry, so that the largest tensors are the first kept inside segments. The
+// value of each segment is the node that the segment is contracted into.
+void ContractByEdgeBytes(const Graph* tf_graph, SimpleGraph* graph,
+                         const std::function<int64(const Edge*)>& edge_bytes_fn,
+                         std::vector<UnionFind<SimpleNode*>>* node_segments) {
+  std::vector<const SimpleNode*> order;
+  order.reserve(graph->num_node_ids());
+  StableDFS(*graph, /*reverse=*/false, {graph->source_node()},
+            /*enter=*/nullptr, [&order](const SimpleNode* n) {
+              order.push_back(n);
+              return true;
+            });
+  TopologicalRanks ranks(*graph, order);
+  std::vector<std::pair<int64, const Edge*>> weighted_edges;
+  for (const Edge* edge : tf_graph->edges()) {
+    if (edge->IsControlEdge() ||
+        (*node_segments)[edge->src()->id()].Value() == nullptr ||
+        (*node_segments)[edge->dst()->id()].Value() == nullptr) {
+      continue;
+    }
+    weighted_edges.emplace_back(edge_bytes_fn(edge), edge);
+  }
+  std::sort(weighted_edges.begin(), weighted_edges.end(),
+            [](const std::pair<int64, const Edge*>& lhs,
+               const std::pair<int64, const Edge*>& rhs) {
+              if (lhs.first != rhs.first) return lhs.first > rhs.first;
+              return lhs.second->id() < rhs.second->id();
+            });
+  for (const auto& weighted_edge : weighted_edges) {
+    const Edge* tf_edge = weighted_edge.second;
+    SimpleNode* src = (*node_segments)[tf_edge->src()->id()].ParentValue();
+    SimpleNode* dst = (*node_segments)[tf_edge->dst()->id()].ParentValue();
+    if (src == dst) continue;
+    // the edge has been moved onto the nodes its ends were contracted into
+    const SimpleEdge* contract_edge = nullptr;
+    for (const SimpleEdge* out_edge : src->out_edges()) {
+      if (out_edge->dst() == dst && !out_edge->IsControlEdge()) {
+        contract_edge = out_edge;
+        break;
+      }
+    }
+    if (contract_edge == nullptr || !CanContractEdge(contract_edge, &ranks)) {
+      VLOG(3) << "... cannot contract " << tf_edge->src()->name() << " -> "
+              << tf_edge->dst()->name();
+      continue;
+    }
+    VLOG(3) << "Merge " << src->name() << " <- " << dst->name() << " ("
+            << weighted_edge.first << " bytes)";
+    ranks.Contract(src, dst);
+    (*node_segments)[src->id()].Merge(&(*node_segments)[dst->id()]);
+    std::vector<const SimpleEdge*> remove_edges;
+    ContractEdge(const_cast<SimpleEdge*>(contract_edge), graph, &remove_edges);
+    for (const SimpleEdge* r : remove_edges) {
+      graph->RemoveEdge(r);
+    }
+  }
+}
+
+// Estimated cost of a partition: bytes of the tensors crossing a segment
+// boundary, once per consuming segment, plus a fixed overhead per segment.
+// Segments smaller than minimum_segment_size are expected to stay on CPU.
+int64 PartitionCost(const Graph* tf_graph, const SegmentOptions& options,
+                    std::vector<UnionFind<SimpleNode*>>* node_segments) {
+  auto segment_of = [&options, node_segments](const Node* node) {
+    UnionFind<SimpleNode*>& u = (*node_segments)[node->id()];
+    if (u.Value() == nullptr || u.Size() < options.minimum_segment_size) {
+      return -1;
+    }
+    return u.ParentValue()->id();
+  };
+  std::set<int> segment_ids;
+  for (const Node* node : tf_graph->op_nodes()) {
+    int segment_id = segment_of(node);
+    if (segment_id >= 0) segment_ids.insert(segment_id);
+  }
+  std::set<std::tuple<int, int, int>> crossings;
+  int64 cost = options.segment_overhead_bytes * segment_ids.size();
+  for (const Edge* edge : tf_graph->edges()) {
+    if (edge->IsControlEdge()) continue;
+    int src_segment = segment_of(edge->src());
+    int dst_segment = segment_of(edge->dst());
+    if (src_segment == dst_segment) continue;
+    auto crossing = std::make_tuple(edge->src()->id(), edge->src_output(),
+                                    dst_segment);
+    if (crossings.insert(crossing).second) {
+      cost += options.edge_bytes_fn(edge);
+    }
+  }
+  return cost;
+}
+
+}  // namespace
+
+int NumEffectiveNodes(const std::set<const Node*>& segment_nodes) {
+  return std::count_if(
+      segment_nodes.begin(), segment_nodes.end(), [](const Node* node) {
+        static auto noops =
+            new std::set<string>{"Identity", "Snapshot", "StopGradient"};
+        return noops->count(node->type_string()) == 0;
+      });
+}
+
 Status SegmentGraph(const Graph* tf_graph,
                     const std::function<Status(const Node*)>& candidate_fn,
                     const std::function<bool(const Edge*)>& input_candidate_fn,
@@ -419,6 +610,7 @@ Status SegmentGraph(const Graph* tf_graph,
   std::unordered_set<string> unsupported_ops;
   int num_unsupported_ops = 0;
   std::vector<UnionFind<SimpleNode*>> node_segments;
+  node_segments.reserve(graph->num_node_ids());
   for (int i = 0; i < graph->num_node_ids(); ++i) {
     SimpleNode* node = graph->FindNodeId(i);
     if (options.exclude_node_list.count(node->name()) != 0) {
@@ -478,6 +670,7 @@ Status SegmentGraph(const Graph* tf_graph,
               order.push_back(n);
               return true;
             });
+  TopologicalRanks ranks(*graph, order);
   for (const SimpleNode* node : order) {
     // All output nodes of 'node' have been visited...
     VLOG(3) << "Trying node " << node->name() << " id=" << node->id();
@@ -503,7 +696,7 @@ Status SegmentGraph(const Graph* tf_graph,
           VLOG(3) << "... ... not a TRT candidate";
           continue;
         }
-        if (CanContractEdge(out_edge, graph)) {
+        if (CanContractEdge(out_edge, &ranks)) {
           VLOG(3) << "... ... can contract";
           contract_edges.insert(out_edge);
         } else {
@@ -527,6 +720,7 @@ Status SegmentGraph(const Graph* tf_graph,
         // Contracting the edge leaves disconnected graph edges.
         // Remove these from the graph and from 'contract_edges' so we
         // don't visit them again.
+        ranks.Contract(src, dst);
         SimpleEdge* e = const_cast<SimpleEdge*>(contract_edge);
         std::vector<const SimpleEdge*> remove_edges;
         ContractEdge(e, graph.get(), &remove_edges);
@@ -539,6 +733,29 @@ Status SegmentGraph(const Graph* tf_graph,
     }
   }
 
+  // Compare against a partition that keeps the largest tensors inside
+  // segments first, starting from an uncontracted copy of the graph.
+  if (options.edge_bytes_fn) {
+    auto cost_graph = std::unique_ptr<SimpleGraph>(new SimpleGraph(tf_graph));
+    std::vector<UnionFind<SimpleNode*>> cost_segments;
+    cost_segments.reserve(node_segments.size());
+    for (int i = 0; i < cost_graph->num_node_ids(); ++i) {
+      bool is_candidate = node_segments[i].Value() != nullptr;
+      cost_segments.emplace_back(is_candidate ? cost_graph->FindNodeId(i)
+                                              : nullptr);
+    }
+    ContractByEdgeBytes(tf_graph, cost_graph.get(), options.edge_bytes_fn,
+                        &cost_segments);
+    int64 greedy_cost = PartitionCost(tf_graph, options, &node_segments);
+    int64 cost = PartitionCost(tf_graph, options, &cost_segments);
+    VLOG(1) << "Estimated partition cost " << greedy_cost << " for greedy, "
+            << cost << " for edge bytes";
+    if (cost < greedy_cost) {
+      graph.swap(cost_graph);
+      node_segments.swap(cost_segments);
+    }
+  }
+
   // Collect the segments/subgraphs. Each subgraph is represented by a
   // set of the names of the nodes in that subgraph.
 
@@ -678,15 +895,11 @@ Status SegmentGraph(const Graph* tf_graph,
               << " with parent=" << segment_root << ":" << s;
     }
 
-    const int num_effective_nodes = std::count_if(
-        segment_nodes.begin(), segment_nodes.end(), [](const Node* node) {
-          static auto noops =
-              new std::set<string>{"Identity", "Snapshot", "StopGradient"};
-          return noops->count(node->type_string()) == 0;
-        });
+    const int num_effective_nodes = NumEffectiveNodes(segment_nodes);
 
     // Don't use segments whose number of effective nodes is small.
-    if (num_effective_nodes < options.minimum_segment_size) {
+    if (!options.keep_small_segments &&
+        num_effective_nodes < options.minimum_segment_size) {
       VLOG(1) << "Segment " << segments->size() << " has only "
               << num_effective_nodes << " effective nodes, dropping";
       continue;
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef TENSORFLOW_COMPILER_TF2TENSORRT_SEGMENT_SEGMENT_H_
 #define TENSORFLOW_COMPILER_TF2TENSORRT_SEGMENT_SEGMENT_H_
 
+#include <functional>
 #include <set>
 #include <vector>
 
@@ -35,8 +36,22 @@ struct SegmentOptions {
   // Segment must contain at least this many nodes.
   int minimum_segment_size = 2;
   std::set<string> exclude_node_list;
+  // If set, edges are also contracted in descending order of the bytes they
+  // carry, and that partition is used instead of the greedy one when its
+  // estimated cost is lower. The cost of a partition is the bytes of tensors
+  // crossing segment boundaries plus segment_overhead_bytes per segment.
+  std::function<int64(const Edge*)> edge_bytes_fn;
+  int64 segment_overhead_bytes = 1 << 20;
+  // If set, segments smaller than minimum_segment_size are still returned so
+  // that the caller can prune them after a selection of its own. The partition
+  // cost keeps treating them as staying on CPU.
+  bool keep_small_segments = false;
 };
 
+// Number of nodes in a segment that are not Identity, Snapshot or
+// StopGradient; this is what minimum_segment_size is compared against.
+int NumEffectiveNodes(const std::set<const Node*>& segment_nodes);
+
 // Get the subgraphs of a graph that can be handled by TensorRT.
 //
 // @param graph Graph of the network
@@ -0,0 +1,104 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Segmentation benchmark on synthetic graphs. Node i adds the outputs of
+// nodes i - 1 and i - span, so that the graph has many reconvergent paths,
+// and every `unsupported_every`-th node is not a segment candidate, which
+// splits the graph into many segments.
+//
+// Usage: segment_benchmark [num_nodes] [span] [unsupported_every]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "segment.h"
+#include "tensorflow/core/graph/graph.h"
+#include "tensorflow/core/graph/node_builder.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+
+namespace tensorflow {
+namespace tensorrt {
+namespace segment {
+
+static Status build_graph(Graph* graph, int num_nodes, int span,
+                          int unsupported_every) {
+  std::vector<Node*> nodes;
+  nodes.reserve(num_nodes);
+  Node* input = nullptr;
+  TF_RETURN_IF_ERROR(NodeBuilder("input", "Placeholder")
+                         .Attr("dtype", DT_FLOAT)
+                         .Finalize(graph, &input));
+  for (int idx = 0; idx < num_nodes; ++idx) {
+    Node* lhs = idx >= 1 ? nodes[idx - 1] : input;
+    Node* rhs = idx >= span ? nodes[idx - span] : input;
+    bool unsupported = unsupported_every > 0 && idx % unsupported_every == 0;
+    std::string name = strings::StrCat(unsupported ? "unsupported_" : "add_",
+                                       idx);
+    Node* node = nullptr;
+    TF_RETURN_IF_ERROR(
+        NodeBuilder(name, "AddN")
+            .Input(std::vector<NodeBuilder::NodeOut>{{lhs, 0}, {rhs, 0}})
+            .Finalize(graph, &node));
+    nodes.push_back(node);
+  }
+  return Status::OK();
+}
+
+static int run(int num_nodes, int span, int unsupported_every) {
+  Graph graph(OpRegistry::Global());
+  Status status = build_graph(&graph, num_nodes, span, unsupported_every);
+  if (!status.ok()) {
+    std::fprintf(stderr, "cannot build graph: %s\n",
+                 status.ToString().c_str());
+    return 1;
+  }
+  auto candidate_fn = [](const Node* node) {
+    if (node->name().find("unsupported_") == 0) {
+      return errors::Unimplemented("unsupported node ", node->name());
+    }
+    return node->IsOp() ? Status::OK() : errors::Unimplemented("not an op");
+  };
+  auto edge_fn = [](const Edge* edge) { return true; };
+  SegmentOptions options;
+  SegmentNodesVector segments;
+  auto start = std::chrono::steady_clock::now();
+  status = SegmentGraph(&graph, candidate_fn, edge_fn, edge_fn, options,
+                        &segments);
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  if (!status.ok()) {
+    std::fprintf(stderr, "SegmentGraph failed: %s\n",
+                 status.ToString().c_str());
+    return 1;
+  }
+  std::printf("%d nodes, span %d, unsupported every %d: %zu segments, %.3f s\n",
+              num_nodes, span, unsupported_every, segments.size(), seconds);
+  return 0;
+}
+
+}  // namespace segment
+}  // namespace tensorrt
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  int num_nodes = argc > 1 ? std::atoi(argv[1]) : 50000;
+  int span = argc > 2 ? std::atoi(argv[2]) : 16;
+  int unsupported_every = argc > 3 ? std::atoi(argv[3]) : 97;
+  return tensorflow::tensorrt::segment::run(num_nodes, span,
+                                            unsupported_every);
+}
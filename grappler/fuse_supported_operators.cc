@@ -29,6 +29,9 @@ constexpr char key_prune_small_subgraphs_ratio[] =
 constexpr char key_supported_op_types[] = "supported_op_types";
 constexpr char key_no_fuse_ops[] = "no_fuse_ops";
 constexpr char key_force_fuse_ops[] = "force_fuse_ops";
+constexpr char key_cost_based_partitioning[] = "cost_based_partitioning";
+constexpr char key_segment_overhead_bytes[] = "segment_overhead_bytes";
+constexpr char key_transfer_cost_ratio[] = "transfer_cost_ratio";
 
 template <class T>
 static std::string container_debug_string(const T& container) {
@@ -77,6 +80,16 @@ Status FuseSupportedOperators::Init(
                        param_force_fuse_ops.end()};
   }
   VLOG(2) << "force_fuse_ops_ " << container_debug_string(force_fuse_ops_);
+  if (parameter_map.count(key_cost_based_partitioning)) {
+    cost_based_partitioning_ =
+        parameter_map.at(key_cost_based_partitioning).b();
+  }
+  if (parameter_map.count(key_segment_overhead_bytes)) {
+    segment_overhead_bytes_ = parameter_map.at(key_segment_overhead_bytes).i();
+  }
+  if (parameter_map.count(key_transfer_cost_ratio)) {
+    transfer_cost_ratio_ = parameter_map.at(key_transfer_cost_ratio).f();
+  }
   return Status::OK();
 }
 
@@ -95,7 +108,8 @@ Status FuseSupportedOperators::Optimize(Cluster* cluster,
   TF_RETURN_IF_ERROR(tensorflow::neuron::convert::CreateNeuronGraphDef(
       output, item.graph, input_op_names, item.fetch, fuse_foldable_nodes_,
       minimum_segment_size_, prune_small_subgraphs_ratio_, supported_op_types_,
-      no_fuse_ops_, force_fuse_ops_));
+      no_fuse_ops_, force_fuse_ops_, cost_based_partitioning_,
+      segment_overhead_bytes_, transfer_cost_ratio_));
   return Status::OK();
 }
 
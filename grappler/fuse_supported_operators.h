@@ -44,6 +44,9 @@ class FuseSupportedOperators : public CustomGraphOptimizer {
   std::set<std::string> supported_op_types_;
   std::set<std::string> no_fuse_ops_;
   std::set<std::string> force_fuse_ops_;
+  bool cost_based_partitioning_ = false;
+  int64 segment_overhead_bytes_ = 1 << 20;
+  double transfer_cost_ratio_ = 0.0;
 };
 
 }  // end namespace neuron
@@ -1,3 +1,4 @@
+import time
 import tensorflow as tf
 import unittest
 import numpy as np
@@ -254,4 +255,51 @@ class TestAvgPool(TestV2Only):
         with tf.device('/device:AWS_NEURON:0'):
             neuron_result = tf.nn.avg_pool(orig_input, ksize, strides, 'SAME', data_format='NHWC')
 
-        np.testing.assert_allclose(neuron_result, tfcpu_result) 
\ No newline at end of file
+        np.testing.assert_allclose(neuron_result, tfcpu_result)
+
+    def test_half_channels_last(self):
+        ksize = [3, 5]
+        strides = [2, 1]
+        a = tf.random.uniform([2, 17, 19, 8], dtype='float32')
+        tfcpu_result = tf.nn.avg_pool(a, ksize, strides, 'SAME', data_format='NHWC')
+
+        with tf.device('/device:AWS_NEURON:0'):
+            neuron_result = tf.nn.avg_pool(tf.cast(a, tf.float16), ksize, strides, 'SAME', data_format='NHWC')
+
+        np.testing.assert_allclose(tf.cast(neuron_result, tf.float32), tfcpu_result, rtol=1e-2, atol=1e-3)
+
+    def test_bfloat16_channels_first(self):
+        ksize = [3, 3]
+        strides = [1, 2]
+        a = tf.random.uniform([2, 8, 15, 13], dtype='float32')
+        tfcpu_result = tf.nn.avg_pool(a, ksize, strides, 'SAME', data_format='NHWC')
+        tfcpu_result_transposed = tf.transpose(tfcpu_result, perm=[0, 3, 1, 2])
+
+        with tf.device('/device:AWS_NEURON:0'):
+            orig_input = tf.cast(tf.transpose(a, perm=[0, 3, 1, 2]), tf.bfloat16)
+            neuron_result = tf.nn.avg_pool(orig_input, ksize, strides, 'SAME', data_format='NCHW')
+
+        np.testing.assert_allclose(tf.cast(neuron_result, tf.float32), tfcpu_result_transposed, rtol=2e-2, atol=1e-2)
+
+    def test_benchmark(self):
+        ksize = [3, 3]
+        strides = [1, 1]
+        num_iters = 20
+        orig_input = tf.random.uniform([8, 56, 56, 256], dtype='float32')
+        for padding in ['VALID', 'SAME']:
+            tfcpu_result = tf.nn.avg_pool(orig_input, ksize, strides, padding, data_format='NHWC')
+            start = time.time()
+            for _ in range(num_iters):
+                tfcpu_result = tf.nn.avg_pool(orig_input, ksize, strides, padding, data_format='NHWC')
+            tfcpu_latency = (time.time() - start) / num_iters
+            with tf.device('/device:AWS_NEURON:0'):
+                # stage the input on the device once so that only the kernel is timed
+                neuron_input = tf.identity(orig_input)
+                neuron_result = tf.nn.avg_pool(neuron_input, ksize, strides, padding, data_format='NHWC')
+                start = time.time()
+                for _ in range(num_iters):
+                    neuron_result = tf.nn.avg_pool(neuron_input, ksize, strides, padding, data_format='NHWC')
+                neuron_latency = (time.time() - start) / num_iters
+            np.testing.assert_allclose(neuron_result, tfcpu_result, rtol=1e-5, atol=1e-5)
+            tf.get_logger().warning('AvgPool {} latency: cpu {:.3f} ms, neuron {:.3f} ms'.format(
+                padding, tfcpu_latency * 1000, neuron_latency * 1000))
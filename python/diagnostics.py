@@ -0,0 +1,38 @@
+# Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+from tensorflow.python.eager import context
+from tensorflow.neuron.python.ops import gen_neuron_op
+
+
+def dump_trace(path=''):
+    """Writes the spans currently held by the Neuron runtime tracer.
+
+    Tracing is turned on by NEURON_TRACE_FILE. The trace is written in Chrome
+    trace JSON format to `path`, or to NEURON_TRACE_FILE if `path` is empty.
+    Executes immediately in eager mode; in graph mode, returns an op to run.
+    """
+    op = gen_neuron_op.neuron_dump_trace(path=path)
+    return None if context.executing_eagerly() else op
+
+
+def dump_flight_recorder(reason='requested'):
+    """Writes the Neuron runtime flight recorder's window of recent requests.
+
+    The window goes to a new file under NEURON_FLIGHT_RECORDER_DIR, or to the
+    INFO log if that is not set, with `reason` in its header. Executes
+    immediately in eager mode; in graph mode, returns an op to run.
+    """
+    op = gen_neuron_op.neuron_dump_flight_recorder(reason=reason)
+    return None if context.executing_eagerly() else op
@@ -0,0 +1,103 @@
+# Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+import os
+import json
+import tempfile
+import time
+import unittest
+import tensorflow as tf
+import tensorflow.neuron as tfn
+from tensorflow.neuron.python import diagnostics
+from tensorflow.neuron.python.unittest_base import TestV2Only
+
+
+class TestDumpTrace(TestV2Only):
+
+    def test_dump_to_path(self):
+        with tempfile.TemporaryDirectory() as workdir:
+            path = os.path.join(workdir, 'trace.json')
+            diagnostics.dump_trace(path)
+            with open(path) as f:
+                trace = json.load(f)
+        assert isinstance(trace['traceEvents'], list)
+
+    def test_dump_traced_request(self):
+        if not os.environ.get('NEURON_TRACE_FILE'):
+            raise unittest.SkipTest('NEURON_TRACE_FILE is not set')
+        if os.environ.get('NEURON_TRACE_SAMPLE_EVERY', '1') != '1':
+            raise unittest.SkipTest('NEURON_TRACE_SAMPLE_EVERY is set')
+        if 'NEURON_TF_COMPILE_ONLY' in os.environ:
+            raise unittest.SkipTest('NEURON_TF_COMPILE_ONLY is set')
+        input0 = tf.keras.layers.Input(3)
+        dense0 = tf.keras.layers.Dense(3)(input0)
+        model = tf.keras.Model(inputs=[input0], outputs=[tf.nn.relu(dense0)])
+        input0_tensor = tf.random.uniform([1, 3])
+        model_neuron = tfn.trace(model, input0_tensor)
+        model_neuron(input0_tensor)
+        with tempfile.TemporaryDirectory() as workdir:
+            path = os.path.join(workdir, 'trace.json')
+            diagnostics.dump_trace(path)
+            with open(path) as f:
+                old_events = json.load(f)['traceEvents']
+            start = time.time()
+            model_neuron(input0_tensor)
+            elapsed_us = (time.time() - start) * 1e6
+            diagnostics.dump_trace(path)
+            with open(path) as f:
+                events = json.load(f)['traceEvents']
+        for event in events:
+            assert event['ph'] == 'X'
+            assert event['ts'] >= 0.0
+            assert event['dur'] >= 0.0
+        old_ts = {event['ts'] for event in old_events if event['name'] == 'neuron_op'}
+        new_ops = [event for event in events if event['name'] == 'neuron_op' and event['ts'] not in old_ts]
+        assert len(new_ops) == 1, new_ops
+        op, = new_ops
+        assert op['dur'] <= elapsed_us * 1.1 + 100.0
+        # the device wait of the request nests inside its neuron_op span
+        slack_us = 1.0
+        waits = [event for event in events
+                 if event['name'] == 'infer_wait' and event['tid'] == op['tid'] and
+                 op['ts'] - slack_us <= event['ts'] and
+                 event['ts'] + event['dur'] <= op['ts'] + op['dur'] + slack_us]
+        assert len(waits) == 1, waits
+
+    def test_dump_without_path(self):
+        if os.environ.get('NEURON_TRACE_FILE'):
+            raise unittest.SkipTest('NEURON_TRACE_FILE is set')
+        with self.assertRaises(tf.errors.InvalidArgumentError):
+            diagnostics.dump_trace()
+
+
+class TestDumpFlightRecorder(TestV2Only):
+
+    def test_dump(self):
+        if os.environ.get('NEURON_FLIGHT_RECORDER_SIZE') == '0':
+            with self.assertRaises(tf.errors.FailedPreconditionError):
+                diagnostics.dump_flight_recorder()
+            return
+        dump_dir = os.environ.get('NEURON_FLIGHT_RECORDER_DIR')
+        old_files = set(os.listdir(dump_dir)) if dump_dir and os.path.isdir(dump_dir) else set()
+        diagnostics.dump_flight_recorder('test_dump')
+        if dump_dir:
+            headers = []
+            for name in set(os.listdir(dump_dir)) - old_files:
+                with open(os.path.join(dump_dir, name)) as f:
+                    headers.append(f.readline())
+            assert any('(test_dump)' in header for header in headers)
+
+
+if __name__ == '__main__':
+    unittest.main()
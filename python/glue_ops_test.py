@@ -0,0 +1,73 @@
+import tensorflow as tf
+import unittest
+import numpy as np
+from tensorflow.neuron.python.unittest_base import TestV2Only
+
+class TestGlueOps(TestV2Only):
+    def _assert_same_on_neuron(self, func, *inputs):
+        tfcpu_result = func(*inputs)
+        with tf.device('/device:AWS_NEURON:0'):
+            neuron_result = func(*inputs)
+        np.testing.assert_equal(neuron_result.numpy(), tfcpu_result.numpy())
+
+    def test_reshape(self):
+        a = tf.range(120, dtype='float32')
+        self._assert_same_on_neuron(lambda x: tf.reshape(x, [2, -1, 4]), a)
+
+    def test_squeeze_expand_dims(self):
+        a = tf.reshape(tf.range(24, dtype='int32'), [1, 4, 1, 6])
+        self._assert_same_on_neuron(lambda x: tf.squeeze(x, axis=[2]), a)
+        self._assert_same_on_neuron(tf.squeeze, a)
+        self._assert_same_on_neuron(lambda x: tf.expand_dims(x, -1), a)
+
+    def test_cast(self):
+        a = tf.range(-50, 50, dtype='float32') / 7.0
+        self._assert_same_on_neuron(lambda x: tf.cast(x, tf.float16), a)
+        self._assert_same_on_neuron(lambda x: tf.cast(x, tf.bfloat16), a)
+        self._assert_same_on_neuron(lambda x: tf.cast(x, tf.int32), a)
+        self._assert_same_on_neuron(lambda x: tf.cast(x, tf.bool), a)
+
+    def test_transpose(self):
+        a = tf.reshape(tf.range(720, dtype='float16'), [2, 3, 4, 5, 6])
+        self._assert_same_on_neuron(lambda x: tf.transpose(x, [0, 3, 1, 4, 2]), a)
+        self._assert_same_on_neuron(lambda x: tf.transpose(x, [0, 1, 2, 3, 4]), a)
+
+    def test_slice(self):
+        a = tf.reshape(tf.range(480, dtype='int64'), [4, 10, 12])
+        self._assert_same_on_neuron(lambda x: tf.slice(x, [1, 2, 3], [2, -1, 5]), a)
+        self._assert_same_on_neuron(lambda x: tf.slice(x, [0, 0, 0], [4, 0, 12]), a)
+
+    def test_pad(self):
+        a = tf.reshape(tf.range(60, dtype='float32'), [3, 4, 5])
+        self._assert_same_on_neuron(lambda x: tf.pad(x, [[0, 1], [2, 3], [1, 0]]), a)
+
+    def test_concat(self):
+        a = tf.reshape(tf.range(60, dtype='float32'), [3, 4, 5])
+        b = tf.reshape(tf.range(36, dtype='float32'), [3, 4, 3])
+        c = tf.reshape(tf.range(20, dtype='float32'), [1, 4, 5])
+        self._assert_same_on_neuron(lambda x, y: tf.concat([x, y], axis=-1), a, b)
+        self._assert_same_on_neuron(lambda x, y: tf.concat([x, y, x], axis=0), a, c)
+
+    def test_rank_8(self):
+        a = tf.reshape(tf.range(768, dtype='float32'), [2, 3, 2, 4, 2, 2, 2, 2])
+        b = tf.reshape(tf.range(384, dtype='float32'), [2, 3, 2, 4, 2, 2, 2, 1])
+        self._assert_same_on_neuron(lambda x: tf.transpose(x, [7, 0, 6, 1, 5, 2, 4, 3]), a)
+        self._assert_same_on_neuron(lambda x: tf.slice(x, [1, 0, 1, 2, 0, 1, 0, 1], [1, 2, -1, 2, 2, 1, 2, 1]), a)
+        self._assert_same_on_neuron(lambda x: tf.pad(x, [[0, 1], [1, 0]] + [[0, 0]] * 5 + [[1, 1]]), a)
+        self._assert_same_on_neuron(lambda x, y: tf.concat([x, y], axis=-1), a, b)
+
+    def test_unsupported_dtype(self):
+        from tensorflow.python.framework import kernels
+        for op_name in 'Transpose', 'Reshape', 'Cast', 'ConcatV2':
+            neuron_kernels = [kernel for kernel in kernels.get_registered_kernels_for_op(op_name).kernel
+                              if kernel.device_type == 'AWS_NEURON']
+            for kernel in neuron_kernels:
+                allowed_types = {constraint.name: set(constraint.allowed_values.list.type)
+                                 for constraint in kernel.constraint}
+                assert allowed_types, '{} kernel has no type constraint'.format(op_name)
+                for types in allowed_types.values():
+                    assert tf.complex128.as_datatype_enum not in types
+                    assert tf.string.as_datatype_enum not in types
+        # soft placement runs unsupported data types on cpu
+        a = tf.complex(tf.reshape(tf.range(24, dtype='float64'), [2, 3, 4]), 1.0)
+        self._assert_same_on_neuron(lambda x: tf.transpose(x, [2, 0, 1]), a)
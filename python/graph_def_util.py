@@ -16,6 +16,7 @@ import math
 import reprlib
 from collections import namedtuple
 from tensorflow.core.framework import graph_pb2
+from tensorflow.core.framework import node_def_pb2
 from tensorflow.python.framework import dtypes
 from tensorflow.python.framework.ops import convert_to_tensor
 from tensorflow.python.framework.tensor_shape import TensorShape
@@ -36,6 +37,9 @@ knInputDtypes = 'input_dtypes'
 knOutputDtypes = 'output_dtypes'
 knInputShapes = 'input_shapes'
 knOutputShapes = 'output_shapes'
+kPipelineStages = '_pipeline_stages'
+kStructuralHash = '_aws_neuron_structural_hash'
+kCacheKey = '_aws_neuron_cache_key'
 vInvalidAxis = -1
 
 
@@ -402,10 +406,95 @@ def set_execution_plan(compiled_graph_def):
     return compiled_graph_def
 
 
+def fuse_pipeline_stages(compiled_graph_def):
+    """Fuses chains of NeuronOps, where each one feeds exactly the next one, into a single
+    pipelined NeuronOp. Stages keep their own executables and are placed on separate
+    NeuronCore groups, so that micro-batches flow through them concurrently.
+    """
+    neuron_nodes = {node.name: node for node in get_neuron_nodes(compiled_graph_def)}
+    consumers = {}
+    for node in compiled_graph_def.node:
+        for name in node.input:
+            op_name, _ = _graph_def_op_index(name)
+            consumers.setdefault(op_name, set()).add(node.name)
+
+    def next_stage(node):
+        users = consumers.get(node.name, set())
+        if len(users) != 1:
+            return None
+        user = neuron_nodes.get(next(iter(users)))
+        if user is None or kPipelineStages in user.attr:
+            return None
+        num_outputs = len(node.attr[knOutputNames].list.s)
+        expected_inputs = ['{}:{}'.format(node.name, idx) for idx in range(num_outputs)]
+        user_inputs = [name if ':' in name else '{}:0'.format(name) for name in user.input]
+        if user_inputs != expected_inputs:
+            return None
+        if node.attr[knOutputDtypes].list.type != user.attr[knInputDtypes].list.type:
+            return None
+        output_shapes = [TensorShape(shape).as_list() for shape in node.attr[knOutputShapes].list.shape]
+        input_shapes = [TensorShape(shape).as_list() for shape in user.attr[knInputShapes].list.shape]
+        return user if output_shapes == input_shapes else None
+
+    stage_successors = {name: next_stage(node) for name, node in neuron_nodes.items()
+                        if kPipelineStages not in node.attr}
+    has_producer = {succ.name for succ in stage_successors.values() if succ is not None}
+    chains = []
+    for name, succ in stage_successors.items():
+        if name in has_producer or succ is None:
+            continue
+        chain = [neuron_nodes[name]]
+        while succ is not None:
+            chain.append(succ)
+            succ = stage_successors.get(succ.name)
+        chains.append(chain)
+    removed_names = set()
+    for chain in chains:
+        first, last = chain[0], chain[-1]
+        stage_defs = []
+        for stage_idx, stage in enumerate(chain):
+            stage_def = node_def_pb2.NodeDef()
+            stage_def.CopyFrom(stage)
+            del stage_def.input[:]
+            model_config = list(stage_def.attr['model_config'].list.i)
+            if len(model_config) >= 4:
+                # engine index; one NeuronCore group per stage
+                model_config = model_config[:4] + [stage_idx]
+                stage_def.attr['model_config'].list.i[:] = model_config
+            stage_defs.append(stage_def.SerializeToString())
+        # the fused op takes over the name of the last stage so that its consumers are intact
+        last.input[:] = first.input
+        for key in [knInputNames, knInputDtypes, knInputShapes, 'input_batch_axis']:
+            last.attr[key].CopyFrom(first.attr[key])
+        last.attr[knExecutable].s = b''
+        last.attr[kPipelineStages].list.s[:] = stage_defs
+        removed_names.update(stage.name for stage in chain[:-1])
+        logging.info('fused {} NeuronOps into pipeline {}'.format(len(chain), last.name))
+    if removed_names:
+        nodes = [node for node in compiled_graph_def.node if node.name not in removed_names]
+        del compiled_graph_def.node[:]
+        compiled_graph_def.node.extend(nodes)
+    return compiled_graph_def
+
+
 def get_neuron_nodes(graph_def):
     return [node for node in graph_def.node if node.op == tNeuronOp]
 
 
+def get_pipeline_stages(node):
+    """Returns the stage NeuronOps of a pipeline fused by `fuse_pipeline_stages`,
+    or `[node]` itself if it is not a pipeline
+    """
+    if kPipelineStages not in node.attr:
+        return [node]
+    stages = []
+    for serialized in node.attr[kPipelineStages].list.s:
+        stage = node_def_pb2.NodeDef()
+        stage.ParseFromString(serialized)
+        stages.append(stage)
+    return stages
+
+
 def get_subgraph_def(node, volatile=False):
     graph_def = graph_pb2.GraphDef()
     graph_def.ParseFromString(node.attr[knGraphDef].s)
@@ -467,9 +556,10 @@ def compiled_graph_op_counts(graph_def):
     neuron_nodes = [node for node in graph_def.node if node.op == tNeuronOp]
     num_ops_on_neuron = 0
     for node in neuron_nodes:
-        if node.attr['executable'].s:
-            subgraph_def = get_subgraph_def(node)
-            num_ops_on_neuron += len(subgraph_def.node) - len(node.attr['input_names'].list.s)
+        for stage in get_pipeline_stages(node):
+            if stage.attr[knExecutable].s:
+                subgraph_def = get_subgraph_def(stage)
+                num_ops_on_neuron += len(subgraph_def.node) - len(stage.attr[knInputNames].list.s)
     num_ops_tfn = len(graph_def.node) + num_ops_on_neuron - len(neuron_nodes)
     return max(num_ops_tfn, 0), max(num_ops_on_neuron, 0)
 
@@ -105,11 +105,21 @@ def inference_graph_from_session(
         `input_tensors`, `shape_feed_dict`, and `feed_dict` can all set input tensors, and so
         the latter one will always override the former one.
     """
+    pipeline = False
+    cost_based_partitioning = False
+    transfer_cost_ratio = None
+    cache_dir = None
+    cache_size_limit = None
     if 'NEURON_CC_FLAGS' in os.environ:
         parser = argparse.ArgumentParser()
         parser.add_argument('--must-compile', action='store_true')
         parser.add_argument('--dump-prefix', default=None)
         parser.add_argument('--verbose', type=int, default=None)
+        parser.add_argument('--pipeline', action='store_true')
+        parser.add_argument('--cost-based-partitioning', action='store_true')
+        parser.add_argument('--transfer-cost-ratio', type=float, default=None)
+        parser.add_argument('--cache-dir', default=None)
+        parser.add_argument('--cache-size-limit', type=int, default=None)
         tf_neuron_args, neuron_cc_args = parser.parse_known_args(shlex.split(os.environ['NEURON_CC_FLAGS']))
         if tf_neuron_args.verbose is not None:
             compiler_verbose = tf_neuron_args.verbose
@@ -119,6 +129,11 @@ def inference_graph_from_session(
                 compiler_verbose = 1
             logging.warning('Enabling must-compile according to NEURON_CC_FLAGS environment variable; '
                             'neuron-cc failures will be thrown as exceptions')
+        pipeline = tf_neuron_args.pipeline
+        cost_based_partitioning = tf_neuron_args.cost_based_partitioning
+        transfer_cost_ratio = tf_neuron_args.transfer_cost_ratio
+        cache_dir = tf_neuron_args.cache_dir
+        cache_size_limit = tf_neuron_args.cache_size_limit
         if tf_neuron_args.dump_prefix is not None:
             compiler_workdir = tf_neuron_args.dump_prefix
         if neuron_cc_args:
@@ -229,7 +244,9 @@ def inference_graph_from_session(
     part_graph_def = whitelist_partition(
         graph_def, signature_def, supported_op_types=supported_op_types,
         no_fuse_ops=no_fuse_ops, force_fuse_ops=force_fuse_ops,
-        minimum_segment_size=minimum_segment_size)
+        minimum_segment_size=minimum_segment_size,
+        cost_based_partitioning=cost_based_partitioning,
+        transfer_cost_ratio=transfer_cost_ratio)
 
     # perform an inference to find tensor shapes as a last resort
     # todo: change to hard_shape_inference == True
@@ -243,7 +260,7 @@ def inference_graph_from_session(
     compiled_graph_def = compile_subgraphs(
         part_graph_def, workdir=compiler_workdir,
         args_dict=args_dict, timeout=compiler_timeout, max_num_compilers=max_num_compilers,
-        verbose=compiler_verbose)
+        verbose=compiler_verbose, cache_dir=cache_dir, cache_size_limit=cache_size_limit)
 
     if dynamic_batch_size:
         compiled_graph_def = mark_batch_axis(compiled_graph_def)
@@ -283,6 +300,8 @@ def inference_graph_from_session(
 
     # execution plan analysis
     compiled_graph_def = gdu.set_execution_plan(compiled_graph_def)
+    if pipeline:
+        compiled_graph_def = gdu.fuse_pipeline_stages(compiled_graph_def)
 
     # return a new graph
     compiled_graph = _graph_def_to_graph(compiled_graph_def)
@@ -367,7 +386,8 @@ def shape_inference(graph_def, shape_feed_dict, output_tensors):
 
 def whitelist_partition(graph_def, signature_def,
                         supported_op_types=None, no_fuse_ops=None, force_fuse_ops=None,
-                        minimum_segment_size=None):
+                        minimum_segment_size=None, cost_based_partitioning=False,
+                        transfer_cost_ratio=None):
     """Partitions a `GraphDef` proto according to a TensorFlow op whitelist and
     fuses each whitelisted subgraph into an `NeuronOp`.
 
@@ -381,6 +401,12 @@ def whitelist_partition(graph_def, signature_def,
         force_fuse_ops: None or iterable of strings (unordered) representing
             names of ops that will be forcibly fused into `NeuronOp`.
         minimum_segment_size: int; minimum number of ops in an `NeuronOp`.
+        cost_based_partitioning: bool; also partition by keeping the largest inferred tensors
+            inside `NeuronOp`s, and use that partition when it is estimated to move fewer bytes
+            between CPU and Inferentia.
+        transfer_cost_ratio: None or float; if set, an `NeuronOp` is only formed when its
+            estimated arithmetic is at least this many times the bytes of its inputs and outputs,
+            as inferred from tensor shapes, and still has at least `minimum_segment_size` ops.
 
     Returns:
         A `GraphDef` proto with whitelisted subgraphs fused as `NeuronOp`s.
@@ -422,6 +448,9 @@ def whitelist_partition(graph_def, signature_def,
     param_map['supported_op_types'].list.s.extend(compat.as_bytes(item) for item in supported_op_types)
     param_map['no_fuse_ops'].list.s.extend(compat.as_bytes(getattr(item, 'name', item)) for item in no_fuse_ops)
     param_map['force_fuse_ops'].list.s.extend(compat.as_bytes(getattr(item, 'name', item)) for item in force_fuse_ops)
+    param_map['cost_based_partitioning'].b = cost_based_partitioning
+    if transfer_cost_ratio is not None:
+        param_map['transfer_cost_ratio'].f = transfer_cost_ratio
 
     # create meta_graph_def and run grappler passes
     meta_graph_def = meta_graph_pb2.MetaGraphDef(graph_def=graph_def)
@@ -446,7 +475,7 @@ def _get_subgraph(node, volatile=False):
 
 def compile_subgraphs(graph_def,
                       workdir=None, args_dict=None, timeout=None, max_num_compilers=None,
-                      verbose=None):
+                      verbose=None, cache_dir=None, cache_size_limit=None):
     """Compile `NeuronOp`s in a `GraphDef` proto.
 
     Args:
@@ -459,6 +488,10 @@ def compile_subgraphs(graph_def,
         timeout: Integer representing timeout limit for the compiler. Default: 18000.
         max_num_compilers: Integer representing maximum allowed compiler processes.
             Default is number of cpu cores.
+        cache_dir: None or path-like representing a directory where compiled executables are
+            cached across runs; if None, every subgraph is compiled.
+        cache_size_limit: None or integer representing the maximum total size in bytes of
+            executables kept in `cache_dir`; least recently used ones are removed first.
 
     Returns:
         A `GraphDef` proto with `NeuronOp`s already compiled.
@@ -479,10 +512,21 @@ def compile_subgraphs(graph_def,
     neuron_cc = ncc.find_neuron_cc()
     if neuron_cc is None:
         return graph_def
+    compile_cache = None
+    if cache_dir is not None:
+        compiler_version = ncc.get_compiler_version(neuron_cc)
+        if compiler_version is None:
+            logging.warning('Not using compilation cache {}: cannot determine neuron-cc version'.format(cache_dir))
+        else:
+            compile_cache = ncc.CompileCache(cache_dir, compiler_version, cache_size_limit)
+    cached_executables = {}
+    cache_keys = {}
     subgraph_info_format = '{{subgraph {} with input tensors {}, output tensors {}}}'.format
     neuron_nodes = gdu.get_neuron_nodes(graph_def)
     if not neuron_nodes:
         return graph_def
+    representatives = {}
+    duplicates = {}
     for node in neuron_nodes:
         if len(node.attr['input_names'].list.s) == 0 or len(node.attr['output_names'].list.s) == 0:
             continue
@@ -494,6 +538,27 @@ def compile_subgraphs(graph_def,
         if any(not TensorShape(shape).is_fully_defined() for shape in node.attr['output_shapes'].list.shape):
             logging.warning('Cannot infer output tensor shapes for subgraph {}'.format(node.name))
             continue
+        extend_args = [] if args_dict is None else args_dict.get(node.name, [])
+        if isinstance(extend_args, (str, bytes)):
+            extend_args = [extend_args]
+        structural_hash = node.attr[gdu.kStructuralHash].s
+        if structural_hash:
+            # structurally identical subgraphs share the executable of the first one
+            dedupe_key = structural_hash, tuple(extend_args)
+            if dedupe_key in representatives:
+                duplicates[node.name] = representatives[dedupe_key]
+                continue
+            representatives[dedupe_key] = node.name
+        node_cache_key = node.attr[gdu.kCacheKey].s.decode()
+        if compile_cache is not None and node_cache_key:
+            output_shapes = node.attr['output_shapes'].list.SerializeToString(deterministic=True)
+            cache_key = compile_cache.key(node_cache_key, [io_config_json, output_shapes.hex(), *extend_args])
+            executable = compile_cache.load(cache_key)
+            if executable:
+                logging.debug('Using cached executable for subgraph {}'.format(subgraph_info))
+                cached_executables[node.name] = executable
+                continue
+            cache_keys[node.name] = cache_key
         subgraph_def = gdu.get_subgraph_def(node)
         for sgn in subgraph_def.node:
             inferred_shapes = sgn.attr.pop(gdu.kNeuronInferredShapes, None)
@@ -508,11 +573,7 @@ def compile_subgraphs(graph_def,
                    '--pipeline', 'compile', 'SaveTemps',
                    '--output', os.path.join(workdir_path, _neuron_executable_name)]
         command.extend(['--io-config', io_config_json])
-        if args_dict is not None:
-            extend_args = args_dict.get(node.name, [])
-            if isinstance(extend_args, (str, bytes)):
-                extend_args = [extend_args]
-            command.extend(extend_args)
+        command.extend(extend_args)
         if verbose is not None:
             command.extend(['--verbose', str(verbose)])
         subgraph_compilers[node.name] = Compiler(command, verbose, workdir_path, subgraph_info)
@@ -521,9 +582,11 @@ def compile_subgraphs(graph_def,
     try_progress_bar_mode = len(subgraph_compilers) == 1 and verbose is None and workdir is None
     parser = argparse.ArgumentParser()
     parser.add_argument('--verbose', type=int, default=None)
-    verbose_args, _ = parser.parse_known_args(command)
     progress_bar_mode_done = False
-    if try_progress_bar_mode and (verbose_args.verbose is None or verbose_args.verbose == 35):
+    if try_progress_bar_mode:
+        verbose_args, _ = parser.parse_known_args(next(iter(subgraph_compilers.values())).command)
+        try_progress_bar_mode = verbose_args.verbose is None or verbose_args.verbose == 35
+    if try_progress_bar_mode:
         node_name = next(iter(subgraph_compilers))
         command = subgraph_compilers[node_name].command.copy()
         command.extend(['--verbose=35'])
@@ -576,15 +639,31 @@ def compile_subgraphs(graph_def,
                 subgraph_compilers[node_name] = None
 
     # fill NeuronOp properties
-    for node in gdu.get_neuron_nodes(graph_def):
+    neuron_nodes = gdu.get_neuron_nodes(graph_def)
+    for node in neuron_nodes:
         node.attr['input_batch_axis'].list.i[:] = [-1 for _ in node.attr['input_names'].list.s]
         node.attr['output_batch_axis'].list.i[:] = [-1 for _ in node.attr['output_names'].list.s]
+        if node.name in cached_executables:
+            node.attr['executable'].s = cached_executables[node.name]
+            continue
         if subgraph_compilers.get(node.name, None) is None:
             continue
         workdir_path = subgraph_compilers[node.name].workdir_path
         executable_path = os.path.join(workdir_path, _neuron_executable_name)
         with open(executable_path, 'rb') as f:
             node.attr['executable'].s = f.read()
+        if node.name in cache_keys:
+            compile_cache.store(cache_keys[node.name], node.attr['executable'].s)
+    name_to_node = {node.name: node for node in neuron_nodes}
+    for node_name, rep_name in duplicates.items():
+        rep_node = name_to_node[rep_name]
+        if not rep_node.attr['executable'].s:
+            continue
+        # tensor names in the executable are those of the representative subgraph;
+        # inputs and outputs correspond by position
+        node = name_to_node[node_name]
+        for key in gdu.knGraphDef, gdu.knInputNames, gdu.knOutputNames, gdu.knExecutable:
+            node.attr[key].CopyFrom(rep_node.attr[key])
     return graph_def
 
 
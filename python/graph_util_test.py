@@ -25,6 +25,7 @@ import numpy as np
 import tensorflow.compat.v1 as tf
 from tensorflow.python.framework.tensor_shape import TensorShape
 from tensorflow.neuron.python import graph_util
+from tensorflow.neuron.python import graph_def_util as gdu
 from tensorflow.neuron.python import meta_graph_util
 from tensorflow.neuron.python.ops.gen_neuron_op import neuron_op
 from tensorflow.python.platform import tf_logging as logging
@@ -501,6 +502,96 @@ class TestDynamicBatchSize(unittest.TestCase):
                     result_neuron = sess.run('relu0:0', feed_dict)
                     np.testing.assert_allclose(result_neuron, result_ref, rtol=1e-2, atol=1e-2)
 
+    def test_input_batch_axis_1(self):
+        np.random.seed(_RANDOM_SEED)
+        pix = 5
+        with tf.Session(graph=tf.Graph()) as sess:
+            input0 = tf.placeholder(tf.float16, [2, None, pix, 3], name='input0')
+            conv2d0 = tf.nn.conv2d(input0, np.random.uniform(-1, 1, size=[1, 1, 3, 3]).astype(np.float16),
+                                   strides=[1, 1, 1, 1], padding='VALID', name='conv2d0')
+            relu0 = tf.nn.relu(conv2d0, name='relu0')
+            feed_dict_compile = {
+                'input0:0': np.random.uniform(-1, 1, size=[2, 4, pix, 3]).astype(np.float16),
+            }
+            feed_dict_list = []
+            for batch_size in 1, 3, 4, 9:
+                feed_dict = {
+                    'input0:0': np.random.uniform(-1, 1, size=[2, batch_size, pix, 3]).astype(np.float16),
+                }
+                feed_dict_list.append(feed_dict)
+            result_ref_list = [sess.run('relu0:0', feed_dict) for feed_dict in feed_dict_list]
+            infer_graph = graph_util.inference_graph_from_session(
+                sess, supported_op_types={'Conv2D', 'Const', 'Relu'},
+                feed_dict=feed_dict_compile, output_tensors=['relu0:0'])
+        _assert_compiler_success(infer_graph)
+        # 1x1 convolutions are independent along H, so it can serve as the batch axis
+        infer_graph_def = infer_graph.as_graph_def()
+        for node in infer_graph_def.node:
+            if node.op == 'NeuronOp':
+                node.attr['input_batch_axis'].list.i[:] = [1]
+                node.attr['output_batch_axis'].list.i[:] = [1]
+        if 'NEURON_TF_COMPILE_ONLY' not in os.environ:
+            with tf.Session(graph=tf.Graph()) as sess:
+                tf.import_graph_def(infer_graph_def, name='')
+                for feed_dict, result_ref in zip(feed_dict_list, result_ref_list):
+                    result_neuron = sess.run('relu0:0', feed_dict)
+                    assert result_neuron.shape == result_ref.shape
+                    np.testing.assert_allclose(result_neuron, result_ref, rtol=1e-2, atol=1e-2)
+
+    def test_chained_neuron_ops(self):
+        np.random.seed(_RANDOM_SEED)
+        pix = 4
+        graph = tf.Graph()
+        with graph.as_default():
+            input0 = tf.placeholder(tf.float16, [2, pix, pix, 3], name='input0')
+            conv2d0 = tf.nn.conv2d(input0, np.random.uniform(-1, 1, size=[1, 1, 3, 3]).astype(np.float16),
+                                   strides=[1, 1, 1, 1], padding='VALID', name='conv2d0')
+            relu0 = tf.nn.relu(conv2d0, name='relu0')
+        subgraph_graph_def_str = graph.as_graph_def(add_shapes=True).SerializeToString()
+        feed_list = [np.random.uniform(-1, 1, size=[batch_size, pix, pix, 3]).astype(np.float16)
+                     for batch_size in (1, 2, 3, 5)]
+        result_ref_list = []
+        with tf.Session(graph=tf.Graph()) as sess:
+            input0 = tf.placeholder(tf.float16, [None, pix, pix, 3], name='input0')
+            tf.import_graph_def(graph.as_graph_def(), input_map={'input0:0': input0}, name='ref')
+            relu0 = sess.graph.get_tensor_by_name('ref/relu0:0')
+            for value in feed_list:
+                result0 = sess.run(relu0, {input0: value})
+                result1 = sess.run(relu0, {input0: result0})
+                result2 = sess.run(relu0, {input0: result0[:2]})
+                result_ref_list.append([result1, result2])
+
+        def chained_neuron_op(tensor, name):
+            output, = neuron_op(
+                [tensor], graph_def=subgraph_graph_def_str,
+                input_names=['input0:0'], input_shapes=[[2, pix, pix, 3]],
+                output_names=['relu0:0'], output_dtypes=[tf.float16],
+                output_shapes=[[2, pix, pix, 3]], executable=b'',
+                input_batch_axis=[0], output_batch_axis=[0], name=name,
+            )
+            return output
+
+        graph = tf.Graph()
+        with graph.as_default():
+            input0 = tf.placeholder(tf.float16, [None, pix, pix, 3], name='input0')
+            sg0 = chained_neuron_op(input0, 'neuron_op0')
+            # the shared-memory output of neuron_op0 is handed over as is
+            sg1 = chained_neuron_op(sg0, 'neuron_op1')
+            # a head slice shares the pointer of that buffer, but not its size
+            sg2 = chained_neuron_op(sg0[:2], 'neuron_op2')
+        compiled_graph_def = graph_util.compile_subgraphs(graph.as_graph_def())
+        for node in compiled_graph_def.node:
+            if node.op == 'NeuronOp':
+                assert node.attr['executable'].s != b''
+        if 'NEURON_TF_COMPILE_ONLY' not in os.environ:
+            with tf.Session(graph=tf.Graph()) as sess:
+                tf.import_graph_def(compiled_graph_def, name='')
+                for value, result_ref in zip(feed_list, result_ref_list):
+                    result_neuron = sess.run([sg1.name, sg2.name], {'input0:0': value})
+                    for res_neuron, res_ref in zip(result_neuron, result_ref):
+                        assert res_neuron.shape == res_ref.shape
+                        np.testing.assert_allclose(res_neuron, res_ref, rtol=1e-2, atol=1e-2)
+
     def test_simple(self):
         infer_graph, result_names, feed_dict_list, result_ref_list = self._body()
         if 'NEURON_TF_COMPILE_ONLY' not in os.environ:
@@ -637,6 +728,117 @@ class TestDynamicBatchSize(unittest.TestCase):
             infer_graph.get_tensor_by_name(name)
 
 
+class TestPaddingAndPacking(unittest.TestCase):
+
+    def test_padding_axis_1(self):
+        np.random.seed(_RANDOM_SEED)
+        pix = 5
+        with tf.Session(graph=tf.Graph()) as sess:
+            input0 = tf.placeholder(tf.float16, [2, None, pix, 3], name='input0')
+            conv2d0 = tf.nn.conv2d(input0, np.random.uniform(-1, 1, size=[1, 1, 3, 3]).astype(np.float16),
+                                   strides=[1, 1, 1, 1], padding='VALID', name='conv2d0')
+            relu0 = tf.nn.relu(conv2d0, name='relu0')
+            feed_dict_compile = {
+                'input0:0': np.random.uniform(-1, 1, size=[2, 8, pix, 3]).astype(np.float16),
+            }
+            feed_dict_list = []
+            for length in 3, 5, 8:
+                feed_dict = {
+                    'input0:0': np.random.uniform(-1, 1, size=[2, length, pix, 3]).astype(np.float16),
+                }
+                feed_dict_list.append(feed_dict)
+            result_ref_list = [sess.run('relu0:0', feed_dict) for feed_dict in feed_dict_list]
+            infer_graph = graph_util.inference_graph_from_session(
+                sess, supported_op_types={'Conv2D', 'Const', 'Relu'},
+                feed_dict=feed_dict_compile, output_tensors=['relu0:0'])
+        _assert_compiler_success(infer_graph)
+        # shorter H is padded up to the compiled 8, and outputs are trimmed back
+        infer_graph_def = infer_graph.as_graph_def()
+        for node in infer_graph_def.node:
+            if node.op == 'NeuronOp':
+                node.attr['_input_padding_axis'].list.i[:] = [1]
+                node.attr['_output_padding_axis'].list.i[:] = [1]
+        if 'NEURON_TF_COMPILE_ONLY' not in os.environ:
+            with tf.Session(graph=tf.Graph()) as sess:
+                tf.import_graph_def(infer_graph_def, name='')
+                for feed_dict, result_ref in zip(feed_dict_list, result_ref_list):
+                    result_neuron = sess.run('relu0:0', feed_dict)
+                    assert result_neuron.shape == result_ref.shape
+                    np.testing.assert_allclose(result_neuron, result_ref, rtol=1e-2, atol=1e-2)
+
+    def test_packing(self):
+        np.random.seed(_RANDOM_SEED)
+        batch_size, length, hidden = 4, 8, 3
+        with tf.Session(graph=tf.Graph()) as sess:
+            input0 = tf.placeholder(tf.float16, [None, length, hidden], name='input0')
+            mask0 = tf.placeholder(tf.int32, [None, length], name='mask0')
+            mul0 = tf.multiply(input0, np.random.uniform(-1, 1, size=[hidden]).astype(np.float16), name='mul0')
+            relu0 = tf.nn.relu(mul0, name='relu0')
+            valid0 = tf.cast(tf.minimum(mask0, 1), tf.float16, name='valid0')
+            output0 = tf.multiply(relu0, tf.expand_dims(valid0, -1), name='output0')
+            segment0 = tf.maximum(mask0, 0, name='segment0')
+            feed_dict_compile = {
+                'input0:0': np.random.uniform(-1, 1, size=[batch_size, length, hidden]).astype(np.float16),
+                'mask0:0': np.ones([batch_size, length], np.int32),
+            }
+            row_lengths = [3, 5, 2, 8, 1, 4]
+            mask = np.zeros([len(row_lengths), length], np.int32)
+            for row, row_length in enumerate(row_lengths):
+                mask[row, :row_length] = 1
+            feed_dict = {
+                'input0:0': np.random.uniform(-1, 1, size=[len(row_lengths), length, hidden]).astype(np.float16),
+                'mask0:0': mask,
+            }
+            result_names = ['output0:0', 'segment0:0']
+            output_ref, _ = sess.run(result_names, feed_dict)
+            infer_graph = graph_util.inference_graph_from_session(
+                sess, supported_op_types={'Mul', 'Relu', 'Minimum', 'Maximum', 'Cast', 'ExpandDims', 'Const'},
+                feed_dict=feed_dict_compile, output_tensors=result_names)
+        _assert_compiler_success(infer_graph)
+        infer_graph_def = infer_graph.as_graph_def()
+        for node in infer_graph_def.node:
+            if node.op == 'NeuronOp':
+                input_ops = [name.split(':')[0] for name in node.input]
+                num_inputs = len(input_ops)
+                num_outputs = len(node.attr['output_names'].list.s)
+                node.attr['input_batch_axis'].list.i[:] = [0] * num_inputs
+                node.attr['output_batch_axis'].list.i[:] = [0] * num_outputs
+                node.attr['_input_padding_axis'].list.i[:] = [1] * num_inputs
+                node.attr['_output_padding_axis'].list.i[:] = [1] * num_outputs
+                node.attr['_packing_mask_input'].i = input_ops.index('mask0')
+        # without declaring an input for segment ids, the 0/1 mask must not be
+        # reinterpreted and packing is refused
+        unsafe_graph_def = copy.deepcopy(infer_graph_def)
+        for node in infer_graph_def.node:
+            if node.op == 'NeuronOp':
+                node.attr['_packing_segment_ids_input'].i = node.attr['_packing_mask_input'].i
+        # rows are placed first-fit decreasing into slots of the compiled
+        # length; the mask then carries the 1-based index of each row in its slot
+        slot_used = []
+        slot_rows = []
+        segment_ref = np.zeros_like(mask)
+        for row in sorted(range(len(row_lengths)), key=lambda row: -row_lengths[row]):
+            slot = next((idx for idx, used in enumerate(slot_used) if used + row_lengths[row] <= length), None)
+            if slot is None:
+                slot = len(slot_used)
+                slot_used.append(0)
+                slot_rows.append(0)
+            slot_used[slot] += row_lengths[row]
+            slot_rows[slot] += 1
+            segment_ref[row, :row_lengths[row]] = slot_rows[slot]
+        assert len(slot_used) == 3
+        if 'NEURON_TF_COMPILE_ONLY' not in os.environ:
+            with tf.Session(graph=tf.Graph()) as sess:
+                tf.import_graph_def(infer_graph_def, name='')
+                output_neuron, segment_neuron = sess.run(result_names, feed_dict)
+            np.testing.assert_allclose(output_neuron, output_ref, rtol=1e-2, atol=1e-2)
+            np.testing.assert_equal(segment_neuron, segment_ref)
+            with tf.Session(graph=tf.Graph()) as sess:
+                tf.import_graph_def(unsafe_graph_def, name='')
+                with self.assertRaises(tf.errors.InvalidArgumentError):
+                    sess.run(result_names, feed_dict)
+
+
 class TestSpecialOperator(unittest.TestCase):
 
     def test_conv2d_nchw(self):
@@ -946,6 +1148,46 @@ class TestMiscUtils(unittest.TestCase):
                 result_neuron0 = sess.run('relu0:0', feed_dict)
                 np.testing.assert_allclose(result_neuron0, result_ref0, rtol=1e-2, atol=1e-3)
 
+    def test_fuse_pipeline_stages(self):
+        graph_def = tf.GraphDef()
+        placeholder = graph_def.node.add(name='input0', op='Placeholder')
+        placeholder.attr['dtype'].type = tf.float32.as_datatype_enum
+        prev_name = 'input0'
+        for idx in range(3):
+            node = graph_def.node.add(name='neuron_op{}'.format(idx), op='NeuronOp')
+            node.input.append(prev_name)
+            for io in ['input', 'output']:
+                node.attr['{}_names'.format(io)].list.s.append('{}{}:0'.format(io, idx).encode())
+                node.attr['{}_dtypes'.format(io)].list.type.append(tf.float32.as_datatype_enum)
+                node.attr['{}_shapes'.format(io)].list.shape.add().CopyFrom(TensorShape([1, 4]).as_proto())
+                node.attr['{}_batch_axis'.format(io)].list.i.append(0)
+            node.attr['executable'].s = 'neff{}'.format(idx).encode()
+            node.attr['model_config'].list.i[:] = [4, 1, 1, 10]
+            subgraph_def = tf.GraphDef()
+            subgraph_def.node.add(name='input{}'.format(idx), op='Placeholder')
+            subgraph_def.node.add(name='output{}'.format(idx), op='Relu', input=['input{}'.format(idx)])
+            node.attr['graph_def'].s = subgraph_def.SerializeToString()
+            prev_name = node.name
+        relu = graph_def.node.add(name='relu0', op='Relu', input=[prev_name])
+        op_counts = gdu.compiled_graph_op_counts(graph_def)
+        assert op_counts == (5, 3)
+        graph_def = gdu.fuse_pipeline_stages(graph_def)
+        assert gdu.compiled_graph_op_counts(graph_def) == op_counts
+        assert [node.name for node in graph_def.node] == ['input0', 'neuron_op2', 'relu0']
+        fused = graph_def.node[1]
+        assert list(fused.input) == ['input0']
+        assert fused.attr['input_names'].list.s == [b'input0:0']
+        assert fused.attr['output_names'].list.s == [b'output2:0']
+        assert not fused.attr['executable'].s
+        stage_defs = fused.attr['_pipeline_stages'].list.s
+        assert len(stage_defs) == 3
+        for idx, serialized in enumerate(stage_defs):
+            stage_def = tf.NodeDef()
+            stage_def.ParseFromString(serialized)
+            assert stage_def.attr['executable'].s == 'neff{}'.format(idx).encode()
+            assert list(stage_def.attr['model_config'].list.i) == [4, 1, 1, 10, idx]
+            assert not stage_def.input
+
 
 class TestNeuronCCFlagsEnv(unittest.TestCase):
 
@@ -1017,6 +1259,25 @@ class TestNeuronCCFlagsEnvDump(TestNeuronCCFlagsEnv):
             assert len(list(glob.glob(os.path.join(workdir, 'neuron_op_*', 'graph_def.neff')))) == 2
             assert len(list(glob.glob(os.path.join(workdir, 'neuron_op_*', 'graph_def.neuron-cc.log')))) == 2
 
+class TestNeuronCCFlagsEnvCache(TestNeuronCCFlagsEnv):
+    _neuron_cc_flags = '--cache-dir ./workdir_neuron_cc_flags_cache --dump-prefix ./workdir_neuron_cc_flags_cache_dump'
+    def test(self):
+        cache_dir = './workdir_neuron_cc_flags_cache'
+        workdir = './workdir_neuron_cc_flags_cache_dump'
+        shutil.rmtree(cache_dir, ignore_errors=True)
+        for _ in range(2):
+            np.random.seed(_RANDOM_SEED)
+            shutil.rmtree(workdir, ignore_errors=True)
+            with tf.Session(graph=tf.Graph()) as sess:
+                fetch_list, feed_dict = self._gen_graph()
+                result_ref0 = sess.run(fetch_list, feed_dict)
+                infer_graph0 = graph_util.inference_graph_from_session(
+                    sess, supported_op_types={'Conv2D', 'Const', 'Add', 'Relu'})
+                _assert_compiler_success(infer_graph0)
+            assert len(list(glob.glob(os.path.join(cache_dir, '*.neff')))) == 2
+        # the second conversion finds both executables in the cache and runs no compiler
+        assert not glob.glob(os.path.join(workdir, 'neuron_op_*', 'graph_def.pb'))
+
 
 class TestStress(unittest.TestCase):
 
@@ -1644,6 +1905,95 @@ class TestWhitelistPartition(unittest.TestCase):
                 for res_neuron, res_ref in zip(result_neuron, result_ref):
                     np.testing.assert_allclose(res_neuron, res_ref, rtol=1e-2, atol=1e-3)
 
+    def test_cost_based_partitioning(self):
+        np.random.seed(_RANDOM_SEED)
+        graph = tf.Graph()
+        with graph.as_default():
+            input0 = tf.placeholder(tf.float32, [1, 32, 32, 8], name='input0')
+            relu0 = tf.nn.relu(input0, name='relu0')
+            conv2d0 = tf.nn.conv2d(relu0, np.random.uniform(-1, 1, size=[32, 32, 8, 8]).astype(np.float32),
+                                   strides=[1, 1, 1, 1], padding='VALID', name='conv2d0')
+            sigmoid0 = tf.sigmoid(relu0, name='sigmoid0')
+            add0 = tf.add(conv2d0, sigmoid0, name='add0')
+        graph_def = graph.as_graph_def(add_shapes=True)
+        signature_def = meta_graph_util.build_signature_def([input0], [add0])
+
+        def neuron_op_node_names(cost_based_partitioning):
+            partitioned_graph_def = graph_util.whitelist_partition(
+                graph_def, signature_def=signature_def,
+                supported_op_types={'Conv2D', 'Const', 'Add', 'Relu'}, minimum_segment_size=1,
+                cost_based_partitioning=cost_based_partitioning)
+            return [{sg_node.name for sg_node in gdu.get_subgraph_def(node).node}
+                    for node in gdu.get_neuron_nodes(partitioned_graph_def)]
+
+        # greedy contraction fuses conv2d0 with add0 and leaves the large relu0 -> conv2d0 tensor
+        # on the boundary, while the cost-based partition keeps it inside a NeuronOp
+        assert not any({'relu0', 'conv2d0'} <= names for names in neuron_op_node_names(False))
+        assert any({'relu0', 'conv2d0'} <= names for names in neuron_op_node_names(True))
+
+    def test_transfer_cost_ratio(self):
+        np.random.seed(_RANDOM_SEED)
+        graph = tf.Graph()
+        with graph.as_default():
+            input0 = tf.placeholder(tf.float32, [1, 64, 64, 16], name='input0')
+            input1 = tf.placeholder(tf.float32, [1, 64, 64, 16], name='input1')
+            add0 = tf.add(input0, input1, name='add0')
+            relu0 = tf.nn.relu(add0, name='relu0')
+            sigmoid0 = tf.sigmoid(relu0, name='sigmoid0')
+            conv2d0 = tf.nn.conv2d(sigmoid0, np.random.uniform(-1, 1, size=[3, 3, 16, 16]).astype(np.float32),
+                                   strides=[1, 1, 1, 1], padding='SAME', name='conv2d0')
+            relu1 = tf.nn.relu(conv2d0, name='relu1')
+        graph_def = graph.as_graph_def(add_shapes=True)
+        signature_def = meta_graph_util.build_signature_def([input0, input1], [relu1])
+
+        def neuron_op_node_names(transfer_cost_ratio, minimum_segment_size=None):
+            partitioned_graph_def = graph_util.whitelist_partition(
+                graph_def, signature_def=signature_def,
+                supported_op_types={'Conv2D', 'Const', 'Add', 'Relu'},
+                minimum_segment_size=minimum_segment_size,
+                transfer_cost_ratio=transfer_cost_ratio)
+            node_names = set()
+            for node in gdu.get_neuron_nodes(partitioned_graph_def):
+                node_names.update(sg_node.name for sg_node in gdu.get_subgraph_def(node).node)
+            return node_names
+
+        # add0 -> relu0 moves three large tensors for two elementwise ops
+        assert {'add0', 'conv2d0'} <= neuron_op_node_names(None)
+        node_names = neuron_op_node_names(1.0)
+        assert 'conv2d0' in node_names
+        assert 'add0' not in node_names
+        # segments that pay off are still held to minimum_segment_size
+        assert not neuron_op_node_names(1.0, minimum_segment_size=8)
+
+    def test_structural_hash(self):
+        np.random.seed(_RANDOM_SEED)
+        kernel = np.random.uniform(-1, 1, size=[3, 3, 4, 4]).astype(np.float32)
+        other_kernel = np.random.uniform(-1, 1, size=[3, 3, 4, 4]).astype(np.float32)
+        graph = tf.Graph()
+        with graph.as_default():
+            input0 = tf.placeholder(tf.float32, [1, 8, 8, 4], name='input0')
+            tensor = input0
+            for idx, weight in enumerate([kernel, kernel, other_kernel]):
+                conv2d = tf.nn.conv2d(tensor, weight, strides=[1, 1, 1, 1], padding='SAME',
+                                      name='conv2d{}'.format(idx))
+                relu = tf.nn.relu(conv2d, name='relu{}'.format(idx))
+                tensor = tf.sigmoid(relu, name='sigmoid{}'.format(idx))
+        graph_def = graph.as_graph_def(add_shapes=True)
+        signature_def = meta_graph_util.build_signature_def([input0], [tensor])
+        partitioned_graph_def = graph_util.whitelist_partition(
+            graph_def, signature_def=signature_def,
+            supported_op_types={'Conv2D', 'Const', 'Relu'}, minimum_segment_size=1)
+        hashes = {}
+        for node in gdu.get_neuron_nodes(partitioned_graph_def):
+            sg_node_names = {sg_node.name for sg_node in gdu.get_subgraph_def(node).node}
+            conv2d_name, = [name for name in sg_node_names if name.startswith('conv2d')]
+            hashes[conv2d_name] = node.attr[gdu.kStructuralHash].s
+        assert len(hashes) == 3
+        assert hashes['conv2d0']
+        # equal structure and equal weights hash equally regardless of node names
+        assert hashes['conv2d0'] == hashes['conv2d1']
+        assert hashes['conv2d0'] != hashes['conv2d2']
+
 
 def _assert_neuron_op(infer_graph):
     op_list = [op for op in infer_graph.get_operations() if op.type == 'NeuronOp']
@@ -1655,8 +2005,9 @@ def _assert_neuron_op(infer_graph):
 def _assert_compiler_success(infer_graph):
     op_list = _assert_neuron_op(infer_graph)
     for op in op_list:
-        if not op.node_def.attr['executable'].s:
-            raise AssertionError('NeuronOp {} is not compiled'.format(op.name))
+        for stage in gdu.get_pipeline_stages(op.node_def):
+            if not stage.attr['executable'].s:
+                raise AssertionError('NeuronOp {} is not compiled'.format(op.name))
 
 
 if __name__ == '__main__':
@@ -15,10 +15,12 @@
 import sys
 import os
 import json
+import hashlib
 import subprocess
 import tempfile
 from distutils import spawn
 from distutils.version import LooseVersion
+from tensorflow.python.platform import tf_logging as logging
 from tensorflow_neuron import __version__
 from tensorflow.neuron.python import utils
 
@@ -89,6 +91,85 @@ def find_neuron_cc():
     return spawn.find_executable('neuron-cc', path)
 
 
+def get_compiler_version(neuron_cc):
+    try:
+        version_output = subprocess.check_output([neuron_cc, '--version'], stderr=subprocess.STDOUT)
+    except (OSError, subprocess.CalledProcessError):
+        return None
+    return version_output.decode().strip()
+
+
+class CompileCache:
+    """Content-addressed cache of neuron-cc executables in a directory.
+
+    An entry is keyed by the cache key the converter attaches to a `NeuronOp`, together with
+    the compiler version and the compiler arguments. Once the directory holds more than
+    `size_limit` bytes of executables, the least recently used ones are removed.
+    """
+
+    _suffix = '.neff'
+
+    def __init__(self, cache_dir, compiler_version, size_limit=None):
+        self.cache_dir = os.path.abspath(cache_dir)
+        self.compiler_version = compiler_version
+        self.size_limit = size_limit
+        os.makedirs(self.cache_dir, exist_ok=True)
+
+    def key(self, node_cache_key, compiler_args):
+        content = [node_cache_key, self.compiler_version]
+        content.extend(compiler_args)
+        return hashlib.sha256('\0'.join(str(item) for item in content).encode()).hexdigest()
+
+    def load(self, key):
+        path = self._path(key)
+        try:
+            with open(path, 'rb') as f:
+                executable = f.read()
+            os.utime(path)  # mark as recently used
+        except OSError:
+            return None
+        return executable
+
+    def store(self, key, executable):
+        fd, temp_path = tempfile.mkstemp(suffix='.tmp', dir=self.cache_dir)
+        try:
+            with os.fdopen(fd, 'wb') as f:
+                f.write(executable)
+            os.replace(temp_path, self._path(key))
+        except OSError as e:
+            logging.warning('Failed to store executable in compilation cache {}: {}'.format(self.cache_dir, e))
+            if os.path.exists(temp_path):
+                os.remove(temp_path)
+            return
+        self._evict()
+
+    def _path(self, key):
+        return os.path.join(self.cache_dir, key + self._suffix)
+
+    def _evict(self):
+        if self.size_limit is None:
+            return
+        entries = []
+        for name in os.listdir(self.cache_dir):
+            if not name.endswith(self._suffix):
+                continue
+            path = os.path.join(self.cache_dir, name)
+            try:
+                stat = os.stat(path)
+            except OSError:  # removed by a concurrent compilation
+                continue
+            entries.append((stat.st_mtime, stat.st_size, path))
+        total_size = sum(size for _, size, _ in entries)
+        for _, size, path in sorted(entries):
+            if total_size <= self.size_limit:
+                break
+            try:
+                os.remove(path)
+            except OSError:
+                continue
+            total_size -= size
+
+
 try:
     import hlo2neuron
 except ImportError:
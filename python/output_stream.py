@@ -0,0 +1,36 @@
+# Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+from tensorflow.python.framework import ops
+from tensorflow.neuron.python.ops import gen_neuron_op
+
+
+def read_output_stream(stream_name, output_dtypes, name=None):
+    """Reads the next chunk of a NeuronOp output stream.
+
+    A NeuronOp whose `_output_stream` attribute is `stream_name` pushes each
+    completed shard of a dynamic batch to the stream before the whole request
+    is done. Each read returns a tuple `(row_start, request_id, outputs)`:
+    `outputs` hold the rows starting at `row_start` of the NeuronOp outputs
+    (of types `output_dtypes`) for request `request_id`.
+
+    A read raises OutOfRangeError at the end of each request, the request's
+    own error if it failed, ResourceExhaustedError if chunks were dropped
+    because nobody read them, and CancelledError if the step is cancelled
+    while waiting.
+    """
+    with ops.device('/device:AWS_NEURON:0'):
+        row_start, request_id, outputs = gen_neuron_op.neuron_output_stream(
+            stream_name=stream_name, output_dtypes=output_dtypes, name=name)
+    return row_start, request_id, outputs
@@ -0,0 +1,110 @@
+# Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+# ==============================================================================
+import os
+import unittest
+from concurrent.futures import ThreadPoolExecutor
+import numpy as np
+import tensorflow.compat.v1 as tf
+from tensorflow.neuron.python import graph_util
+from tensorflow.neuron.python.output_stream import read_output_stream
+
+
+_RANDOM_SEED = 15213
+
+
+class TestOutputStream(unittest.TestCase):
+
+    def _infer_graph_def(self, stream_name):
+        np.random.seed(_RANDOM_SEED)
+        with tf.Session(graph=tf.Graph()) as sess:
+            input0 = tf.placeholder(tf.float16, [None, 3], name='input0')
+            matmul0 = tf.matmul(input0, np.random.uniform(-1, 1, size=[3, 3]).astype(np.float16), name='matmul0')
+            relu0 = tf.nn.relu(matmul0, name='relu0')
+            feed_dict_compile = {'input0:0': np.random.uniform(-1, 1, size=[2, 3]).astype(np.float16)}
+            feed_dict = {'input0:0': np.random.uniform(-1, 1, size=[7, 3]).astype(np.float16)}
+            result_ref = sess.run('relu0:0', feed_dict)
+            infer_graph = graph_util.inference_graph_from_session(
+                sess, supported_op_types={'MatMul', 'Const', 'Relu'},
+                feed_dict=feed_dict_compile, output_tensors=['relu0:0'],
+                dynamic_batch_size=True)
+        infer_graph_def = infer_graph.as_graph_def()
+        neuron_nodes = [node for node in infer_graph_def.node if node.op == 'NeuronOp']
+        assert len(neuron_nodes) == 1
+        neuron_nodes[0].attr['_output_stream'].s = stream_name.encode()
+        return infer_graph_def, feed_dict, result_ref
+
+    def _read_request(self, sess, reader):
+        chunks = []
+        while True:
+            try:
+                chunks.append(sess.run(reader))
+            except tf.errors.OutOfRangeError:
+                return chunks
+
+    def test_read_chunks(self):
+        infer_graph_def, feed_dict, result_ref = self._infer_graph_def('test_read_chunks')
+        if 'NEURON_TF_COMPILE_ONLY' in os.environ:
+            return
+        with tf.Session(graph=tf.Graph()) as sess:
+            tf.import_graph_def(infer_graph_def, name='')
+            reader = read_output_stream('test_read_chunks', [tf.float16])
+            with ThreadPoolExecutor(max_workers=1) as executor:
+                future = executor.submit(sess.run, 'relu0:0', feed_dict)
+                chunks = self._read_request(sess, reader)
+                result_neuron = future.result()
+        np.testing.assert_allclose(result_neuron, result_ref, rtol=1e-2, atol=1e-2)
+        assert len(chunks) > 1
+        assert len({request_id for _, request_id, _ in chunks}) == 1
+        result_streamed = np.zeros_like(result_neuron)
+        for row_start, _, (rows,) in chunks:
+            result_streamed[row_start:row_start+len(rows)] = rows
+        np.testing.assert_equal(result_streamed, result_neuron)
+
+    def test_overflow(self):
+        os.environ['NEURON_OUTPUT_STREAM_CAPACITY'] = '2'
+        try:
+            infer_graph_def, feed_dict, _ = self._infer_graph_def('test_overflow')
+            if 'NEURON_TF_COMPILE_ONLY' in os.environ:
+                return
+            with tf.Session(graph=tf.Graph()) as sess:
+                tf.import_graph_def(infer_graph_def, name='')
+                reader = read_output_stream('test_overflow', [tf.float16])
+                # nobody reads the 4 shards of this request
+                sess.run('relu0:0', feed_dict)
+                with self.assertRaises(tf.errors.ResourceExhaustedError):
+                    sess.run(reader)
+                # the stream works again for later requests
+                small_feed_dict = {'input0:0': feed_dict['input0:0'][:2]}
+                result_neuron = sess.run('relu0:0', small_feed_dict)
+                chunks = self._read_request(sess, reader)
+        finally:
+            del os.environ['NEURON_OUTPUT_STREAM_CAPACITY']
+        assert len(chunks) == 1
+        row_start, _, (rows,) = chunks[0]
+        assert row_start == 0
+        np.testing.assert_equal(rows, result_neuron)
+
+    def test_cancel_waiting_read(self):
+        if 'NEURON_TF_COMPILE_ONLY' in os.environ:
+            return
+        with tf.Session(graph=tf.Graph()) as sess:
+            reader = read_output_stream('test_cancel_waiting_read', [tf.float16])
+            run_options = tf.RunOptions(timeout_in_ms=200)
+            with self.assertRaises(tf.errors.DeadlineExceededError):
+                sess.run(reader, options=run_options)
+
+
+if __name__ == '__main__':
+    unittest.main()
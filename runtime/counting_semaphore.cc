@@ -0,0 +1,190 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "counting_semaphore.h"
+#include <climits>
+#include <thread>
+#include "tensorflow/core/platform/logging.h"
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tensorflow {
+namespace neuron {
+
+static const int SPIN_COUNT = 128;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Blocks only if *addr still equals expected; spurious wakeups are allowed.
+static inline void futex_wait(std::atomic<int32_t>* addr, int32_t expected) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+#else
+  std::this_thread::yield();
+#endif
+}
+
+static inline void futex_wake(std::atomic<int32_t>* addr, int32_t count) {
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<int32_t*>(addr), FUTEX_WAKE_PRIVATE,
+          count, nullptr, nullptr, 0);
+#endif
+}
+
+CountingSemaphore::CountingSemaphore(int64 capacity, bool fair)
+    : fair_(fair),
+      value_(capacity),
+      num_parked_(0),
+      multi_unit_waiters_(false),
+      next_ticket_(0),
+      now_serving_(0),
+      num_parked_in_line_(0) {
+  CHECK_GE(capacity, 0);
+  CHECK_LE(capacity, INT_MAX);
+}
+
+bool CountingSemaphore::try_acquire(int32_t amount) {
+  int32_t value = value_.load(std::memory_order_relaxed);
+  while (value >= amount) {
+    if (value_.compare_exchange_weak(value, value - amount,
+                                     std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void CountingSemaphore::acquire_units(int32_t amount) {
+  for (int spin = 0; spin < SPIN_COUNT; ++spin) {
+    if (TF_PREDICT_TRUE(try_acquire(amount))) {
+      return;
+    }
+    cpu_relax();
+  }
+  if (amount > 1) {
+    multi_unit_waiters_.store(true, std::memory_order_relaxed);
+  }
+  // Release increments value_ before reading num_parked_, and we increment
+  // num_parked_ before reading value_, so either we see the new value or the
+  // releaser sees us parked and wakes us up
+  num_parked_.fetch_add(1);
+  while (true) {
+    int32_t value = value_.load();
+    if (value >= amount) {
+      if (value_.compare_exchange_weak(value, value - amount)) {
+        break;
+      }
+      continue;
+    }
+    futex_wait(&value_, value);
+  }
+  num_parked_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void CountingSemaphore::Acquire(int64 amount) {
+  CHECK_GE(amount, 0);
+  CHECK_LE(amount, INT_MAX);
+  if (TF_PREDICT_TRUE(!fair_)) {
+    acquire_units(amount);
+    return;
+  }
+
+  // wait for our turn in line, then for the units
+  int32_t ticket = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+  int spin = 0;
+  for (; spin < SPIN_COUNT; ++spin) {
+    if (now_serving_.load(std::memory_order_acquire) == ticket) {
+      break;
+    }
+    cpu_relax();
+  }
+  if (TF_PREDICT_FALSE(SPIN_COUNT == spin)) {
+    std::atomic<int32_t>* slot =
+        &ticket_slots_[(uint32_t)ticket % NUM_TICKET_SLOTS].generation;
+    num_parked_in_line_.fetch_add(1);
+    while (true) {
+      // read the generation before checking our turn; the previous holder
+      // bumps it after advancing now_serving_, so the futex cannot miss it
+      int32_t generation = slot->load();
+      if (now_serving_.load() == ticket) {
+        break;
+      }
+      futex_wait(slot, generation);
+    }
+    num_parked_in_line_.fetch_sub(1, std::memory_order_relaxed);
+  }
+  acquire_units(amount);
+  int32_t next_ticket = ticket + 1;
+  now_serving_.store(next_ticket);
+  if (num_parked_in_line_.load() > 0) {
+    std::atomic<int32_t>* slot =
+        &ticket_slots_[(uint32_t)next_ticket % NUM_TICKET_SLOTS].generation;
+    slot->fetch_add(1);
+    // more than one thread shares a slot only when the line is longer than
+    // NUM_TICKET_SLOTS; those wake up, see it is not their turn and park again
+    futex_wake(slot, INT_MAX);
+  }
+}
+
+void CountingSemaphore::Release(int64 amount) {
+  CHECK_GE(amount, 0);
+  value_.fetch_add(amount);
+  if (TF_PREDICT_FALSE(num_parked_.load() > 0)) {
+    bool wake_all = multi_unit_waiters_.load(std::memory_order_relaxed);
+    futex_wake(&value_, wake_all ? INT_MAX : amount);
+  }
+}
+
+CountingSemaphore::ScopedReservation::~ScopedReservation() {
+  if (semaphore_) {
+    semaphore_->Release(amount_);
+  }
+}
+
+CountingSemaphore::ScopedReservation::ScopedReservation(
+    ScopedReservation&& other) noexcept {
+  semaphore_ = other.semaphore_;
+  amount_ = other.amount_;
+  other.semaphore_ = nullptr;
+}
+
+CountingSemaphore::ScopedReservation&
+CountingSemaphore::ScopedReservation::operator=(
+    ScopedReservation&& other) noexcept {
+  semaphore_ = other.semaphore_;
+  amount_ = other.amount_;
+  other.semaphore_ = nullptr;
+  return *this;
+}
+
+CountingSemaphore::ScopedReservation CountingSemaphore::ScopedAcquire(
+    int64 amount) {
+  Acquire(amount);
+  return ScopedReservation(this, amount);
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,88 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_COUNTING_SEMAPHORE_H_
+#define TENSORFLOW_NEURON_RUNTIME_COUNTING_SEMAPHORE_H_
+
+#include <atomic>
+#include <cstdint>
+#include "tensorflow/core/framework/types.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Counting semaphore with the same interface as xla::Semaphore. Acquire and
+// Release are a single atomic operation when there is no contention; a
+// blocked Acquire spins briefly and then parks the thread on a futex, and
+// Release only makes a syscall when some thread is parked.
+//
+// By default waiters may be overtaken by newly arriving threads, which gives
+// the best throughput. With fair = true, threads acquire in arrival order.
+class CountingSemaphore {
+ public:
+  explicit CountingSemaphore(int64 capacity, bool fair = false);
+
+  // Acquires `amount` units. Blocks until `amount` units are available.
+  void Acquire(int64 amount);
+
+  // Returns `amount` units to the semaphore.
+  void Release(int64 amount);
+
+  class ScopedReservation {
+   public:
+    ScopedReservation(CountingSemaphore* semaphore, int64 amount)
+        : semaphore_(semaphore), amount_(amount) {}
+    ~ScopedReservation();
+
+    ScopedReservation(const ScopedReservation&) = delete;
+    ScopedReservation(ScopedReservation&& other) noexcept;
+    ScopedReservation& operator=(const ScopedReservation&) = delete;
+    ScopedReservation& operator=(ScopedReservation&& other) noexcept;
+
+   private:
+    CountingSemaphore* semaphore_;
+    int64 amount_;
+  };
+  // RAII version of Acquire. Releases the reservation when the
+  // ScopedReservation is destroyed.
+  ScopedReservation ScopedAcquire(int64 amount);
+
+ private:
+  bool try_acquire(int32_t amount);
+  void acquire_units(int32_t amount);
+  const bool fair_;
+  // futex words must be 32 bits wide
+  std::atomic<int32_t> value_;
+  std::atomic<int32_t> num_parked_;
+  // set once any thread parks waiting for more than one unit, after which a
+  // release must wake every parked thread instead of just `amount` of them
+  std::atomic<bool> multi_unit_waiters_;
+  // ticket lock used to order waiters in fair mode; a parked ticket holder
+  // sleeps on the futex word of its slot so that each hand-off wakes only
+  // the next holder rather than the whole line
+  static const int NUM_TICKET_SLOTS = 64;
+  struct alignas(64) TicketSlot {
+    std::atomic<int32_t> generation{0};
+  };
+  std::atomic<int32_t> next_ticket_;
+  std::atomic<int32_t> now_serving_;
+  std::atomic<int32_t> num_parked_in_line_;
+  TicketSlot ticket_slots_[NUM_TICKET_SLOTS];
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_COUNTING_SEMAPHORE_H_
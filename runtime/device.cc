@@ -19,6 +19,7 @@ limitations under the License.
 #include "device.h"
 #include "engine.h"
 #include "env.h"
+#include "tensor_util.h"
 #include "tensorflow/core/common_runtime/device_factory.h"
 #include "tensorflow/core/common_runtime/process_state.h"
 #include "tensorflow/core/framework/tensor_util.h"
@@ -27,15 +28,48 @@ limitations under the License.
 namespace tensorflow {
 namespace neuron {
 
+static const int64 kMinStagingBytes = 64 * 1024;
+
+// Tensors smaller than NEURON_SHM_STAGING_MIN_BYTES (default 64 KiB) are not
+// staged, as mapping a shared memory buffer for a new size costs far more
+// than the copy it saves.
+static int64 min_staging_bytes() {
+  static const int64 min_bytes = [] {
+    int value = stoi_no_throw(env_get("NEURON_SHM_STAGING_MIN_BYTES", ""));
+    return value >= 0 ? (int64)value : kMinStagingBytes;
+  }();
+  return min_bytes;
+}
+
 class NeuronDeviceContext : public DeviceContext {
  public:
-  NeuronDeviceContext() = default;
+  explicit NeuronDeviceContext(SharedMemoryAllocator* shm_allocator)
+      : shm_allocator_(shm_allocator) {}
 
   void CopyCPUTensorToDevice(const Tensor* cpu_tensor, Device* device,
                              Tensor* device_tensor, StatusCallback done,
                              bool sync_dst_compute) const override {
     VLOG(1) << "copying " << cpu_tensor << " to " << device_tensor
             << " in NeuronDeviceContext::CopyCPUTensorToDevice";
+    if (TF_PREDICT_TRUE(need_shm_staging(*cpu_tensor))) {
+      // stage the tensor in shared memory so that NeuronModel::compute can
+      // pass it to neuron-rtd without making another copy
+      Tensor shm_tensor(shm_allocator_, cpu_tensor->dtype(),
+                        cpu_tensor->shape());
+      if (TF_PREDICT_TRUE(shm_tensor.IsInitialized() &&
+                          shm_allocator_->is_shm_tensor(shm_tensor))) {
+        thread::ThreadPool* pool =
+            device->tensorflow_cpu_worker_threads()->workers;
+        Status status = tensor_copy(&shm_tensor, *cpu_tensor, pool);
+        if (TF_PREDICT_TRUE(status.ok())) {
+          *device_tensor = shm_tensor;
+          done(Status::OK());
+          return;
+        }
+        VLOG(1) << "shm staging failed with " << status
+                << "; falling back to aliasing the cpu tensor";
+      }
+    }
     *device_tensor = *cpu_tensor;
     done(Status::OK());
   }
@@ -55,6 +89,19 @@ class NeuronDeviceContext : public DeviceContext {
     *output_tensor = *input_tensor;
     done(Status::OK());
   }
+
+ private:
+  // Staging is only an optimization, so it gives way to the plain copy once
+  // the allocator would have to map more than its limit to keep it up
+  bool need_shm_staging(const Tensor& cpu_tensor) const {
+    return nullptr != shm_allocator_ && shm_allocator_->is_valid() &&
+           DataTypeCanUseMemcpy(cpu_tensor.dtype()) &&
+           cpu_tensor.NumElements() > 0 &&
+           (int64)cpu_tensor.TotalBytes() >= min_staging_bytes() &&
+           !shm_allocator_->is_shm_tensor(cpu_tensor) &&
+           shm_allocator_->has_room_for(cpu_tensor.TotalBytes());
+  }
+  SharedMemoryAllocator* shm_allocator_;  // Not owned
 };
 
 NeuronDevice::NeuronDevice(const SessionOptions& options,
@@ -91,6 +138,17 @@ Status NeuronDevice::MakeTensorFromProto(const TensorProto& tensor_proto,
   VLOG(1) << "entering NeuronDevice::MakeTensorFromProto";
   if (tensor_proto.dtype() > 0 && tensor_proto.dtype() <= DataType_MAX) {
     Tensor parsed(tensor_proto.dtype());
+    if (on_shm(alloc_attrs) && shm_allocator_->is_valid() &&
+        DataTypeCanUseMemcpy(tensor_proto.dtype())) {
+      if (parsed.FromProto(shm_allocator_, tensor_proto) &&
+          shm_allocator_->is_shm_tensor(parsed)) {
+        *tensor = std::move(parsed);
+        return Status::OK();
+      }
+      VLOG(1) << "cannot parse tensor proto into shared memory; falling back "
+                 "to cpu allocator";
+      parsed = Tensor(tensor_proto.dtype());
+    }
     if (parsed.FromProto(cpu_allocator_, tensor_proto)) {
       *tensor = std::move(parsed);
       return Status::OK();
@@ -120,14 +178,14 @@ Status NeuronDevice::FillContextMap(const Graph* graph,
                                     DeviceContextMap* device_context_map) {
   device_context_map->resize(graph->num_node_ids());
   for (Node* n : graph->nodes()) {
-    (*device_context_map)[n->id()] = new NeuronDeviceContext;
+    (*device_context_map)[n->id()] = new NeuronDeviceContext(shm_allocator_);
   }
   return Status::OK();
 }
 #endif
 
 Status NeuronDevice::TryGetDeviceContext(DeviceContext** out_context) {
-  *out_context = new NeuronDeviceContext;
+  *out_context = new NeuronDeviceContext(shm_allocator_);
   return Status::OK();
 }
 
@@ -139,6 +197,11 @@ bool NeuronDevice::on_shm(const AllocatorAttributes& attr) {
   return attr.value & (0x1 << NeuronDevice::on_shm_shift_);
 }
 
+void NeuronDevice::set_on_valid_shm(AllocatorAttributes* attr) {
+  NeuronEngineManager& nem = NeuronEngineManager::GetNeuronEngineManager();
+  set_on_shm(attr, nem.get_shm_allocator()->is_valid());
+}
+
 class NeuronDeviceFactory : public DeviceFactory {
  public:
   Status ListPhysicalDevices(std::vector<std::string>* devices) override {
@@ -55,6 +55,9 @@ class NeuronDevice : public LocalDevice {
   // devices are responsible for setting those 8 bits appropriately.
   static void set_on_shm(AllocatorAttributes* attr, bool v);
   static bool on_shm(const AllocatorAttributes& attr);
+  // Sets the on_shm bit only if the shared memory allocator is usable, so
+  // that host kernels on this device can write their outputs to shm directly.
+  static void set_on_valid_shm(AllocatorAttributes* attr);
 
  private:
   Allocator* cpu_allocator_;  // Not owned
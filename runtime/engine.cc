@@ -14,8 +14,12 @@ limitations under the License.
 ==============================================================================*/
 
 #include "engine.h"
+#include <algorithm>
 #include "env.h"
 #include "macros.h"
+#include "tracer.h"
+#include "tensorflow/core/platform/env.h"
+#include "tensorflow/core/platform/fingerprint.h"
 
 namespace tensorflow {
 namespace neuron {
@@ -290,17 +294,31 @@ Status NeuronEngine::initialize(
       num_cores_ = num_cores_req;
     }
   }
-  running_nn_id_ = NRT_INVALID_NN_ID;
+  running_model_ = nullptr;
   return Status::OK();
 }
 
-Status NeuronEngine::load(uint32_t* nn_id, const StringPiece& executable,
+Status NeuronEngine::load(ModelDescriptorPtr* model,
+                          const StringPiece& executable,
                           const uint32_t timeout, const uint32_t ninfer,
                           const bool profile_enabled) {
   tensorflow::mutex_lock lock(mutex_eg_);
   if (closed_) {
     return errors::Aborted("neuron_engine is closed");
   }
+  // NeuronOps compiled from structurally identical subgraphs carry the same
+  // executable; load it once and share the nn_id among them. Profiling
+  // sessions are per NeuronOp, so profiled models are never shared.
+  uint64 executable_key = FingerprintCat64(
+      Fingerprint64(executable), ((uint64)timeout << 32) | ninfer);
+  if (!profile_enabled && executable_to_model_.count(executable_key)) {
+    ModelDescriptorPtr desc = executable_to_model_[executable_key];
+    ++desc->num_users;
+    *model = desc;
+    VLOG(1) << "sharing " << desc->nn_id << " among " << desc->num_users
+            << " models";
+    return Status::OK();
+  }
   uint32_t first_nn_id = NRT_INVALID_NN_ID;
   std::vector<uint32_t> all_nn_ids;
   if (vec_eg_id_.size() == 1) {
@@ -333,78 +351,180 @@ Status NeuronEngine::load(uint32_t* nn_id, const StringPiece& executable,
   } else {
     return errors::Unavailable("NeuronEngine is uninitialized");
   }
-  if (nn_id_to_all_nn_ids_.count(first_nn_id)) {
+  if (nn_id_to_model_.count(first_nn_id)) {
     for (const uint32_t nid : all_nn_ids) {
       TF_LOG_IF_ERROR(runtime_.unload(nid));
     }
     return errors::AlreadyExists("nn ", first_nn_id, " is already mapped");
   }
-  nn_id_to_all_nn_ids_[first_nn_id] = all_nn_ids;
-  nn_id_to_active_idx_[first_nn_id] = 0;
-  std::vector<std::shared_ptr<xla::Semaphore> >& sems =
-      nn_id_to_sems_[first_nn_id];
+  // NEURON_FAIR_REPLICA_SLOTS=1 hands out replica slots in arrival order at
+  // some cost in throughput when there are more threads than cores
+  bool fair = stoi_no_throw(env_get("NEURON_FAIR_REPLICA_SLOTS", "0")) > 0;
+  ModelDescriptorPtr desc = std::make_shared<ModelDescriptor>();
+  desc->nn_id = first_nn_id;
+  desc->replica_nn_ids = all_nn_ids;
   for (const auto& nn_id : all_nn_ids) {
-    VLOG(1) << "model " << nn_id << " infer semaphore capacity " << ninfer;
-    sems.push_back(std::make_shared<xla::Semaphore>(ninfer));
-  }
-  *nn_id = first_nn_id;
+    VLOG(1) << "model " << nn_id << " infer semaphore capacity " << ninfer
+            << ", fair " << fair;
+    desc->replica_sems.emplace_back(new CountingSemaphore(ninfer, fair));
+  }
+  desc->replica_num_infers.resize(all_nn_ids.size(), 0);
+  desc->capacity = (int64)ninfer * all_nn_ids.size();
+  desc->loaded = true;
+  desc->num_users = 1;
+  nn_id_to_model_[first_nn_id] = desc;
+  if (!profile_enabled) {
+    desc->executable_key = executable_key;
+    executable_to_model_[executable_key] = desc;
+  }
+  *model = desc;
   VLOG(1) << "successfully loaded " << first_nn_id;
   return Status::OK();
 }
 
-void NeuronEngine::unload(const uint32_t nn_id) {
+void NeuronEngine::unload(ModelDescriptor* model) {
   tensorflow::mutex_lock lock(mutex_eg_);
   if (closed_) {
     return;
   }
-  if (!nn_id_to_all_nn_ids_.count(nn_id)) {
-    VLOG(1) << "model " << nn_id << " is not loaded";
+  if (!model->loaded) {
+    VLOG(1) << "model " << model->nn_id << " is not loaded";
+    return;
+  }
+  if (--model->num_users > 0) {
+    VLOG(1) << "model " << model->nn_id << " is still used by "
+            << model->num_users << " models";
     return;
   }
   // stop
-  if (running(nn_id)) {
+  if (running(model)) {
     // stop all models
-    for (const uint32_t nid : nn_id_to_all_nn_ids_[nn_id]) {
+    for (const uint32_t nid : model->replica_nn_ids) {
       TF_LOG_IF_ERROR(runtime_.stop(nid));
     }
-    set_running(NRT_INVALID_NN_ID);
+    set_running(nullptr);
   }
 
   // unload all models
-  for (const uint32_t nid : nn_id_to_all_nn_ids_[nn_id]) {
+  for (const uint32_t nid : model->replica_nn_ids) {
     TF_LOG_IF_ERROR(runtime_.unload(nid));
   }
-  nn_id_to_all_nn_ids_.erase(nn_id);
+  model->loaded = false;
+  nn_id_to_model_.erase(model->nn_id);
+  auto shared = executable_to_model_.find(model->executable_key);
+  if (shared != executable_to_model_.end() && shared->second.get() == model) {
+    executable_to_model_.erase(shared);
+  }
   VLOG(1) << "unload: number of NEFFs: " << num_executable();
 }
 
-Status NeuronEngine::infer(RuntimeIO* runtime_io) {
-  uint32_t nn_id = runtime_io->get_nn_id();
+Status NeuronEngine::infer(RuntimeIO* runtime_io, ModelDescriptor* model,
+                           ModelMetrics* metrics) {
   SemResQueue sem_res_queue;
+  size_t replica_idx = 0;
+  uint32_t active_nn_id = NRT_INVALID_NN_ID;
+  Env* env = Env::Default();
+  uint64 timestamp = env->NowMicros();
+  uint64 device_timestamp = 0;
   {
+    TraceSpan lock_span("engine_lock_wait");
     tensorflow::mutex_lock lock(mutex_eg_);
-    TF_RETURN_IF_ERROR(start_model_unsafe(nn_id));
-    uint32_t active_nn_id = NRT_INVALID_NN_ID;
-    std::shared_ptr<xla::Semaphore> sem;
-    TF_RETURN_IF_ERROR(get_active(&active_nn_id, &sem, nn_id));
+    lock_span.end();
+    uint64 locked_timestamp = env->NowMicros();
+    if (TF_PREDICT_TRUE(nullptr != metrics)) {
+      metrics->record_engine_lock_wait(locked_timestamp - timestamp);
+    }
+    TF_RETURN_IF_ERROR(start_model_unsafe(model, metrics));
+    CountingSemaphore* sem = nullptr;
+    TF_RETURN_IF_ERROR(
+        get_active(&replica_idx, &active_nn_id, &sem, model, metrics));
     runtime_io->set_nn_id(active_nn_id);
+    TraceSpan sem_span("semaphore_wait", active_nn_id);
+    timestamp = env->NowMicros();
     sem_res_queue.push(sem->ScopedAcquire(1));
-    TF_RETURN_IF_ERROR(runtime_.infer_post(runtime_io));
-  }
-  return runtime_.infer_wait(runtime_io);
+    sem_span.end();
+    uint64 acquired_timestamp = env->NowMicros();
+    device_timestamp = acquired_timestamp;
+    if (TF_PREDICT_TRUE(nullptr != metrics)) {
+      metrics->begin_device_busy(replica_idx, acquired_timestamp);
+    }
+    TraceSpan post_span("infer_post", active_nn_id);
+    Status status = runtime_.infer_post(runtime_io);
+    uint64 posted_timestamp = env->NowMicros();
+    if (TF_PREDICT_TRUE(nullptr != metrics)) {
+      metrics->record_semaphore_wait(replica_idx,
+                                     acquired_timestamp - timestamp);
+      metrics->record_infer_post(replica_idx,
+                                 posted_timestamp - acquired_timestamp);
+      if (TF_PREDICT_FALSE(!status.ok())) {
+        metrics->end_device_busy(replica_idx, posted_timestamp);
+      }
+    }
+    TF_RETURN_IF_ERROR(status);
+    timestamp = posted_timestamp;
+  }
+  TraceSpan wait_span("infer_wait", active_nn_id);
+  Status status = runtime_.infer_wait(runtime_io);
+  uint64 done_timestamp = env->NowMicros();
+  runtime_io->set_device_us(done_timestamp - device_timestamp);
+  if (TF_PREDICT_TRUE(nullptr != metrics)) {
+    metrics->record_infer_wait(replica_idx, done_timestamp - timestamp);
+    metrics->end_device_busy(replica_idx, done_timestamp);
+  }
+  return status;
 }
 
 Status NeuronEngine::infer_with_profiling(RuntimeIO* runtime_io,
+                                          ModelDescriptor* model,
+                                          ModelMetrics* metrics,
                                           ProfilerInterface* profile) {
-  uint32_t nn_id = runtime_io->get_nn_id();
-  tensorflow::mutex_lock lock(mutex_eg_);
-  TF_RETURN_IF_ERROR(start_model_unsafe(nn_id));
-  if (profile->enabled_) profile->start_session(nrtd_address_, nn_id);
-  Status status_post = runtime_.infer_post(runtime_io);
-  Status status_wait = runtime_.infer_wait(runtime_io);
-  if (profile->enabled_) profile->stop_session();
-  TF_RETURN_IF_ERROR(status_post);
-  return status_wait;
+  // the profiling session is attached to one replica and started in the
+  // background; this request runs unprofiled unless the session is already up
+  size_t replica_idx = 0;
+  uint32_t active_nn_id = NRT_INVALID_NN_ID;
+  {
+    tensorflow::mutex_lock lock(mutex_eg_);
+    Status status = start_model_unsafe(model, metrics);
+    if (!status.ok()) {
+      profile->stop_session();
+      return status;
+    }
+    active_nn_id = model->replica_nn_ids[0];
+  }
+  if (!profile->start_session(nrtd_address_, &active_nn_id)) {
+    return infer(runtime_io, model, metrics);
+  }
+  Status status;
+  SemResQueue sem_res_queue;
+  uint64 device_timestamp = 0;
+  {
+    tensorflow::mutex_lock lock(mutex_eg_);
+    status = start_model_unsafe(model, metrics);
+    if (status.ok()) {
+      auto found = std::find(model->replica_nn_ids.begin(),
+                             model->replica_nn_ids.end(), active_nn_id);
+      if (found == model->replica_nn_ids.end()) {
+        // the model was reloaded since the session started
+        status = errors::Aborted("profiled nn ", active_nn_id, " is gone");
+      } else {
+        replica_idx = found - model->replica_nn_ids.begin();
+        ++model->replica_num_infers[replica_idx];
+        if (TF_PREDICT_TRUE(nullptr != metrics)) {
+          metrics->count_inference(replica_idx);
+        }
+        runtime_io->set_nn_id(active_nn_id);
+        sem_res_queue.push(model->replica_sems[replica_idx]->ScopedAcquire(1));
+        device_timestamp = Env::Default()->NowMicros();
+        status = runtime_.infer_post(runtime_io);
+      }
+    }
+  }
+  if (status.ok()) {
+    status = runtime_.infer_wait(runtime_io);
+    runtime_io->set_device_us(Env::Default()->NowMicros() - device_timestamp);
+  }
+  profile->stop_session();
+  return status;
 }
 
 void NeuronEngine::clear(bool from_global_state) {
@@ -415,17 +535,16 @@ void NeuronEngine::clear(bool from_global_state) {
   if (from_global_state) {
     closed_ = true;
   }
-  for (const auto& nn_id_pair : nn_id_to_all_nn_ids_) {
-    const uint32_t nn_id = nn_id_pair.first;
-    const std::vector<uint32_t>& all_nn_ids = nn_id_pair.second;
-    if (running(nn_id)) {
+  for (const auto& nn_id_pair : nn_id_to_model_) {
+    ModelDescriptor* model = nn_id_pair.second.get();
+    if (running(model)) {
       // stop all models
-      for (const uint32_t nid : all_nn_ids) {
+      for (const uint32_t nid : model->replica_nn_ids) {
         TF_LOG_IF_ERROR(runtime_.stop(nid));
       }
     }
     // unload all models
-    for (const uint32_t nid : all_nn_ids) {
+    for (const uint32_t nid : model->replica_nn_ids) {
       TF_LOG_IF_ERROR(runtime_.unload(nid, from_global_state));
     }
     VLOG(1) << "unload from NeuronEngine::clear";
@@ -435,74 +554,90 @@ void NeuronEngine::clear(bool from_global_state) {
   }
   VLOG(1) << "destroy_eg from NeuronEngine::clear";
   if (!from_global_state) {
-    set_running(NRT_INVALID_NN_ID);
-    nn_id_to_all_nn_ids_.clear();
+    set_running(nullptr);
+    for (const auto& nn_id_pair : nn_id_to_model_) {
+      nn_id_pair.second->loaded = false;
+    }
+    nn_id_to_model_.clear();
+    executable_to_model_.clear();
     vec_eg_id_.clear();
   }
 }
 
-Status NeuronEngine::start_model_unsafe(const uint32_t nn_id) {
+Status NeuronEngine::start_model_unsafe(ModelDescriptor* model,
+                                        ModelMetrics* metrics) {
   if (TF_PREDICT_FALSE(closed_)) {
     return errors::Aborted("neuron_engine is closed");
   }
-  if (TF_PREDICT_FALSE(!running(nn_id) && is_busy())) {
-    // if nn_id is not running, stop the current running model
-    std::queue<RuntimeStopper> stopper_queue;
-    for (const uint32_t nid : nn_id_to_all_nn_ids_[nn_get_current_running()]) {
-      stopper_queue.emplace();
-      TF_RETURN_IF_ERROR(runtime_.post_stop(&stopper_queue.back(), nid));
-    }
-    for (const uint32_t nid : nn_id_to_all_nn_ids_[nn_get_current_running()]) {
-      TF_RETURN_IF_ERROR(runtime_.wait_stop(&stopper_queue.front()));
-      stopper_queue.pop();
-      VLOG(1) << "stopped model " << nid;
-    }
-    set_running(NRT_INVALID_NN_ID);
+  if (TF_PREDICT_FALSE(!model->loaded)) {
+    return errors::InvalidArgument("model ", model->nn_id, " is not loaded");
+  }
+  if (TF_PREDICT_TRUE(running(model))) {
+    return Status::OK();
+  }
+  TraceSpan switch_span("model_switch", model->nn_id);
+  if (TF_PREDICT_TRUE(nullptr != metrics)) {
+    metrics->count_model_switch();
+  }
+  if (TF_PREDICT_FALSE(is_busy())) {
+    // if model is not running, stop the current running model
+    TF_RETURN_IF_ERROR(stop_model_unsafe(running_model_));
+    set_running(nullptr);
   }
   if (TF_PREDICT_FALSE(!is_busy())) {
-    // if no model is running, start nn_id
+    // if no model is running, start model
     std::queue<RuntimeStarter> starter_queue;
-    for (const uint32_t nid : nn_id_to_all_nn_ids_[nn_id]) {
+    for (const uint32_t nid : model->replica_nn_ids) {
       starter_queue.emplace();
       TF_RETURN_IF_ERROR(runtime_.post_start(&starter_queue.back(), nid));
     }
-    for (const uint32_t nid : nn_id_to_all_nn_ids_[nn_id]) {
+    for (const uint32_t nid : model->replica_nn_ids) {
       TF_RETURN_IF_ERROR(runtime_.wait_start(&starter_queue.front()));
       starter_queue.pop();
       VLOG(1) << "started model " << nid;
     }
-    set_running(nn_id);
+    set_running(model);
   }
   return Status::OK();
 }
 
-inline bool NeuronEngine::is_busy() {
-  return running_nn_id_ != NRT_INVALID_NN_ID;
+Status NeuronEngine::stop_model_unsafe(ModelDescriptor* model) {
+  std::queue<RuntimeStopper> stopper_queue;
+  for (const uint32_t nid : model->replica_nn_ids) {
+    stopper_queue.emplace();
+    TF_RETURN_IF_ERROR(runtime_.post_stop(&stopper_queue.back(), nid));
+  }
+  for (const uint32_t nid : model->replica_nn_ids) {
+    TF_RETURN_IF_ERROR(runtime_.wait_stop(&stopper_queue.front()));
+    stopper_queue.pop();
+    VLOG(1) << "stopped model " << nid;
+  }
+  return Status::OK();
 }
 
-inline bool NeuronEngine::running(uint32_t nn_id) {
-  return running_nn_id_ == nn_id && NRT_INVALID_NN_ID != running_nn_id_;
-}
+inline bool NeuronEngine::is_busy() { return nullptr != running_model_; }
 
-inline uint32_t NeuronEngine::nn_get_current_running() {
-  return running_nn_id_;
+inline bool NeuronEngine::running(ModelDescriptor* model) {
+  return nullptr != model && running_model_ == model;
 }
 
-inline void NeuronEngine::set_running(uint32_t nn_id) {
-  running_nn_id_ = nn_id;
+inline void NeuronEngine::set_running(ModelDescriptor* model) {
+  running_model_ = model;
 }
 
-Status NeuronEngine::get_active(uint32_t* active_nn_id,
-                                std::shared_ptr<xla::Semaphore>* sem,
-                                const uint32_t nn_id) {
-  if (TF_PREDICT_FALSE(!nn_id_to_all_nn_ids_.count(nn_id))) {
-    return errors::InvalidArgument("no active id can be found from nn id ",
-                                   nn_id);
-  }
-  size_t idx = nn_id_to_active_idx_[nn_id];
-  nn_id_to_active_idx_[nn_id] = (idx + 1) % nn_id_to_all_nn_ids_[nn_id].size();
-  *active_nn_id = nn_id_to_all_nn_ids_[nn_id][idx];
-  *sem = nn_id_to_sems_[nn_id][idx];
+Status NeuronEngine::get_active(size_t* replica_idx, uint32_t* active_nn_id,
+                                CountingSemaphore** sem,
+                                ModelDescriptor* model,
+                                ModelMetrics* metrics) {
+  size_t idx = model->active_idx;
+  model->active_idx = (idx + 1) % model->replica_nn_ids.size();
+  *replica_idx = idx;
+  *active_nn_id = model->replica_nn_ids[idx];
+  *sem = model->replica_sems[idx].get();
+  ++model->replica_num_infers[idx];
+  if (TF_PREDICT_TRUE(nullptr != metrics)) {
+    metrics->count_inference(idx);
+  }
   return Status::OK();
 }
 
@@ -16,10 +16,12 @@ limitations under the License.
 #ifndef TENSORFLOW_NEURON_RUNTIME_ENGINE_H_
 #define TENSORFLOW_NEURON_RUNTIME_ENGINE_H_
 
+#include <memory>
 #include <queue>
+#include "counting_semaphore.h"
+#include "metrics.h"
 #include "profiler.h"
 #include "runtime_grpc.h"
-#include "semaphore.h"
 #include "shared_memory.h"
 #include "tensor_util.h"
 #include "tensorflow/core/platform/mutex.h"
@@ -27,46 +29,68 @@ limitations under the License.
 namespace tensorflow {
 namespace neuron {
 
-typedef std::queue<xla::Semaphore::ScopedReservation> SemResQueue;
+typedef std::queue<CountingSemaphore::ScopedReservation> SemResQueue;
+
+// Dispatch state of one loaded model and its replicas. NeuronEngine creates
+// it in load() and NeuronModel keeps the returned pointer, so the inference
+// path reaches replica ids and semaphores without any nn_id lookup. Fields
+// other than the semaphores are guarded by the owning engine's mutex.
+struct ModelDescriptor {
+  uint32_t nn_id = NRT_INVALID_NN_ID;  // nn_id of the first replica
+  std::vector<uint32_t> replica_nn_ids;
+  std::vector<std::unique_ptr<CountingSemaphore> > replica_sems;
+  std::vector<uint64> replica_num_infers;
+  int64 capacity = 0;  // max in-flight inferences across all replicas
+  size_t active_idx = 0;
+  bool loaded = false;
+  // identical executables loaded by several NeuronModels share a descriptor
+  uint64 executable_key = 0;
+  int num_users = 0;
+};
+
+typedef std::shared_ptr<ModelDescriptor> ModelDescriptorPtr;
 
 class NeuronEngine {
  public:
   NeuronEngine() {}
   Status initialize(const std::string& nrtd_address, const int num_cores_req,
                     const int num_dup, std::shared_ptr<RuntimeSession> session);
-  Status load(uint32_t* nn_id, const StringPiece& executable,
+  Status load(ModelDescriptorPtr* model, const StringPiece& executable,
               const uint32_t timeout, const uint32_t ninfer,
               const bool profile_enabled);
-  Status infer(RuntimeIO* runtime_io);
-  Status infer_with_profiling(RuntimeIO* runtime_io,
+  // metrics belong to the calling NeuronModel, as a descriptor may be shared
+  Status infer(RuntimeIO* runtime_io, ModelDescriptor* model,
+               ModelMetrics* metrics);
+  Status infer_with_profiling(RuntimeIO* runtime_io, ModelDescriptor* model,
+                              ModelMetrics* metrics,
                               ProfilerInterface* profile);
-  void unload(const uint32_t nn_id);
+  void unload(ModelDescriptor* model);
   void clear(bool from_global_state = false);
-  size_t num_executable() { return nn_id_to_all_nn_ids_.size(); };
+  size_t num_executable() { return nn_id_to_model_.size(); };
   uint32_t num_cores() { return num_cores_; };
   std::shared_ptr<RuntimeSession> get_session() { return session_; }
 
  private:
-  Status start_model_unsafe(const uint32_t nn_id);
+  Status start_model_unsafe(ModelDescriptor* model, ModelMetrics* metrics);
+  Status stop_model_unsafe(ModelDescriptor* model);
   bool is_busy();
-  bool running(uint32_t nn_id);
-  void set_running(uint32_t nn_id);
-  uint32_t nn_get_current_running();
-  Status get_active(uint32_t* active_nn_id,
-                    std::shared_ptr<xla::Semaphore>* sem, const uint32_t nn_id);
+  bool running(ModelDescriptor* model);
+  void set_running(ModelDescriptor* model);
+  Status get_active(size_t* replica_idx, uint32_t* active_nn_id,
+                    CountingSemaphore** sem, ModelDescriptor* model,
+                    ModelMetrics* metrics);
   tensorflow::mutex mutex_eg_;
   bool closed_ = false;
   RuntimeGRPC runtime_;
   uint64_t session_id_ = RuntimeSession::INVALID_ID;
   std::shared_ptr<RuntimeSession> session_ = nullptr;
   std::vector<uint32_t> vec_eg_id_;
-  uint32_t running_nn_id_;
+  ModelDescriptor* running_model_ = nullptr;
   uint32_t num_cores_ = 0;
   std::string nrtd_address_ = "";
-  std::unordered_map<uint32_t, std::vector<uint32_t> > nn_id_to_all_nn_ids_;
-  std::unordered_map<uint32_t, size_t> nn_id_to_active_idx_;
-  std::unordered_map<uint32_t, std::vector<std::shared_ptr<xla::Semaphore> > >
-      nn_id_to_sems_;
+  // only used by load, unload and clear; never on the inference path
+  std::unordered_map<uint32_t, ModelDescriptorPtr> nn_id_to_model_;
+  std::unordered_map<uint64, ModelDescriptorPtr> executable_to_model_;
   TFN_DISALLOW_COPY_MOVE_ASSIGN(NeuronEngine);
 };
 
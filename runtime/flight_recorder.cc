@@ -0,0 +1,172 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "flight_recorder.h"
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include "env.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace neuron {
+
+static const int DEFAULT_CAPACITY = 1024;
+// threshold-triggered dumps are rate limited to one per second
+static const uint64 MIN_THRESHOLD_DUMP_INTERVAL_US = 1000000;
+static const int64 SIGNAL_POLL_INTERVAL_US = 1000000;
+
+// set from the signal handler and serviced by the next recorded request or
+// by the signal watcher thread, since nothing in dump() is async-signal-safe
+static std::atomic<bool> signal_dump_requested(false);
+
+static void handle_dump_signal(int) { signal_dump_requested = true; }
+
+void RequestRecord::set_name(const std::string& op_name) {
+  size_t length = std::min(op_name.size(), MAX_NAME_LENGTH);
+  std::memcpy(name, op_name.data(), length);
+  name[length] = '\0';
+}
+
+FlightRecorder& FlightRecorder::GetFlightRecorder() {
+  // leaked on purpose; the signal watcher thread never exits
+  static FlightRecorder* flight_recorder = new FlightRecorder;
+  return *flight_recorder;
+}
+
+FlightRecorder::FlightRecorder() {
+  std::string capacity_str = env_get("NEURON_FLIGHT_RECORDER_SIZE");
+  int capacity =
+      capacity_str.empty() ? DEFAULT_CAPACITY : stoi_no_throw(capacity_str);
+  capacity_ = capacity > 0 ? capacity : 0;
+  int threshold_us =
+      stoi_no_throw(env_get("NEURON_FLIGHT_RECORDER_THRESHOLD_US", ""));
+  threshold_us_ = threshold_us > 0 ? threshold_us : 0;
+  dump_dir_ = env_get("NEURON_FLIGHT_RECORDER_DIR", "");
+  if (enabled()) {
+    slots_.reset(new Slot[capacity_]);
+    if ("1" == env_get("NEURON_FLIGHT_RECORDER_SIGNAL", "")) {
+      struct sigaction action;
+      std::memset(&action, 0, sizeof(action));
+      action.sa_handler = handle_dump_signal;
+      sigemptyset(&action.sa_mask);
+      action.sa_flags = SA_RESTART;
+      SYS_FAIL_LOG(sigaction(SIGUSR2, &action, nullptr) < 0, "sigaction");
+      signal_watcher_.reset(
+          Env::Default()->StartThread(ThreadOptions(), "neuron_flight_recorder",
+                                      [this] { watch_signal(); }));
+    }
+  }
+}
+
+// Services signals that arrive while no requests are being recorded
+void FlightRecorder::watch_signal() {
+  while (true) {
+    Env::Default()->SleepForMicroseconds(SIGNAL_POLL_INTERVAL_US);
+    if (signal_dump_requested.exchange(false)) {
+      TF_LOG_IF_ERROR(dump("signal"));
+    }
+  }
+}
+
+void FlightRecorder::record(const RequestRecord& record) {
+  if (TF_PREDICT_FALSE(!enabled())) {
+    return;
+  }
+  uint64 idx = next_.fetch_add(1, std::memory_order_relaxed);
+  Slot& slot = slots_[idx % capacity_];
+  slot.seq.store(2 * idx + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.record = record;
+  slot.seq.store(2 * idx + 2, std::memory_order_release);
+
+  if (TF_PREDICT_FALSE(signal_dump_requested.load(std::memory_order_relaxed) &&
+                       signal_dump_requested.exchange(false))) {
+    request_dump("signal");
+  }
+  if (TF_PREDICT_FALSE(threshold_us_ > 0 && record.end_us > threshold_us_)) {
+    uint64 now_us = Env::Default()->NowMicros();
+    uint64 last_us = last_dump_us_.load(std::memory_order_relaxed);
+    if (now_us - last_us >= MIN_THRESHOLD_DUMP_INTERVAL_US &&
+        last_dump_us_.compare_exchange_strong(last_us, now_us)) {
+      request_dump(strings::StrCat(record.name, " took ", record.end_us,
+                                   " us"));
+    }
+  }
+}
+
+void FlightRecorder::request_dump(const std::string& reason) {
+  if (!enabled()) {
+    return;
+  }
+  Env::Default()->SchedClosure(
+      [this, reason] { TF_LOG_IF_ERROR(dump(reason)); });
+}
+
+void FlightRecorder::snapshot(std::vector<RequestRecord>* records) {
+  uint64 end = next_.load(std::memory_order_acquire);
+  uint64 begin = end > capacity_ ? end - capacity_ : 0;
+  records->clear();
+  records->reserve(end - begin);
+  for (uint64 idx = begin; idx < end; ++idx) {
+    Slot& slot = slots_[idx % capacity_];
+    uint64 seq = slot.seq.load(std::memory_order_acquire);
+    RequestRecord record = slot.record;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    // skip slots still being written or already reused by a newer request
+    if (seq == 2 * idx + 2 &&
+        seq == slot.seq.load(std::memory_order_relaxed)) {
+      records->push_back(record);
+    }
+  }
+}
+
+Status FlightRecorder::dump(const std::string& reason) {
+  if (!enabled()) {
+    return errors::FailedPrecondition("flight recorder is disabled");
+  }
+  std::vector<RequestRecord> records;
+  snapshot(&records);
+  std::string text = strings::StrCat(
+      "# neuron flight recorder dump (", reason, "), ", records.size(),
+      " requests\n# start_us name nn_id replica batch shards in_bytes "
+      "out_bytes shm cache prepared_us input_copied_us inferred_us end_us "
+      "status\n");
+  for (const RequestRecord& rec : records) {
+    strings::StrAppend(&text, rec.start_us, " ", rec.name, " ", rec.nn_id, " ",
+                       rec.replica_nn_id, " ", rec.batch_size, " ",
+                       rec.num_shards, " ", rec.input_bytes, " ",
+                       rec.output_bytes, " ", rec.use_shm, " ", rec.cache_hit,
+                       " ", rec.prepared_us, " ", rec.input_copied_us, " ",
+                       rec.inferred_us, " ", rec.end_us, " ", rec.status_code,
+                       "\n");
+  }
+  if (dump_dir_.empty()) {
+    LOG(INFO) << text;
+    return Status::OK();
+  }
+  TF_RETURN_IF_ERROR(Env::Default()->RecursivelyCreateDir(dump_dir_));
+  std::string path = strings::StrCat(dump_dir_, "/neuron_flight_recorder_",
+                                     getpid(), "_", num_dumps_++, ".txt");
+  TF_RETURN_IF_ERROR(WriteStringToFile(Env::Default(), path, text));
+  LOG(INFO) << "flight recorder dump (" << reason << ") written to " << path;
+  return Status::OK();
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
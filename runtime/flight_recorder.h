@@ -0,0 +1,96 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_FLIGHT_RECORDER_H_
+#define TENSORFLOW_NEURON_RUNTIME_FLIGHT_RECORDER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "macros.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// One NeuronOp request as seen by the flight recorder. Stage times are
+// microseconds since start_us and stay 0 for stages the request never reached.
+struct RequestRecord {
+  static const size_t MAX_NAME_LENGTH = 63;
+  uint64 start_us = 0;
+  uint32_t prepared_us = 0;      // inputs validated, outputs allocated
+  uint32_t input_copied_us = 0;  // inputs copied into the runtime
+  uint32_t inferred_us = 0;      // inference result available
+  uint32_t end_us = 0;
+  uint32_t nn_id = 0;
+  uint32_t replica_nn_id = 0;  // replica of the last (or only) inference
+  int64 batch_size = 0;
+  int32_t num_shards = 0;
+  int32_t status_code = 0;
+  uint64 input_bytes = 0;
+  uint64 output_bytes = 0;
+  bool use_shm = false;
+  bool cache_hit = false;
+  char name[MAX_NAME_LENGTH + 1] = {0};
+  void set_name(const std::string& op_name);
+};
+
+// Always-on, fixed-size ring buffer of the most recent NeuronOp requests, so
+// that latency spikes can be examined after the fact. Writers never block:
+// each slot carries a sequence number and a reader simply drops slots that
+// were being rewritten while it copied them.
+//
+// The window is dumped (to NEURON_FLIGHT_RECORDER_DIR, or to the log) when a
+// request takes longer than NEURON_FLIGHT_RECORDER_THRESHOLD_US, when the
+// process receives SIGUSR2 with NEURON_FLIGHT_RECORDER_SIGNAL=1, or when
+// dump() is called (tfn.diagnostics.dump_flight_recorder() from Python). A
+// signal is serviced by the next request, or within a second by a watcher
+// thread if the process is idle. NEURON_FLIGHT_RECORDER_SIZE sets the number
+// of records kept; 0 turns the recorder off.
+class FlightRecorder {
+ public:
+  static FlightRecorder& GetFlightRecorder();
+  bool enabled() const { return capacity_ > 0; }
+  void record(const RequestRecord& record);
+  // Asks for a dump of the current window; it is written in the background
+  void request_dump(const std::string& reason);
+  // Writes the current window synchronously
+  Status dump(const std::string& reason);
+
+ private:
+  struct Slot {
+    std::atomic<uint64> seq{0};  // odd while being written
+    RequestRecord record;
+  };
+  FlightRecorder();
+  void watch_signal();
+  void snapshot(std::vector<RequestRecord>* records);
+  size_t capacity_ = 0;
+  uint64 threshold_us_ = 0;
+  std::string dump_dir_ = "";
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64> next_{0};
+  std::atomic<uint64> last_dump_us_{0};
+  std::atomic<int> num_dumps_{0};
+  std::unique_ptr<Thread> signal_watcher_;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(FlightRecorder);
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_FLIGHT_RECORDER_H_
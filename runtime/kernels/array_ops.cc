@@ -0,0 +1,380 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#define EIGEN_USE_THREADS
+
+#include <cstring>
+#include "registration.h"
+#include "../device.h"
+#include "../tensor_util.h"
+#include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
+#include "tensorflow/core/framework/tensor_shape.h"
+
+namespace tensorflow {
+namespace neuron {
+
+typedef Eigen::ThreadPoolDevice CPUDevice;
+
+static const int kMaxRank = 8;
+
+// Data movement kernels only care about the element size, so tensors are
+// bit-casted to unsigned integers of the same width before being handed to
+// Eigen. This keeps the number of template instantiations small.
+template <template <typename, int> class Functor, typename T, typename... Args>
+static Status dispatch_rank(const int rank, Args&&... args) {
+  switch (rank) {
+#define CASE(NDIMS)                                           \
+  case NDIMS: {                                               \
+    return Functor<T, NDIMS>::run(std::forward<Args>(args)...); \
+  }
+    CASE(1);
+    CASE(2);
+    CASE(3);
+    CASE(4);
+    CASE(5);
+    CASE(6);
+    CASE(7);
+    CASE(8);
+#undef CASE
+    default:
+      return errors::Unimplemented("tensor rank ", rank,
+                                   " is not supported on ", DEVICE_NEURON);
+  }
+}
+
+template <template <typename, int> class Functor, typename... Args>
+static Status dispatch(const DataType dtype, const int rank, Args&&... args) {
+  if (TF_PREDICT_FALSE(!DataTypeCanUseMemcpy(dtype))) {
+    return errors::Unimplemented("data type ", DataTypeString(dtype),
+                                 " is not supported on ", DEVICE_NEURON);
+  }
+  switch (DataTypeSize(dtype)) {
+    case 1:
+      return dispatch_rank<Functor, uint8>(rank, std::forward<Args>(args)...);
+    case 2:
+      return dispatch_rank<Functor, uint16>(rank, std::forward<Args>(args)...);
+    case 4:
+      return dispatch_rank<Functor, uint32>(rank, std::forward<Args>(args)...);
+    case 8:
+      return dispatch_rank<Functor, uint64>(rank, std::forward<Args>(args)...);
+    default:
+      return errors::Unimplemented("data type ", DataTypeString(dtype),
+                                   " is not supported on ", DEVICE_NEURON);
+  }
+}
+
+static Status allocate_shm_output(OpKernelContext* ctx,
+                                  const TensorShape& shape, Tensor** output) {
+  AllocatorAttributes attr;
+  NeuronDevice::set_on_valid_shm(&attr);
+  return ctx->allocate_output(0, shape, output, attr);
+}
+
+template <typename T, int NDIMS>
+struct TransposeFunctor {
+  static Status run(const CPUDevice& device, const Tensor& input,
+                    const std::vector<int64>& perm, Tensor* output) {
+    Eigen::array<int, NDIMS> shuffle;
+    for (int idx = 0; idx < NDIMS; ++idx) {
+      shuffle[idx] = perm[idx];
+    }
+    output->bit_casted_tensor<T, NDIMS>().device(device) =
+        input.bit_casted_tensor<T, NDIMS>().shuffle(shuffle);
+    return Status::OK();
+  }
+};
+
+template <typename T, int NDIMS>
+struct SliceFunctor {
+  static Status run(const CPUDevice& device, const Tensor& input,
+                    const std::vector<int64>& begin, Tensor* output) {
+    Eigen::DSizes<Eigen::DenseIndex, NDIMS> indices;
+    Eigen::DSizes<Eigen::DenseIndex, NDIMS> sizes;
+    for (int idx = 0; idx < NDIMS; ++idx) {
+      indices[idx] = begin[idx];
+      sizes[idx] = output->dim_size(idx);
+    }
+    output->bit_casted_tensor<T, NDIMS>().device(device) =
+        input.bit_casted_tensor<T, NDIMS>().slice(indices, sizes);
+    return Status::OK();
+  }
+};
+
+template <typename T, int NDIMS>
+struct PadFunctor {
+  static Status run(const CPUDevice& device, const Tensor& input,
+                    const std::vector<int64>& paddings, Tensor* output) {
+    Eigen::array<Eigen::IndexPair<int64>, NDIMS> pads;
+    for (int idx = 0; idx < NDIMS; ++idx) {
+      pads[idx] = {paddings[2 * idx], paddings[2 * idx + 1]};
+    }
+    // all-zero bits are zero for every memcpy-able data type
+    output->bit_casted_tensor<T, NDIMS>().device(device) =
+        input.bit_casted_tensor<T, NDIMS>().pad(pads);
+    return Status::OK();
+  }
+};
+
+class TransposeOp : public OpKernel {
+ public:
+  explicit TransposeOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron transpose implementation";
+    const Tensor& input = ctx->input(0);
+    const Tensor& perm_tensor = ctx->input(1);
+    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(perm_tensor.shape()),
+                errors::InvalidArgument("perm must be a vector, not ",
+                                        perm_tensor.shape().DebugString()));
+    std::vector<int64> perm;
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&perm, perm_tensor));
+    const int rank = input.dims();
+    OP_REQUIRES(ctx, rank == (int)perm.size(),
+                errors::InvalidArgument(
+                    "transpose expects a vector of size ", rank,
+                    ". But input(1) is a vector of size ", perm.size()));
+    std::vector<bool> bits(rank, false);
+    bool is_identity = true;
+    TensorShape shape;
+    for (int idx = 0; idx < rank; ++idx) {
+      int64 dim = perm[idx];
+      OP_REQUIRES(ctx, 0 <= dim && dim < rank && !bits[dim],
+                  errors::InvalidArgument(dim, " is not a valid permutation "
+                                               "of 0..", rank - 1));
+      bits[dim] = true;
+      is_identity &= dim == idx;
+      shape.AddDim(input.dim_size(dim));
+    }
+    if (is_identity || input.NumElements() <= 1) {
+      Tensor output;
+      OP_REQUIRES(ctx, output.CopyFrom(input, shape),
+                  errors::Internal("could not forward transpose input"));
+      ctx->set_output(0, output);
+      return;
+    }
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(ctx, allocate_shm_output(ctx, shape, &output));
+    OP_REQUIRES_OK(ctx, dispatch<TransposeFunctor>(
+                            input.dtype(), rank,
+                            ctx->eigen_device<CPUDevice>(), input, perm,
+                            output));
+  }
+};
+
+class SliceOp : public OpKernel {
+ public:
+  explicit SliceOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron slice implementation";
+    const Tensor& input = ctx->input(0);
+    std::vector<int64> begin;
+    std::vector<int64> size;
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&begin, ctx->input(1)));
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&size, ctx->input(2)));
+    const int rank = input.dims();
+    OP_REQUIRES(
+        ctx, rank == (int)begin.size() && rank == (int)size.size(),
+        errors::InvalidArgument(
+            "Expected begin and size arguments to be 1-D tensors of size ",
+            rank, ", but got shapes ", ctx->input(1).shape().DebugString(),
+            " and ", ctx->input(2).shape().DebugString(), " instead."));
+    bool is_identity = true;
+    TensorShape shape;
+    for (int idx = 0; idx < rank; ++idx) {
+      int64 dim_size = input.dim_size(idx);
+      int64 b = begin[idx];
+      int64 s = -1 == size[idx] ? dim_size - b : size[idx];
+      OP_REQUIRES(ctx, 0 <= b && b <= dim_size && 0 <= s && b + s <= dim_size,
+                  errors::InvalidArgument(
+                      "Expected begin[", idx, "] in [0, ", dim_size,
+                      "] and size[", idx, "] in [0, ", dim_size - b,
+                      "], but got ", b, " and ", s));
+      is_identity &= 0 == b && dim_size == s;
+      shape.AddDim(s);
+    }
+    if (is_identity) {
+      ctx->set_output(0, input);
+      return;
+    }
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(ctx, allocate_shm_output(ctx, shape, &output));
+    if (0 == output->NumElements()) {
+      return;
+    }
+    OP_REQUIRES_OK(ctx, dispatch<SliceFunctor>(input.dtype(), rank,
+                                               ctx->eigen_device<CPUDevice>(),
+                                               input, begin, output));
+  }
+};
+
+class PadOp : public OpKernel {
+ public:
+  explicit PadOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron pad implementation";
+    const Tensor& input = ctx->input(0);
+    const Tensor& paddings_tensor = ctx->input(1);
+    const int rank = input.dims();
+    OP_REQUIRES(ctx,
+                TensorShapeUtils::IsMatrix(paddings_tensor.shape()) &&
+                    paddings_tensor.dim_size(0) == rank &&
+                    paddings_tensor.dim_size(1) == 2,
+                errors::InvalidArgument(
+                    "paddings must be a matrix of shape [", rank,
+                    ", 2]: ", paddings_tensor.shape().DebugString()));
+    std::vector<int64> paddings;
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&paddings, paddings_tensor));
+    bool is_identity = true;
+    TensorShape shape;
+    for (int idx = 0; idx < rank; ++idx) {
+      int64 before = paddings[2 * idx];
+      int64 after = paddings[2 * idx + 1];
+      OP_REQUIRES(ctx, before >= 0 && after >= 0,
+                  errors::InvalidArgument("Paddings must be non-negative: ",
+                                          before, " ", after));
+      is_identity &= 0 == before && 0 == after;
+      shape.AddDim(before + input.dim_size(idx) + after);
+    }
+    if (is_identity) {
+      ctx->set_output(0, input);
+      return;
+    }
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(ctx, allocate_shm_output(ctx, shape, &output));
+    if (0 == input.NumElements()) {
+      OP_REQUIRES_OK(ctx, tensor_memset(output, 0));
+      return;
+    }
+    OP_REQUIRES_OK(ctx, dispatch<PadFunctor>(input.dtype(), rank,
+                                             ctx->eigen_device<CPUDevice>(),
+                                             input, paddings, output));
+  }
+};
+
+class ConcatV2Op : public OpKernel {
+ public:
+  explicit ConcatV2Op(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron concat implementation";
+    const int num_values = ctx->num_inputs() - 1;
+    const Tensor& axis_tensor = ctx->input(num_values);
+    OP_REQUIRES(ctx, TensorShapeUtils::IsScalar(axis_tensor.shape()),
+                errors::InvalidArgument(
+                    "ConcatV2 axis tensor should be a scalar integer, but got ",
+                    axis_tensor.shape().DebugString()));
+    std::vector<int64> axis_values;
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&axis_values, axis_tensor));
+    const Tensor& first = ctx->input(0);
+    const int rank = first.dims();
+    int64 axis = axis_values[0] < 0 ? axis_values[0] + rank : axis_values[0];
+    OP_REQUIRES(ctx, 0 <= axis && axis < rank,
+                errors::InvalidArgument("ConcatV2 expected concatenating "
+                                        "dimension in the range [",
+                                        -rank, ", ", rank, "), but got ",
+                                        axis_values[0]));
+    OP_REQUIRES(ctx, DataTypeCanUseMemcpy(first.dtype()),
+                errors::Unimplemented("data type ",
+                                      DataTypeString(first.dtype()),
+                                      " is not supported on ", DEVICE_NEURON));
+
+    // view every input as [outer, inner] where outer covers the dimensions
+    // before axis; each output row is then a concatenation of input rows
+    int64 outer = 1;
+    for (int idx = 0; idx < axis; ++idx) {
+      outer *= first.dim_size(idx);
+    }
+    const int64 dtype_size = DataTypeSize(first.dtype());
+    TensorShape shape(first.shape());
+    int64 axis_size = 0;
+    std::vector<int64> row_bytes(num_values);
+    for (int idx = 0; idx < num_values; ++idx) {
+      const Tensor& value = ctx->input(idx);
+      OP_REQUIRES(ctx, value.dims() == rank,
+                  errors::InvalidArgument(
+                      "ConcatV2 ranks of all input tensors should match: "
+                      "shape[0] = ", first.shape().DebugString(), " vs. shape[",
+                      idx, "] = ", value.shape().DebugString()));
+      for (int dim = 0; dim < rank; ++dim) {
+        OP_REQUIRES(ctx, dim == axis || value.dim_size(dim) == shape.dim_size(dim),
+                    errors::InvalidArgument(
+                        "ConcatV2 dimensions of inputs should match: "
+                        "shape[0] = ", first.shape().DebugString(),
+                        " vs. shape[", idx, "] = ",
+                        value.shape().DebugString()));
+      }
+      axis_size += value.dim_size(axis);
+      row_bytes[idx] =
+          outer > 0 ? value.NumElements() / outer * dtype_size : 0;
+    }
+    shape.set_dim(axis, axis_size);
+    if (1 == num_values) {
+      ctx->set_output(0, first);
+      return;
+    }
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(ctx, allocate_shm_output(ctx, shape, &output));
+    if (0 == output->NumElements()) {
+      return;
+    }
+    int64 out_row_bytes = 0;
+    std::vector<const char*> src_ptrs(num_values);
+    for (int idx = 0; idx < num_values; ++idx) {
+      out_row_bytes += row_bytes[idx];
+      src_ptrs[idx] = ctx->input(idx).tensor_data().data();
+    }
+    char* dst = const_cast<char*>(output->tensor_data().data());
+    thread::ThreadPool* pool =
+        ctx->device()->tensorflow_cpu_worker_threads()->workers;
+    if (1 == outer) {
+      // concatenating along the outermost non-trivial axis is a sequence of
+      // large contiguous copies
+      for (int idx = 0; idx < num_values; ++idx) {
+        fast_memcpy(dst, src_ptrs[idx], row_bytes[idx], pool);
+        dst += row_bytes[idx];
+      }
+      return;
+    }
+    auto concat_rows = [&](int64 begin, int64 end) {
+      for (int64 row = begin; row < end; ++row) {
+        char* dst_row = dst + row * out_row_bytes;
+        for (int idx = 0; idx < num_values; ++idx) {
+          std::memcpy(dst_row, src_ptrs[idx] + row * row_bytes[idx],
+                      row_bytes[idx]);
+          dst_row += row_bytes[idx];
+        }
+      }
+    };
+    pool->ParallelFor(outer, out_row_bytes, std::move(concat_rows));
+  }
+};
+
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("Transpose", DEVICE_NEURON, TransposeOp,
+                                     {"T", kNeuronMemcpyTypes},
+                                     {"Tperm", kNeuronIndexTypes});
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("Slice", DEVICE_NEURON, SliceOp,
+                                     {"T", kNeuronMemcpyTypes},
+                                     {"Index", kNeuronIndexTypes});
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("Pad", DEVICE_NEURON, PadOp,
+                                     {"T", kNeuronMemcpyTypes},
+                                     {"Tpaddings", kNeuronIndexTypes});
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("ConcatV2", DEVICE_NEURON, ConcatV2Op,
+                                     {"T", kNeuronMemcpyTypes},
+                                     {"Tidx", kNeuronIndexTypes});
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -12,7 +12,6 @@ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
-#include <iostream>
 
 #include "../device.h"
 #include "registration.h"
@@ -20,23 +19,14 @@ limitations under the License.
 
 #define EIGEN_USE_THREADS
 
-//#include "tensorflow/core/kernels/avgpooling_op.h"
-
+#include <algorithm>
 #include <vector>
 
-#include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
-//#include "tensorflow/core/framework/kernel_shape_util.h"
-#include "tensorflow/core/framework/numeric_op.h"
+#include "tensorflow/core/framework/common_shape_fns.h"
 #include "tensorflow/core/framework/op_kernel.h"
-#include "tensorflow/core/framework/register_types.h"
 #include "tensorflow/core/framework/tensor.h"
 #include "tensorflow/core/framework/tensor_shape.h"
-#include "tensorflow/core/framework/tensor_slice.h"
-//#include "tensorflow/core/kernels/eigen_pooling.h"
-//#include "tensorflow/core/kernels/ops_util.h"
-//#include "tensorflow/core/kernels/pooling_ops_common.h"
 #include "tensorflow/core/lib/core/errors.h"
-#include "tensorflow/core/lib/gtl/array_slice.h"
 #include "tensorflow/core/platform/logging.h"
 #include "tensorflow/core/util/padding.h"
 #include "tensorflow/core/util/tensor_format.h"
@@ -44,22 +34,191 @@ limitations under the License.
 namespace tensorflow {
 namespace neuron {
 
-typedef Eigen::ThreadPoolDevice CPUDevice;
+// Both layouts are viewed as [outer, rows, cols, depth] where depth is the
+// contiguous dimension: NHWC is [batch, H, W, C] and NCHW is [batch * C, H,
+// W, 1]. The 2-D window sum is computed separably, first along cols into a
+// float buffer and then along rows, and each 1-D pass slides its running sum
+// instead of re-summing the window whenever that is cheaper. Padded elements
+// are never materialized; windows are clipped to the input instead, which
+// also gives the SAME padding divisor (number of valid elements) for free.
+struct AvgPoolParams {
+  int64 outer;
+  int64 in_rows;
+  int64 in_cols;
+  int64 depth;
+  int64 out_rows;
+  int64 out_cols;
+  int64 window_rows;
+  int64 window_cols;
+  int64 stride_rows;
+  int64 stride_cols;
+  int64 pad_rows;
+  int64 pad_cols;
+};
+
+static inline void clipped_window(int64 out_idx, int64 stride, int64 pad,
+                                  int64 window, int64 in_size, int64* start,
+                                  int64* end) {
+  int64 begin = out_idx * stride - pad;
+  *start = std::max<int64>(begin, 0);
+  *end = std::min<int64>(begin + window, in_size);
+}
+
+template <typename T>
+static inline void add_to(float* acc, const T* src, int64 size) {
+  for (int64 idx = 0; idx < size; ++idx) {
+    acc[idx] += static_cast<float>(src[idx]);
+  }
+}
+
+template <typename T>
+static inline void subtract_from(float* acc, const T* src, int64 size) {
+  for (int64 idx = 0; idx < size; ++idx) {
+    acc[idx] -= static_cast<float>(src[idx]);
+  }
+}
+
+// Computes the window sum of every output position along one dimension.
+// src has in_size vectors of length `size`, spaced `src_step` apart; the
+// window sum of output position `o` is written to dst + o * size.
+template <typename T>
+static void sliding_window_sum(const T* src, int64 src_step, int64 size,
+                               int64 out_size, int64 stride, int64 pad,
+                               int64 window, int64 in_size, float* acc,
+                               float* dst) {
+  int64 acc_start = 0;
+  int64 acc_end = 0;
+  for (int64 out_idx = 0; out_idx < out_size; ++out_idx) {
+    int64 start, end;
+    clipped_window(out_idx, stride, pad, window, in_size, &start, &end);
+    int64 slide_cost = (start - acc_start) + (end - acc_end);
+    if (start < acc_end && slide_cost < end - start) {
+      for (int64 idx = acc_start; idx < start; ++idx) {
+        subtract_from(acc, src + idx * src_step, size);
+      }
+      for (int64 idx = acc_end; idx < end; ++idx) {
+        add_to(acc, src + idx * src_step, size);
+      }
+    } else {
+      std::fill_n(acc, size, 0.0f);
+      for (int64 idx = start; idx < end; ++idx) {
+        add_to(acc, src + idx * src_step, size);
+      }
+    }
+    acc_start = start;
+    acc_end = end;
+    std::copy_n(acc, size, dst + out_idx * size);
+  }
+}
+
+// Computes output rows [out_row_begin, out_row_end) of one outer slice.
+template <typename T>
+static void avg_pool_rows(const AvgPoolParams& p, const T* input, T* output,
+                          int64 out_row_begin, int64 out_row_end) {
+  const int64 in_row_size = p.in_cols * p.depth;
+  const int64 out_row_size = p.out_cols * p.depth;
+  int64 row_begin, row_end, unused;
+  clipped_window(out_row_begin, p.stride_rows, p.pad_rows, p.window_rows,
+                 p.in_rows, &row_begin, &unused);
+  clipped_window(out_row_end - 1, p.stride_rows, p.pad_rows, p.window_rows,
+                 p.in_rows, &unused, &row_end);
+  row_end = std::max(row_begin, row_end);
+
+  // horizontal pass over only the input rows this shard needs
+  std::vector<float> col_sums((row_end - row_begin) * out_row_size);
+  std::vector<float> acc(out_row_size);
+  for (int64 row = row_begin; row < row_end; ++row) {
+    sliding_window_sum(input + row * in_row_size, p.depth, p.depth,
+                       p.out_cols, p.stride_cols, p.pad_cols, p.window_cols,
+                       p.in_cols, acc.data(),
+                       col_sums.data() + (row - row_begin) * out_row_size);
+  }
+
+  // number of valid cols in each output element's window
+  std::vector<float> col_counts(out_row_size);
+  for (int64 col = 0; col < p.out_cols; ++col) {
+    int64 start, end;
+    clipped_window(col, p.stride_cols, p.pad_cols, p.window_cols, p.in_cols,
+                   &start, &end);
+    std::fill_n(col_counts.data() + col * p.depth, p.depth,
+                static_cast<float>(end - start));
+  }
+
+  // vertical pass is contiguous over [out_cols, depth] so it vectorizes in
+  // both layouts
+  int64 acc_start = row_begin;
+  int64 acc_end = row_begin;
+  std::fill(acc.begin(), acc.end(), 0.0f);
+  for (int64 out_row = out_row_begin; out_row < out_row_end; ++out_row) {
+    int64 start, end;
+    clipped_window(out_row, p.stride_rows, p.pad_rows, p.window_rows,
+                   p.in_rows, &start, &end);
+    int64 slide_cost = (start - acc_start) + (end - acc_end);
+    if (start < acc_end && slide_cost < end - start) {
+      for (int64 row = acc_start; row < start; ++row) {
+        subtract_from(acc.data(), &col_sums[(row - row_begin) * out_row_size],
+                      out_row_size);
+      }
+      for (int64 row = acc_end; row < end; ++row) {
+        add_to(acc.data(), &col_sums[(row - row_begin) * out_row_size],
+               out_row_size);
+      }
+    } else {
+      std::fill(acc.begin(), acc.end(), 0.0f);
+      for (int64 row = start; row < end; ++row) {
+        add_to(acc.data(), &col_sums[(row - row_begin) * out_row_size],
+               out_row_size);
+      }
+    }
+    acc_start = start;
+    acc_end = end;
+    float row_count = static_cast<float>(end - start);
+    T* out_row_ptr = output + out_row * out_row_size;
+    for (int64 idx = 0; idx < out_row_size; ++idx) {
+      out_row_ptr[idx] =
+          static_cast<T>(acc[idx] / (row_count * col_counts[idx]));
+    }
+  }
+}
+
+template <typename T>
+static void avg_pool(const AvgPoolParams& p, const Tensor& tensor_in,
+                     Tensor* output, thread::ThreadPool* pool) {
+  const T* input = tensor_in.flat<T>().data();
+  T* out = output->flat<T>().data();
+  const int64 in_slice_size = p.in_rows * p.in_cols * p.depth;
+  const int64 out_slice_size = p.out_rows * p.out_cols * p.depth;
+
+  // one work unit is one output row of one outer slice, so that batch 1
+  // NHWC inputs still spread across the thread pool
+  auto work = [&](int64 begin, int64 end) {
+    for (int64 unit = begin; unit < end;) {
+      int64 outer_idx = unit / p.out_rows;
+      int64 out_row_begin = unit % p.out_rows;
+      int64 out_row_end = std::min(p.out_rows, out_row_begin + end - unit);
+      avg_pool_rows(p, input + outer_idx * in_slice_size,
+                    out + outer_idx * out_slice_size, out_row_begin,
+                    out_row_end);
+      unit += out_row_end - out_row_begin;
+    }
+  };
+  int64 cost_per_unit =
+      (p.window_rows + p.window_cols) * p.out_cols * p.depth + p.in_cols;
+  pool->ParallelFor(p.outer * p.out_rows, cost_per_unit, std::move(work));
+}
 
-template <typename Device, typename T>
-class AvgPoolingOp : public UnaryOp<T> {
+class AvgPoolingOp : public OpKernel {
  public:
-  explicit AvgPoolingOp(OpKernelConstruction* context) : UnaryOp<T>(context) {
+  explicit AvgPoolingOp(OpKernelConstruction* context) : OpKernel(context) {
     VLOG(1) << "using neuron implementation";
     string data_format;
     OP_REQUIRES_OK(context, context->GetAttr("data_format", &data_format));
     OP_REQUIRES(context, FormatFromString(data_format, &data_format_),
                 errors::InvalidArgument("Invalid data format"));
-    /*OP_REQUIRES(
-        context, data_format_ == FORMAT_NHWC,
-        errors::InvalidArgument("Default AvgPoolingOp only supports NHWC ",
-                                "on device type ",
-                                DeviceTypeString(context->device_type())));*/
+    OP_REQUIRES(context,
+                data_format_ == FORMAT_NHWC || data_format_ == FORMAT_NCHW,
+                errors::InvalidArgument("Unsupported data format ",
+                                        data_format));
     OP_REQUIRES_OK(context, context->GetAttr("ksize", &ksize_));
     OP_REQUIRES(context, ksize_.size() == 4,
                 errors::InvalidArgument("Sliding window ksize field must "
@@ -69,326 +228,83 @@ class AvgPoolingOp : public UnaryOp<T> {
                 errors::InvalidArgument("Sliding window stride field must "
                                         "specify 4 dimensions"));
     OP_REQUIRES_OK(context, context->GetAttr("padding", &padding_));
-    OP_REQUIRES(context, ksize_[0] == 1 && stride_[0] == 1,
+    OP_REQUIRES(context, padding_ == VALID || padding_ == SAME,
+                errors::Unimplemented("Only VALID and SAME padding are "
+                                      "supported on ", DEVICE_NEURON));
+    OP_REQUIRES(context,
+                GetTensorDim(ksize_, data_format_, 'N') == 1 &&
+                    GetTensorDim(stride_, data_format_, 'N') == 1,
                 errors::Unimplemented(
                     "Pooling is not yet supported on the batch dimension."));
+    OP_REQUIRES(context,
+                GetTensorDim(ksize_, data_format_, 'C') == 1 &&
+                    GetTensorDim(stride_, data_format_, 'C') == 1,
+                errors::Unimplemented(
+                    "Pooling is not yet supported on the depth dimension."));
+    OP_REQUIRES(context,
+                GetTensorDim(ksize_, data_format_, 'H') > 0 &&
+                    GetTensorDim(ksize_, data_format_, 'W') > 0 &&
+                    GetTensorDim(stride_, data_format_, 'H') > 0 &&
+                    GetTensorDim(stride_, data_format_, 'W') > 0,
+                errors::InvalidArgument("Sliding window ksize and stride "
+                                        "must be positive"));
   }
 
   void Compute(OpKernelContext* context) override {
-    VLOG(1) << "Starting AvgPool compute.";
     const Tensor& tensor_in = context->input(0);
-    if (!context->status().ok()) {
-      return;
-    }
-
-    // For avgpooling, tensor_in should have 4 dimensions.
     OP_REQUIRES(context, tensor_in.dims() == 4,
                 errors::InvalidArgument("tensor_in must be 4-dimensional"));
 
-    Tensor* output = nullptr;
-
-    int batch_size = tensor_in.shape().dim_size(0);
-    int rows;
-    int cols;
-    int channels;
-    int newNumRows;
-    int newNumCols;
-    int rowKernelSize;
-    int colKernelSize;
-    int rowStrideLen;
-    int colStrideLen;
-
-    TensorShape outputshape;
-    TensorShape newinputshape;
-    Tensor paddedTensor;
-
+    AvgPoolParams p;
+    int64 batch_size = GetTensorDim(tensor_in, data_format_, 'N');
+    int64 channels = GetTensorDim(tensor_in, data_format_, 'C');
+    p.in_rows = GetTensorDim(tensor_in, data_format_, 'H');
+    p.in_cols = GetTensorDim(tensor_in, data_format_, 'W');
+    p.window_rows = GetTensorDim(ksize_, data_format_, 'H');
+    p.window_cols = GetTensorDim(ksize_, data_format_, 'W');
+    p.stride_rows = GetTensorDim(stride_, data_format_, 'H');
+    p.stride_cols = GetTensorDim(stride_, data_format_, 'W');
+    OP_REQUIRES_OK(context, GetWindowedOutputSize(
+                                p.in_rows, p.window_rows, p.stride_rows,
+                                padding_, &p.out_rows, &p.pad_rows));
+    OP_REQUIRES_OK(context, GetWindowedOutputSize(
+                                p.in_cols, p.window_cols, p.stride_cols,
+                                padding_, &p.out_cols, &p.pad_cols));
     if (data_format_ == FORMAT_NHWC) {
-      rows = tensor_in.shape().dim_size(1);
-      cols = tensor_in.shape().dim_size(2);
-      channels = tensor_in.shape().dim_size(3);
-      rowKernelSize = ksize_[1];
-      colKernelSize = ksize_[2];
-      rowStrideLen = stride_[1];
-      colStrideLen = stride_[2];
-    } else if (data_format_ == FORMAT_NCHW) {
-      rows = tensor_in.shape().dim_size(2);
-      cols = tensor_in.shape().dim_size(3);
-      channels = tensor_in.shape().dim_size(1);
-      rowKernelSize = ksize_[2];
-      colKernelSize = ksize_[3];
-      rowStrideLen = stride_[2];
-      colStrideLen = stride_[3];
-    } else
-      VLOG(1) << "Unrecognized format, but didn't get caught by error checking";
-    if (padding_ == 1) {
-      VLOG(1) << "Valid Padding";
-
-      // now we must calculate the actual newNumRows/Cols if striding is in play
-      newNumRows = rows - rowKernelSize + 1;
-      newNumCols = cols - colKernelSize + 1;
-      // ceiling(newNumRows/rowStrideLen)
-      newNumRows = (newNumRows + rowStrideLen - 1) / rowStrideLen;
-      // ceiling(newNumRows/rowStrideLen)
-      newNumCols = (newNumCols + colStrideLen - 1) / colStrideLen;
-
-    } else if (padding_ == 2) {
-      VLOG(1) << "Same Padding";
-      // int row_offset = rowKernelSize / 2;
-      // int col_offset = colKernelSize / 2;
-      int totalRowPadding = rowKernelSize - 1;
-      int totalColPadding = colKernelSize - 1;
-      int paddedRowLen = rows + totalRowPadding;
-      int paddedColLen = cols + totalColPadding;
-      // ceiling(paddedRowLen/rowStrideLen)
-      newNumRows = ((paddedRowLen - rowKernelSize) / rowStrideLen) + 1;
-      newNumCols = ((paddedColLen - colKernelSize) / colStrideLen) + 1;
-      // newNumRows and newNumCols to be used later when generating output shape
-
-      // floor(totalRowPadding / 2)
-      int row_offset_up = (totalRowPadding) / 2;
-      // ceil(totalRowPadding / 2)
-      int row_offset_down = (totalRowPadding + 1) / 2;
-      // floor(totalColPadding / 2)
-      int col_offset_left = (totalColPadding) / 2;
-      // ceil(totalColPadding / 2)
-      int col_offset_right = (totalColPadding + 1) / 2;
-
-      if (data_format_ == FORMAT_NHWC) {
-        newinputshape =
-            TensorShape{batch_size, paddedRowLen, paddedColLen, channels};
-      } else {
-        newinputshape =
-            TensorShape{batch_size, channels, paddedRowLen, paddedColLen};
-      }
-
-      OP_REQUIRES_OK(context, context->allocate_temp(DT_FLOAT, newinputshape,
-                                                     &paddedTensor));
-      VLOG(1) << "Successfully allocated the paddedTensor for same paddding.";
-
-      auto newmatrix = paddedTensor.tensor<float, 4>();
-      auto t = tensor_in.tensor<float, 4>();
-      float inf = std::numeric_limits<float>::infinity();
-
-      if (data_format_ == FORMAT_NHWC) {
-        VLOG(1) << "Channels last padded tensor being created";
-        // create the padded tensor surrounded with proper padding
-        for (int b = 0; b < batch_size; b++) {
-          for (int r = 0; r < paddedRowLen; r++) {
-            for (int c = 0; c < paddedColLen; c++) {
-              for (int ch = 0; ch < channels; ch++) {
-                if ((r < row_offset_up || c < col_offset_left) ||
-                    (r >= paddedRowLen - row_offset_down ||
-                     c >= paddedColLen - col_offset_right)) {
-                  newmatrix(b, r, c, ch) = inf;
-                } else {
-                  newmatrix(b, r, c, ch) =
-                      t(b, r - row_offset_up, c - col_offset_left, ch);
-                }
-              }
-            }
-          }
-        }
-      } else {
-        VLOG(1) << "Channels First padded tensor being created";
-        for (int b = 0; b < batch_size; b++) {
-          for (int ch = 0; ch < channels; ch++) {
-            for (int r = 0; r < paddedRowLen; r++) {
-              for (int c = 0; c < paddedColLen; c++) {
-                if ((r < row_offset_up || c < col_offset_left) ||
-                    (r >= paddedRowLen - row_offset_down ||
-                     c >= paddedColLen - col_offset_right)) {
-                  newmatrix(b, ch, r, c) = inf;
-                } else {
-                  newmatrix(b, ch, r, c) =
-                      t(b, ch, r - row_offset_up, c - col_offset_left);
-                }
-              }
-            }
-          }
-        }
-      }
-    }
-
-    VLOG(1) << "paddedTensor shape: " << paddedTensor.DebugString();
-
-    if (data_format_ == FORMAT_NHWC) {
-      outputshape = TensorShape{batch_size, newNumRows, newNumCols, channels};
+      p.outer = batch_size;
+      p.depth = channels;
     } else {
-      outputshape = TensorShape{batch_size, channels, newNumRows, newNumCols};
+      p.outer = batch_size * channels;
+      p.depth = 1;
     }
 
-    OP_REQUIRES_OK(context, context->allocate_output(0, outputshape, &output));
-
-    VLOG(1) << "Output Shape: " << output->DebugString();
-    auto outmatrix = output->tensor<float, 4>();
-
-    // this is a special case where we just average the whole input tensor
-    if (newNumRows == 1 && newNumCols == 1) {
-      VLOG(1) << "Using the special case!";
-      for (int b = 0; b < batch_size; b++) {
-        for (int ch = 0; ch < channels; ch++) {
-          // less efficient here because I think we can get away with it as it
-          // is only 1x1 image
-          if (data_format_ == FORMAT_NHWC) {
-            outmatrix(b, 0, 0, ch) =
-                special_case(tensor_in, b, ch, rows, cols, true);
-          } else {
-            outmatrix(b, ch, 0, 0) =
-                special_case(tensor_in, b, ch, rows, cols, false);
-          }
-        }
-      }
-      //don't need to do any more calculations
+    TensorShape output_shape = ShapeFromFormat(
+        data_format_, batch_size, p.out_rows, p.out_cols, channels);
+    AllocatorAttributes attr;
+    NeuronDevice::set_on_valid_shm(&attr);
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(context,
+                   context->allocate_output(0, output_shape, &output, attr));
+    if (0 == output->NumElements()) {
       return;
     }
-
-    // VALID PADDING
-    if (padding_ == 1) {
-      VLOG(1) << "Valid padding AVGPool step";
-      if (data_format_ == FORMAT_NHWC) {
-        VLOG(1) << "Using channels last format";
-        for (int b = 0; b < batch_size; b++) {
-          for (int r = 0, r1 = 0; r1 < newNumRows; r += rowStrideLen, r1++) {
-            for (int c = 0, c1 = 0; c1 < newNumCols; c += colStrideLen, c1++) {
-              for (int ch = 0; ch < channels; ch++) {
-                outmatrix(b, r1, c1, ch) = calculate_sum_and_average_valid(
-                    tensor_in, b, r, c, ch, rowKernelSize, colKernelSize, true);
-              }
-            }
-          }
-        }
-      } else {
-        VLOG(1) << "Using channels first format";
-        for (int b = 0; b < batch_size; b++) {
-          for (int ch = 0; ch < channels; ch++) {
-            for (int r = 0, r1 = 0; r1 < newNumRows; r += rowStrideLen, r1++) {
-              for (int c = 0, c1 = 0; c1 < newNumCols;
-                   c += colStrideLen, c1++) {
-                outmatrix(b, ch, r1, c1) = calculate_sum_and_average_valid(
-                    tensor_in, b, r, c, ch, rowKernelSize, colKernelSize,
-                    false);
-              }
-            }
-          }
-        }
-      }
-    }
-    // SAME PADDING
-    else if (padding_ == 2) {
-      VLOG(1) << "Same padding AVG pool step.";
-      if (data_format_ == FORMAT_NHWC) {
-        VLOG(1) << "Using channels last format";
-        for (int b = 0; b < batch_size; b++) {
-          for (int r = 0, r1 = 0; r1 < newNumRows; r += rowStrideLen, r1++) {
-            for (int c = 0, c1 = 0; c1 < newNumCols; c += colStrideLen, c1++) {
-              for (int ch = 0; ch < channels; ch++) {
-                outmatrix(b, r1, c1, ch) = calculate_sum_and_average_same(
-                    paddedTensor, b, r, c, ch, rowKernelSize, colKernelSize,
-                    true);
-              }
-            }
-          }
-        }
-      } else {
-        VLOG(1) << "Using channels first format";
-        for (int b = 0; b < batch_size; b++) {
-          for (int ch = 0; ch < channels; ch++) {
-            for (int r = 0, r1 = 0; r1 < newNumRows; r += rowStrideLen, r1++) {
-              for (int c = 0, c1 = 0; c1 < newNumCols;
-                   c += colStrideLen, c1++) {
-                outmatrix(b, ch, r1, c1) = calculate_sum_and_average_same(
-                    paddedTensor, b, r, c, ch, rowKernelSize, colKernelSize,
-                    false);
-              }
-            }
-          }
-        }
-      }
+    thread::ThreadPool* pool =
+        context->device()->tensorflow_cpu_worker_threads()->workers;
+    switch (tensor_in.dtype()) {
+      case DT_FLOAT:
+        avg_pool<float>(p, tensor_in, output, pool);
+        break;
+      case DT_HALF:
+        avg_pool<Eigen::half>(p, tensor_in, output, pool);
+        break;
+      case DT_BFLOAT16:
+        avg_pool<bfloat16>(p, tensor_in, output, pool);
+        break;
+      default:
+        context->SetStatus(errors::Unimplemented(
+            "AvgPool on ", DEVICE_NEURON, " does not support data type ",
+            DataTypeString(tensor_in.dtype())));
     }
-
-    // context->set_output(0, context->input(0));
-    // SpatialAvgPool<Device, T>(context, output, tensor_in, params, padding_);
-  }
-  static float calculate_sum_and_average_valid(const Tensor& tensor_in, int b,
-                                               int r, int c, int ch,
-                                               int rowKernelSize,
-                                               int colKernelSize,
-                                               bool channelsLast) {
-    auto t = tensor_in.tensor<float, 4>();
-    float sum = 0;
-    float total = rowKernelSize * colKernelSize;
-    if (channelsLast) {
-      for (int r_offset = 0; r_offset < rowKernelSize; r_offset++) {
-        for (int c_offset = 0; c_offset < colKernelSize; c_offset++) {
-          sum += t(b, r + r_offset, c + c_offset, ch);
-        }
-      }
-    }
-
-    else {
-      for (int r_offset = 0; r_offset < rowKernelSize; r_offset++) {
-        for (int c_offset = 0; c_offset < colKernelSize; c_offset++) {
-          sum += t(b, ch, r + r_offset, c + c_offset);
-        }
-      }
-    }
-    return sum / total;
-  }
-  static float calculate_sum_and_average_same(const Tensor& tensor_in, int b,
-                                              int r, int c, int ch,
-                                              int rowKernelSize,
-                                              int colKernelSize,
-                                              bool channelsLast) {
-    auto t = tensor_in.tensor<float, 4>();
-    float sum = 0;
-    float total = rowKernelSize * colKernelSize;
-    float value;
-    float inf = std::numeric_limits<float>::infinity();
-    if (channelsLast) {
-      for (int r_offset = 0; r_offset < rowKernelSize; r_offset++) {
-        for (int c_offset = 0; c_offset < colKernelSize; c_offset++) {
-          value = t(b, r + r_offset, c + c_offset, ch);
-          if (value == inf) {
-            total--;
-          } else {
-            sum += value;
-          }
-        }
-      }
-    }
-
-    else {
-      for (int r_offset = 0; r_offset < rowKernelSize; r_offset++) {
-        for (int c_offset = 0; c_offset < colKernelSize; c_offset++) {
-          value = t(b, ch, r + r_offset, c + c_offset);
-          if (value == inf) {
-            total--;
-          } else {
-            sum += value;
-          }
-        }
-      }
-    }
-    return sum / total;
-  }
-
-  static float special_case(const Tensor& tensor_in, int b, int ch, int r,
-                            int c, bool channelsLast) {
-    auto t = tensor_in.tensor<float, 4>();
-    float sum = 0;
-    float total = r * c;
-    for (int i = 0; i < r; i++) {
-      for (int j = 0; j < c; j++) {
-        // called very little so I think we can get away with if inside the for
-        // loops here
-        if (channelsLast) {
-          sum += t(b, i, j, ch);
-        } else {
-          sum += t(b, ch, i, j);
-        }
-      }
-    }
-    return sum / total;
   }
 
  private:
@@ -398,9 +314,8 @@ class AvgPoolingOp : public UnaryOp<T> {
   TensorFormat data_format_;
 };
 
-typedef AvgPoolingOp<CPUDevice, float> AvgPoolCPUFloat;
-
-NEURON_REGISTER_KERNEL_BUILDER("AvgPool", DEVICE_NEURON, AvgPoolCPUFloat);
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("AvgPool", DEVICE_NEURON, AvgPoolingOp,
+                                     {"T", {DT_FLOAT, DT_HALF, DT_BFLOAT16}});
 
 }  // namespace neuron
 }  // namespace tensorflow
@@ -0,0 +1,105 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#define EIGEN_USE_THREADS
+
+#include "registration.h"
+#include "../device.h"
+#include "third_party/eigen3/unsupported/Eigen/CXX11/Tensor"
+#include "tensorflow/core/framework/register_types.h"
+
+namespace tensorflow {
+namespace neuron {
+
+typedef Eigen::ThreadPoolDevice CPUDevice;
+
+#define NEURON_CALL_CAST_TYPES(m)                                     \
+  TF_CALL_bool(m) TF_CALL_uint8(m) TF_CALL_int8(m) TF_CALL_uint16(m) \
+      TF_CALL_int16(m) TF_CALL_int32(m) TF_CALL_int64(m)             \
+          TF_CALL_half(m) TF_CALL_bfloat16(m) TF_CALL_float(m)       \
+              TF_CALL_double(m)
+
+template <typename SrcT>
+static Status cast_from(const CPUDevice& device, const Tensor& input,
+                        Tensor* output) {
+  switch (output->dtype()) {
+#define CASE(DstT)                                                \
+  case DataTypeToEnum<DstT>::value: {                             \
+    output->flat<DstT>().device(device) =                         \
+        input.flat<SrcT>().template cast<DstT>();                 \
+    return Status::OK();                                          \
+  }
+    NEURON_CALL_CAST_TYPES(CASE);
+#undef CASE
+    default:
+      return errors::Unimplemented("Cast from ", DataTypeString(input.dtype()),
+                                   " to ", DataTypeString(output->dtype()),
+                                   " is not supported on ", DEVICE_NEURON);
+  }
+}
+
+class CastOp : public OpKernel {
+ public:
+  explicit CastOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("SrcT", &src_dtype_));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("DstT", &dst_dtype_));
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron cast implementation";
+    const Tensor& input = ctx->input(0);
+    if (src_dtype_ == dst_dtype_) {
+      ctx->set_output(0, input);
+      return;
+    }
+    AllocatorAttributes attr;
+    NeuronDevice::set_on_valid_shm(&attr);
+    Tensor* output = nullptr;
+    OP_REQUIRES_OK(ctx, ctx->allocate_output(0, input.shape(), &output, attr));
+    const CPUDevice& device = ctx->eigen_device<CPUDevice>();
+    switch (src_dtype_) {
+#define CASE(SrcT)                                                      \
+  case DataTypeToEnum<SrcT>::value: {                                   \
+    OP_REQUIRES_OK(ctx, cast_from<SrcT>(device, input, output));        \
+    break;                                                              \
+  }
+      NEURON_CALL_CAST_TYPES(CASE);
+#undef CASE
+      default:
+        ctx->SetStatus(errors::Unimplemented(
+            "Cast from ", DataTypeString(src_dtype_), " to ",
+            DataTypeString(dst_dtype_), " is not supported on ",
+            DEVICE_NEURON));
+    }
+  }
+
+ private:
+  DataType src_dtype_;
+  DataType dst_dtype_;
+};
+
+#undef NEURON_CALL_CAST_TYPES
+
+// must match NEURON_CALL_CAST_TYPES
+static const std::vector<DataType> kCastTypes = {
+    DT_BOOL,  DT_UINT8, DT_INT8,     DT_UINT16, DT_INT16, DT_INT32,
+    DT_INT64, DT_HALF,  DT_BFLOAT16, DT_FLOAT,  DT_DOUBLE};
+
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("Cast", DEVICE_NEURON, CastOp,
+                                     {"SrcT", kCastTypes},
+                                     {"DstT", kCastTypes});
+
+}  // namespace neuron
+}  // namespace tensorflow
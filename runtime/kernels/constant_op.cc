@@ -15,18 +15,38 @@ limitations under the License.
 
 #include "registration.h"
 #include "../device.h"
+#include "../env.h"
 
 namespace tensorflow {
 namespace neuron {
 
+static const int64 kMinBytesOnShm = 64 * 1024;
+
 class ConstantOp : public OpKernel {
  public:
   explicit ConstantOp(OpKernelConstruction* ctx)
       : OpKernel(ctx), tensor_(ctx->output_type(0)) {
     const TensorProto* proto = nullptr;
     OP_REQUIRES_OK(ctx, ctx->GetAttr("value", &proto));
-    OP_REQUIRES_OK(ctx, ctx->device()->MakeTensorFromProto(
-                            *proto, AllocatorAttributes(), &tensor_));
+    // With NEURON_CONSTANT_ON_SHM=1 the constant is parsed once into a
+    // persistent shared memory buffer, which NeuronOp consumers can then
+    // pass to the runtime without copying on every run. Only constants of at
+    // least NEURON_CONSTANT_ON_SHM_MIN_BYTES (default 64 KiB) go there, as
+    // copying a small one costs less than pinning a buffer for it.
+    AllocatorAttributes attr;
+    if (stoi_no_throw(env_get("NEURON_CONSTANT_ON_SHM", "0")) > 0 &&
+        DataTypeCanUseMemcpy(proto->dtype()) &&
+        TensorShape::IsValid(proto->tensor_shape())) {
+      int min_bytes =
+          stoi_no_throw(env_get("NEURON_CONSTANT_ON_SHM_MIN_BYTES", ""));
+      int64 num_bytes = TensorShape(proto->tensor_shape()).num_elements() *
+                        DataTypeSize(proto->dtype());
+      if (num_bytes >= (min_bytes >= 0 ? min_bytes : kMinBytesOnShm)) {
+        NeuronDevice::set_on_valid_shm(&attr);
+      }
+    }
+    OP_REQUIRES_OK(ctx, ctx->device()->MakeTensorFromProto(*proto, attr,
+                                                           &tensor_));
     OP_REQUIRES(
         ctx, ctx->output_type(0) == tensor_.dtype(),
         errors::InvalidArgument(
@@ -0,0 +1,58 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "registration.h"
+#include "../flight_recorder.h"
+#include "../tracer.h"
+
+namespace tensorflow {
+namespace neuron {
+
+class DumpTraceOp : public OpKernel {
+ public:
+  explicit DumpTraceOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("path", &path_));
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    Tracer& tracer = Tracer::GetTracer();
+    OP_REQUIRES_OK(ctx, path_.empty() ? tracer.dump() : tracer.dump(path_));
+  }
+
+ private:
+  std::string path_;
+};
+
+NEURON_REGISTER_KERNEL_BUILDER("NeuronDumpTrace", DEVICE_CPU, DumpTraceOp);
+
+class DumpFlightRecorderOp : public OpKernel {
+ public:
+  explicit DumpFlightRecorderOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("reason", &reason_));
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    OP_REQUIRES_OK(ctx, FlightRecorder::GetFlightRecorder().dump(reason_));
+  }
+
+ private:
+  std::string reason_;
+};
+
+NEURON_REGISTER_KERNEL_BUILDER("NeuronDumpFlightRecorder", DEVICE_CPU,
+                               DumpFlightRecorderOp);
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,97 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#include "registration.h"
+#include "../device.h"
+#include "../output_stream.h"
+#include "tensorflow/core/framework/cancellation.h"
+
+namespace tensorflow {
+namespace neuron {
+
+class OutputStreamOp : public AsyncOpKernel {
+ public:
+  explicit OutputStreamOp(OpKernelConstruction* ctx) : AsyncOpKernel(ctx) {
+    std::string stream_name;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("stream_name", &stream_name));
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("output_dtypes", &output_dtypes_));
+    stream_ = OutputStream::GetOutputStream(stream_name);
+  }
+
+  void ComputeAsync(OpKernelContext* ctx, DoneCallback done) override {
+    DataTypeVector output_dtypes = output_dtypes_;
+    std::shared_ptr<OutputStream> stream = stream_;
+    uint64 reader_id = stream->new_reader_id();
+    CancellationManager* cm = ctx->cancellation_manager();
+    CancellationToken token = CancellationManager::kInvalidToken;
+    if (nullptr != cm) {
+      token = cm->get_cancellation_token();
+      bool registered = cm->RegisterCallback(
+          token, [stream, reader_id] { stream->cancel(reader_id); });
+      OP_REQUIRES_ASYNC(ctx, registered,
+                        errors::Cancelled("read from output stream was "
+                                          "cancelled"),
+                        done);
+    }
+    stream->read(reader_id, [ctx, done, output_dtypes, cm,
+                             token](const StreamChunk& chunk) {
+      if (nullptr != cm) {
+        // non-blocking, as this may run from the cancellation callback
+        cm->TryDeregisterCallback(token);
+      }
+      if (chunk.end) {
+        OP_REQUIRES_OK_ASYNC(ctx, chunk.status, done);
+        ctx->SetStatus(errors::OutOfRange("end of request ", chunk.request_id,
+                                          " on output stream"));
+        done();
+        return;
+      }
+      OP_REQUIRES_ASYNC(
+          ctx, chunk.outputs.size() == output_dtypes.size(),
+          errors::InvalidArgument("output stream has ", chunk.outputs.size(),
+                                  " outputs, expected ", output_dtypes.size()),
+          done);
+      Tensor* row_start = nullptr;
+      OP_REQUIRES_OK_ASYNC(
+          ctx, ctx->allocate_output(0, TensorShape({}), &row_start), done);
+      row_start->scalar<int64>()() = chunk.row_start;
+      Tensor* request_id = nullptr;
+      OP_REQUIRES_OK_ASYNC(
+          ctx, ctx->allocate_output(1, TensorShape({}), &request_id), done);
+      request_id->scalar<int64>()() = chunk.request_id;
+      for (size_t idx = 0; idx < chunk.outputs.size(); ++idx) {
+        const Tensor& output = chunk.outputs[idx];
+        OP_REQUIRES_ASYNC(
+            ctx, output.dtype() == output_dtypes[idx],
+            errors::InvalidArgument("output stream tensor ", idx, " has type ",
+                                    DataTypeString(output.dtype())),
+            done);
+        ctx->set_output(idx + 2, output);
+      }
+      done();
+    });
+  }
+
+ private:
+  DataTypeVector output_dtypes_;
+  std::shared_ptr<OutputStream> stream_;
+};
+
+NEURON_REGISTER_KERNEL_BUILDER("NeuronOutputStream", DEVICE_NEURON,
+                               OutputStreamOp);
+
+}  // namespace neuron
+}  // namespace tensorflow
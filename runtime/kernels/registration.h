@@ -13,6 +13,9 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <string>
+#include <utility>
+#include <vector>
 #include "tensorflow/core/framework/op_kernel.h"
 
 namespace tensorflow {
@@ -43,6 +46,33 @@ static KernelDef* neuron_kernel(const std::string& type,
   return kernel;
 }
 
+typedef std::vector<std::pair<std::string, std::vector<DataType> > >
+    TypeConstraints;
+
+// Same as above, but restricts each listed type attribute to the given data
+// types so that placement never picks DEVICE_NEURON for a type the kernel does
+// not handle.
+static KernelDef* neuron_kernel(const std::string& type,
+                                const std::string& device_type,
+                                const TypeConstraints& type_constraints) {
+  KernelDef* kernel = neuron_kernel(type, device_type);
+  for (const auto& name_types : type_constraints) {
+    KernelDef::AttrConstraint* constraint = kernel->add_constraint();
+    constraint->set_name(name_types.first);
+    auto* allowed_types = constraint->mutable_allowed_values()->mutable_list();
+    for (DataType dtype : name_types.second) {
+      allowed_types->add_type(dtype);
+    }
+  }
+  return kernel;
+}
+
+// Data types that glue op kernels move around as raw bytes
+static const std::vector<DataType> kNeuronMemcpyTypes = {
+    DT_BOOL,  DT_UINT8,  DT_INT8, DT_UINT16,   DT_INT16, DT_INT32, DT_UINT32,
+    DT_INT64, DT_UINT64, DT_HALF, DT_BFLOAT16, DT_FLOAT, DT_DOUBLE};
+static const std::vector<DataType> kNeuronIndexTypes = {DT_INT32, DT_INT64};
+
 #define NEURON_REGISTER_KERNEL_BUILDER(type, device_type, class_name) \
   static kernel_factory::OpKernelRegistrar                            \
       neuron_##device_type##_##class_name##_registrar(                \
@@ -51,5 +81,14 @@ static KernelDef* neuron_kernel(const std::string& type,
             return new (class_name)(context);                         \
           });
 
+#define NEURON_REGISTER_TYPED_KERNEL_BUILDER(type, device_type, class_name, \
+                                             ...)                           \
+  static kernel_factory::OpKernelRegistrar                                  \
+      neuron_##device_type##_##class_name##_registrar(                      \
+          neuron_kernel((type), (device_type), TypeConstraints{__VA_ARGS__}), \
+          (type), [](OpKernelConstruction* context) -> OpKernel* {          \
+            return new (class_name)(context);                               \
+          });
+
 }  // namespace neuron
 }  // namespace tensorflow
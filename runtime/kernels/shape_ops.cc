@@ -0,0 +1,183 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include <unordered_set>
+#include "registration.h"
+#include "../device.h"
+#include "../tensor_util.h"
+#include "tensorflow/core/framework/tensor_shape.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Shape-only ops alias the input buffer, so a shared-memory input stays in
+// shared memory for the NeuronOp consuming the output.
+
+class ReshapeOp : public OpKernel {
+ public:
+  explicit ReshapeOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron reshape implementation";
+    const Tensor& input = ctx->input(0);
+    const Tensor& sizes = ctx->input(1);
+    OP_REQUIRES(ctx, TensorShapeUtils::IsVector(sizes.shape()),
+                errors::InvalidArgument("sizes input must be 1-D, not ",
+                                        sizes.shape().DebugString()));
+    std::vector<int64> dims;
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&dims, sizes));
+    TensorShape shape;
+    int64 product = 1;
+    int unknown_index = -1;
+    for (size_t idx = 0; idx < dims.size(); ++idx) {
+      int64 size = dims[idx];
+      if (-1 == size) {
+        OP_REQUIRES(ctx, -1 == unknown_index,
+                    errors::InvalidArgument("only one input size may be -1, "
+                                            "not both ", unknown_index,
+                                            " and ", idx));
+        unknown_index = idx;
+        shape.AddDim(1);
+      } else {
+        OP_REQUIRES(ctx, size >= 0,
+                    errors::InvalidArgument("size ", idx,
+                                            " must be non-negative, not ",
+                                            size));
+        shape.AddDim(size);
+        product *= size;
+      }
+    }
+    if (-1 != unknown_index) {
+      OP_REQUIRES(ctx, product > 0,
+                  errors::InvalidArgument(
+                      "Reshape cannot infer the missing input size for an "
+                      "empty tensor unless all specified input sizes are "
+                      "non-zero"));
+      int64 missing = input.NumElements() / product;
+      OP_REQUIRES(ctx, product * missing == input.NumElements(),
+                  errors::InvalidArgument(
+                      "Input to reshape is a tensor with ",
+                      input.NumElements(), " values, but the requested shape "
+                      "requires a multiple of ", product));
+      shape.set_dim(unknown_index, missing);
+    }
+    Tensor output;
+    OP_REQUIRES(ctx, output.CopyFrom(input, shape),
+                errors::InvalidArgument(
+                    "Input to reshape is a tensor with ", input.NumElements(),
+                    " values, but the requested shape has ",
+                    shape.num_elements()));
+    ctx->set_output(0, output);
+  }
+
+  bool IsExpensive() override { return false; }
+};
+
+class SqueezeOp : public OpKernel {
+ public:
+  explicit SqueezeOp(OpKernelConstruction* ctx) : OpKernel(ctx) {
+    std::vector<int32> squeeze_dims;
+    OP_REQUIRES_OK(ctx, ctx->GetAttr("squeeze_dims", &squeeze_dims));
+    squeeze_dims_.insert(squeeze_dims.begin(), squeeze_dims.end());
+  }
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron squeeze implementation";
+    const Tensor& input = ctx->input(0);
+    const int rank = input.dims();
+    std::unordered_set<int32> wrapped_squeeze_dims;
+    for (int32 dim : squeeze_dims_) {
+      OP_REQUIRES(ctx, -rank <= dim && dim < rank,
+                  errors::InvalidArgument("Tried to squeeze dim index ", dim,
+                                          " for tensor with ", rank,
+                                          " dimensions."));
+      wrapped_squeeze_dims.insert(dim < 0 ? dim + rank : dim);
+    }
+    TensorShape shape;
+    for (int idx = 0; idx < rank; ++idx) {
+      int64 size = input.dim_size(idx);
+      if (wrapped_squeeze_dims.empty()) {
+        if (1 != size) {
+          shape.AddDim(size);
+        }
+      } else if (wrapped_squeeze_dims.count(idx)) {
+        OP_REQUIRES(ctx, 1 == size,
+                    errors::InvalidArgument(
+                        "Can not squeeze dim[", idx,
+                        "], expected a dimension of 1, got ", size));
+      } else {
+        shape.AddDim(size);
+      }
+    }
+    Tensor output;
+    OP_REQUIRES(ctx, output.CopyFrom(input, shape),
+                errors::Internal("Could not squeeze input with shape ",
+                                 input.shape().DebugString(), " to ",
+                                 shape.DebugString()));
+    ctx->set_output(0, output);
+  }
+
+  bool IsExpensive() override { return false; }
+
+ private:
+  std::unordered_set<int32> squeeze_dims_;
+};
+
+class ExpandDimsOp : public OpKernel {
+ public:
+  explicit ExpandDimsOp(OpKernelConstruction* ctx) : OpKernel(ctx) {}
+
+  void Compute(OpKernelContext* ctx) override {
+    VLOG(1) << "executing Neuron expand_dims implementation";
+    const Tensor& input = ctx->input(0);
+    const Tensor& dim_tensor = ctx->input(1);
+    OP_REQUIRES(ctx, 1 == dim_tensor.NumElements(),
+                errors::InvalidArgument(
+                    "'dim' must be a tensor with a single value"));
+    std::vector<int64> dim_values;
+    OP_REQUIRES_OK(ctx, tensor_to_int64s(&dim_values, dim_tensor));
+    const int64 rank = input.dims();
+    int64 dim = dim_values[0];
+    OP_REQUIRES(ctx, -1 - rank <= dim && dim <= rank,
+                errors::InvalidArgument("Tried to expand dim index ", dim,
+                                        " for tensor with ", rank,
+                                        " dimensions."));
+    if (dim < 0) {
+      dim += rank + 1;
+    }
+    TensorShape shape(input.shape());
+    shape.InsertDim(dim, 1);
+    Tensor output;
+    OP_REQUIRES(ctx, output.CopyFrom(input, shape),
+                errors::Internal("Could not expand dimension with input shape ",
+                                 input.shape().DebugString(),
+                                 " and output shape ", shape.DebugString()));
+    ctx->set_output(0, output);
+  }
+
+  bool IsExpensive() override { return false; }
+};
+
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("Reshape", DEVICE_NEURON, ReshapeOp,
+                                     {"T", kNeuronMemcpyTypes},
+                                     {"Tshape", kNeuronIndexTypes});
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("Squeeze", DEVICE_NEURON, SqueezeOp,
+                                     {"T", kNeuronMemcpyTypes});
+NEURON_REGISTER_TYPED_KERNEL_BUILDER("ExpandDims", DEVICE_NEURON, ExpandDimsOp,
+                                     {"T", kNeuronMemcpyTypes},
+                                     {"Tdim", kNeuronIndexTypes});
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,294 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "metrics.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// 1 us to ~1.2 hours in powers of two
+static std::unique_ptr<monitoring::Buckets> latency_buckets() {
+  return monitoring::Buckets::Exponential(1.0, 2.0, 32);
+}
+
+static auto* neuron_latency = monitoring::Sampler<1>::New(
+    {"/tensorflow/neuron/latency_us",
+     "End-to-end NeuronOp compute time in microseconds.", "model"},
+    latency_buckets());
+
+static auto* neuron_copy = monitoring::Sampler<2>::New(
+    {"/tensorflow/neuron/copy_us",
+     "Time spent copying tensors to and from the runtime, in microseconds.",
+     "model", "direction"},
+    latency_buckets());
+
+static auto* neuron_engine_lock_wait = monitoring::Sampler<1>::New(
+    {"/tensorflow/neuron/engine_lock_wait_us",
+     "Time waiting for the NeuronEngine lock in microseconds.", "model"},
+    latency_buckets());
+
+static auto* neuron_semaphore_wait = monitoring::Sampler<2>::New(
+    {"/tensorflow/neuron/semaphore_wait_us",
+     "Time waiting for a free replica slot in microseconds.", "model",
+     "replica"},
+    latency_buckets());
+
+static auto* neuron_infer_post = monitoring::Sampler<2>::New(
+    {"/tensorflow/neuron/infer_post_us",
+     "Time to post an inference request in microseconds.", "model",
+     "replica"},
+    latency_buckets());
+
+static auto* neuron_infer_wait = monitoring::Sampler<2>::New(
+    {"/tensorflow/neuron/infer_wait_us",
+     "Time waiting for an inference result in microseconds.", "model",
+     "replica"},
+    latency_buckets());
+
+static auto* neuron_inferences = monitoring::Counter<2>::New(
+    "/tensorflow/neuron/inferences", "Number of inferences run on a replica.",
+    "model", "replica");
+
+static auto* neuron_real_rows = monitoring::Counter<1>::New(
+    "/tensorflow/neuron/real_rows",
+    "Number of batch rows of request data sent to the device.", "model");
+
+static auto* neuron_padded_rows = monitoring::Counter<1>::New(
+    "/tensorflow/neuron/padded_rows",
+    "Number of batch rows added to fill the compiled batch size.", "model");
+
+static auto* neuron_batch_efficiency = monitoring::Gauge<int64, 1>::New(
+    "/tensorflow/neuron/batch_efficiency_permille",
+    "Real rows per thousand rows sent to the device.", "model");
+
+static auto* neuron_device_busy = monitoring::Counter<2>::New(
+    "/tensorflow/neuron/device_busy_us",
+    "Time a replica had at least one inference in flight, in microseconds.",
+    "model", "replica");
+
+static auto* neuron_utilization = monitoring::Gauge<int64, 2>::New(
+    "/tensorflow/neuron/utilization_permille",
+    "Permille of time since its first inference that a replica was busy.",
+    "model", "replica");
+
+static auto* neuron_model_switches = monitoring::Counter<1>::New(
+    "/tensorflow/neuron/model_switches",
+    "Number of times a model was started in place of another one.", "model");
+
+static auto* neuron_result_cache_lookups = monitoring::Counter<2>::New(
+    "/tensorflow/neuron/result_cache_lookups",
+    "Number of result cache lookups by outcome.", "model", "result");
+
+static auto* neuron_result_cache_hit_rate = monitoring::Gauge<int64, 1>::New(
+    "/tensorflow/neuron/result_cache_hit_rate_permille",
+    "Result cache hits per thousand lookups.", "model");
+
+static auto* neuron_errors = monitoring::Counter<2>::New(
+    "/tensorflow/neuron/errors", "Number of failed NeuronOp computes.",
+    "model", "code");
+
+static auto* neuron_shm_allocations = monitoring::Counter<1>::New(
+    "/tensorflow/neuron/shm_allocations",
+    "Number of shared memory buffers allocated.", "source");
+
+ModelMetrics::~ModelMetrics() {
+  if (!initialized_) {
+    return;
+  }
+  if (total_padded_rows_ > 0) {
+    LOG(INFO) << "device usage for " << model_name_ << ": " << debug_string();
+  } else {
+    VLOG(1) << "device usage for " << model_name_ << ": " << debug_string();
+  }
+}
+
+void ModelMetrics::initialize(const std::string& model_name) {
+  if (TF_PREDICT_TRUE(initialized_.load(std::memory_order_acquire))) {
+    return;
+  }
+  tensorflow::mutex_lock lock(mutex_);
+  if (initialized_) {
+    return;
+  }
+  model_name_ = model_name;
+  latency_ = neuron_latency->GetCell(model_name);
+  input_copy_ = neuron_copy->GetCell(model_name, "input");
+  output_copy_ = neuron_copy->GetCell(model_name, "output");
+  engine_lock_wait_ = neuron_engine_lock_wait->GetCell(model_name);
+  real_rows_ = neuron_real_rows->GetCell(model_name);
+  padded_rows_ = neuron_padded_rows->GetCell(model_name);
+  batch_efficiency_ = neuron_batch_efficiency->GetCell(model_name);
+  model_switches_ = neuron_model_switches->GetCell(model_name);
+  result_cache_hits_ = neuron_result_cache_lookups->GetCell(model_name, "hit");
+  result_cache_misses_ =
+      neuron_result_cache_lookups->GetCell(model_name, "miss");
+  result_cache_hit_rate_ = neuron_result_cache_hit_rate->GetCell(model_name);
+  initialized_.store(true, std::memory_order_release);
+}
+
+void ModelMetrics::set_replicas(const std::vector<uint32_t>& replica_nn_ids) {
+  tensorflow::mutex_lock lock(mutex_);
+  replicas_.clear();
+  for (const uint32_t nn_id : replica_nn_ids) {
+    std::string replica = std::to_string(nn_id);
+    std::unique_ptr<ReplicaState> state(new ReplicaState);
+    state->nn_id = nn_id;
+    state->semaphore_wait =
+        neuron_semaphore_wait->GetCell(model_name_, replica);
+    state->infer_post = neuron_infer_post->GetCell(model_name_, replica);
+    state->infer_wait = neuron_infer_wait->GetCell(model_name_, replica);
+    state->inferences = neuron_inferences->GetCell(model_name_, replica);
+    state->device_busy = neuron_device_busy->GetCell(model_name_, replica);
+    state->utilization = neuron_utilization->GetCell(model_name_, replica);
+    replicas_.push_back(std::move(state));
+  }
+}
+
+void ModelMetrics::record_semaphore_wait(size_t replica_idx, uint64 us) {
+  if (TF_PREDICT_TRUE(replica_idx < replicas_.size())) {
+    add(replicas_[replica_idx]->semaphore_wait, us);
+  }
+}
+
+void ModelMetrics::record_infer_post(size_t replica_idx, uint64 us) {
+  if (TF_PREDICT_TRUE(replica_idx < replicas_.size())) {
+    add(replicas_[replica_idx]->infer_post, us);
+  }
+}
+
+void ModelMetrics::record_infer_wait(size_t replica_idx, uint64 us) {
+  if (TF_PREDICT_TRUE(replica_idx < replicas_.size())) {
+    add(replicas_[replica_idx]->infer_wait, us);
+  }
+}
+
+void ModelMetrics::count_inference(size_t replica_idx) {
+  if (TF_PREDICT_TRUE(replica_idx < replicas_.size())) {
+    replicas_[replica_idx]->inferences->IncrementBy(1);
+  }
+}
+
+void ModelMetrics::count_rows(int64 real_rows, int64 padded_rows) {
+  if (TF_PREDICT_FALSE(nullptr == real_rows_)) {
+    return;
+  }
+  real_rows_->IncrementBy(real_rows);
+  padded_rows_->IncrementBy(padded_rows);
+  int64 total_real = total_real_rows_ += real_rows;
+  int64 total_padded = total_padded_rows_ += padded_rows;
+  int64 total = total_real + total_padded;
+  if (TF_PREDICT_TRUE(total > 0)) {
+    batch_efficiency_->Set(total_real * 1000 / total);
+  }
+}
+
+void ModelMetrics::begin_device_busy(size_t replica_idx, uint64 now_us) {
+  if (TF_PREDICT_FALSE(replica_idx >= replicas_.size())) {
+    return;
+  }
+  ReplicaState* state = replicas_[replica_idx].get();
+  tensorflow::mutex_lock lock(state->mutex);
+  if (0 == state->num_in_flight++) {
+    state->busy_since_us = now_us;
+    if (0 == state->first_busy_us) {
+      state->first_busy_us = now_us;
+    }
+  }
+}
+
+void ModelMetrics::end_device_busy(size_t replica_idx, uint64 now_us) {
+  if (TF_PREDICT_FALSE(replica_idx >= replicas_.size())) {
+    return;
+  }
+  ReplicaState* state = replicas_[replica_idx].get();
+  tensorflow::mutex_lock lock(state->mutex);
+  if (TF_PREDICT_FALSE(state->num_in_flight <= 0)) {
+    return;
+  }
+  if (0 == --state->num_in_flight) {
+    uint64 busy_us = now_us - state->busy_since_us;
+    state->total_busy_us += busy_us;
+    state->device_busy->IncrementBy(busy_us);
+    uint64 lifetime_us = now_us - state->first_busy_us;
+    if (TF_PREDICT_TRUE(lifetime_us > 0)) {
+      state->utilization->Set(state->total_busy_us * 1000 / lifetime_us);
+    }
+  }
+}
+
+void ModelMetrics::count_model_switch() {
+  if (TF_PREDICT_TRUE(nullptr != model_switches_)) {
+    model_switches_->IncrementBy(1);
+  }
+}
+
+void ModelMetrics::count_result_cache_lookup(bool hit) {
+  if (TF_PREDICT_FALSE(nullptr == result_cache_hits_)) {
+    return;
+  }
+  (hit ? result_cache_hits_ : result_cache_misses_)->IncrementBy(1);
+  int64 total_hits = total_result_cache_hits_ += hit ? 1 : 0;
+  int64 total_lookups = ++total_result_cache_lookups_;
+  result_cache_hit_rate_->Set(total_hits * 1000 / total_lookups);
+}
+
+void ModelMetrics::count_error(const Status& status) {
+  if (status.ok()) {
+    return;
+  }
+  // errors are rare, so looking up the cell each time is fine
+  neuron_errors->GetCell(model_name_, error::Code_Name(status.code()))
+      ->IncrementBy(1);
+}
+
+std::string ModelMetrics::debug_string() {
+  int64 total_real = total_real_rows_;
+  int64 total_padded = total_padded_rows_;
+  int64 total = total_real + total_padded;
+  double efficiency = total > 0 ? (double)total_real / total : 1.0;
+  std::string result =
+      strings::StrCat("real_rows=", total_real, ", padded_rows=", total_padded,
+                      ", batch_efficiency=", efficiency);
+  uint64 now_us = Env::Default()->NowMicros();
+  tensorflow::mutex_lock lock(mutex_);
+  for (const auto& state : replicas_) {
+    tensorflow::mutex_lock replica_lock(state->mutex);
+    uint64 busy_us = state->total_busy_us;
+    if (state->num_in_flight > 0) {
+      busy_us += now_us - state->busy_since_us;
+    }
+    uint64 lifetime_us = now_us - state->first_busy_us;
+    double utilization =
+        state->first_busy_us > 0 && lifetime_us > 0
+            ? (double)busy_us / lifetime_us
+            : 0.0;
+    strings::StrAppend(&result, ", replica ", state->nn_id,
+                       " utilization=", utilization);
+  }
+  return result;
+}
+
+void count_shm_allocation(bool reused) {
+  static monitoring::CounterCell* reused_cell =
+      neuron_shm_allocations->GetCell("reused");
+  static monitoring::CounterCell* new_cell =
+      neuron_shm_allocations->GetCell("new");
+  (reused ? reused_cell : new_cell)->IncrementBy(1);
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,117 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_METRICS_H_
+#define TENSORFLOW_NEURON_RUNTIME_METRICS_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "macros.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/lib/monitoring/counter.h"
+#include "tensorflow/core/lib/monitoring/gauge.h"
+#include "tensorflow/core/lib/monitoring/sampler.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Per-NeuronOp view of the /tensorflow/neuron/* metrics exported through
+// tensorflow/core/lib/monitoring (and thus TF Serving's Prometheus endpoint).
+// Metric cells are looked up once, so recording is a lock-free histogram or
+// counter update. Times are in microseconds.
+//
+// Besides raw counters, three ratios are kept up to date as permille gauges:
+// batch efficiency (real rows over real plus padded rows) and result cache
+// hit rate per model, and device utilization (time with at least one
+// inference in flight over time since the first inference) per replica.
+class ModelMetrics {
+ public:
+  ModelMetrics() {}
+  ~ModelMetrics();
+  // Idempotent; cheap after the first call
+  void initialize(const std::string& model_name);
+  // Called once the model is loaded; replica_idx below indexes this vector
+  void set_replicas(const std::vector<uint32_t>& replica_nn_ids);
+  void record_latency(uint64 us) { add(latency_, us); }
+  void record_input_copy(uint64 us) { add(input_copy_, us); }
+  void record_output_copy(uint64 us) { add(output_copy_, us); }
+  void record_engine_lock_wait(uint64 us) { add(engine_lock_wait_, us); }
+  void record_semaphore_wait(size_t replica_idx, uint64 us);
+  void record_infer_post(size_t replica_idx, uint64 us);
+  void record_infer_wait(size_t replica_idx, uint64 us);
+  void count_inference(size_t replica_idx);
+  // Rows of real data and rows of zero padding sent to the device
+  void count_rows(int64 real_rows, int64 padded_rows);
+  // Bracket a replica's inference from post until its result is available
+  void begin_device_busy(size_t replica_idx, uint64 now_us);
+  void end_device_busy(size_t replica_idx, uint64 now_us);
+  void count_model_switch();
+  void count_result_cache_lookup(bool hit);
+  void count_error(const Status& status);
+  std::string debug_string();
+
+ private:
+  struct ReplicaState {
+    uint32_t nn_id;
+    monitoring::SamplerCell* semaphore_wait;
+    monitoring::SamplerCell* infer_post;
+    monitoring::SamplerCell* infer_wait;
+    monitoring::CounterCell* inferences;
+    monitoring::CounterCell* device_busy;
+    monitoring::GaugeCell<int64>* utilization;
+    // overlapping inferences count once toward busy time
+    tensorflow::mutex mutex;
+    int num_in_flight = 0;
+    uint64 busy_since_us = 0;
+    uint64 first_busy_us = 0;
+    uint64 total_busy_us = 0;
+  };
+  static void add(monitoring::SamplerCell* cell, uint64 us) {
+    if (TF_PREDICT_TRUE(nullptr != cell)) {
+      cell->Add((double)us);
+    }
+  }
+  tensorflow::mutex mutex_;
+  std::atomic<bool> initialized_{false};
+  std::string model_name_ = "";
+  monitoring::SamplerCell* latency_ = nullptr;
+  monitoring::SamplerCell* input_copy_ = nullptr;
+  monitoring::SamplerCell* output_copy_ = nullptr;
+  monitoring::SamplerCell* engine_lock_wait_ = nullptr;
+  monitoring::CounterCell* real_rows_ = nullptr;
+  monitoring::CounterCell* padded_rows_ = nullptr;
+  monitoring::GaugeCell<int64>* batch_efficiency_ = nullptr;
+  monitoring::CounterCell* model_switches_ = nullptr;
+  monitoring::CounterCell* result_cache_hits_ = nullptr;
+  monitoring::CounterCell* result_cache_misses_ = nullptr;
+  monitoring::GaugeCell<int64>* result_cache_hit_rate_ = nullptr;
+  std::atomic<int64> total_real_rows_{0};
+  std::atomic<int64> total_padded_rows_{0};
+  std::atomic<int64> total_result_cache_hits_{0};
+  std::atomic<int64> total_result_cache_lookups_{0};
+  std::vector<std::unique_ptr<ReplicaState> > replicas_;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(ModelMetrics);
+};
+
+// Counts shared memory buffers handed out by SharedMemoryAllocator;
+// `reused` tells whether the buffer came from the free list
+void count_shm_allocation(bool reused);
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_METRICS_H_
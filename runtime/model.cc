@@ -13,10 +13,16 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
+#include <atomic>
 #include "model.h"
 #include "device.h"
 #include "engine.h"
+#include "flight_recorder.h"
 #include "model_config.h"
+#include "packing.h"
+#include "result_cache.h"
+#include "shard_cost.h"
+#include "tracer.h"
 
 #define TFNN_ASSERT(cond, error)     \
   {                                  \
@@ -39,10 +45,19 @@ namespace neuron {
 
 // some keys
 const char kInputShuffles[] = "_input_shuffles";
+const char kInputPaddingAxis[] = "_input_padding_axis";
+const char kOutputPaddingAxis[] = "_output_padding_axis";
+const char kBucketLengths[] = "_bucket_lengths";
+const char kBucketExecutables[] = "_bucket_executables";
+const char kPackingMaskInput[] = "_packing_mask_input";
+const char kPackingSegmentIdsInput[] = "_packing_segment_ids_input";
+const char kOutputStream[] = "_output_stream";
+const char kPipelineStages[] = "_pipeline_stages";
 
 // some magic numbers
 static const int64 UNINIT_BATCH_SIZE = -8;
 static const int64 STATIC_BATCH_AXIS = -1;
+static const int64 NO_PADDING_AXIS = -1;
 static const int64 H2D_POOL_SIZE = 8;
 
 static size_t get_tensor_size(const DataType dype,
@@ -80,6 +95,29 @@ static Status get_io_tensor_sizes(std::vector<size_t>* tensor_sizes,
   return Status::OK();
 }
 
+static void push_stream_chunk(OutputStream* stream, uint64 request_id,
+                              int64 row_start, int64 row_limit,
+                              std::vector<Tensor> outputs) {
+  StreamChunk chunk;
+  chunk.request_id = request_id;
+  chunk.row_start = row_start;
+  chunk.row_limit = row_limit;
+  chunk.outputs = std::move(outputs);
+  stream->push(std::move(chunk));
+}
+
+static std::vector<Tensor> get_outputs(OpKernelContext* ctx) {
+  std::vector<Tensor> outputs;
+  for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
+    outputs.push_back(*ctx->mutable_output(idx));
+  }
+  return outputs;
+}
+
+static uint32_t elapsed_us(const RequestRecord& record) {
+  return Env::Default()->NowMicros() - record.start_us;
+}
+
 static Status check_input_tensors(const std::vector<Tensor>& input_tensors,
                                   const NodeDef& node_def) {
   AttrList& input_names = node_def.attr().at("input_names").list();
@@ -269,6 +307,7 @@ Status NeuronModel::initialize(const NodeDef& node_def,
     return errors::InvalidArgument("Neuron executable (neff) is empty.");
   }
   profile_.initialize(env_get("NEURON_PROFILE"), node_def.name());
+  result_cache_.initialize(node_def.name());
   if (profile_.enabled_)
     profile_.dump_info(attr.at("graph_def").s(), executable);
   AttrList& model_config_attr = attr.at("model_config").list();
@@ -283,12 +322,12 @@ Status NeuronModel::initialize(const NodeDef& node_def,
   model_config.parse_ninfer(model_config_attr, neuron_engine_->num_cores(),
                             NeuronEngineManager::MIN_NUM_CORES,
                             NeuronEngineManager::MAX_NUM_CORES);
-  estimated_cost_ = executable.size();
   TF_RETURN_IF_ERROR(
-      neuron_engine_->load(&nn_id_, executable, model_config.timeout_,
+      neuron_engine_->load(&model_desc_, executable, model_config.timeout_,
                            model_config.ninfer_, profile_.enabled_));
-  VLOG(1) << "loaded " << node_def.name() << " as " << nn_id_
+  VLOG(1) << "loaded " << node_def.name() << " as " << model_desc_->nn_id
           << "; number of NEFFs: " << neuron_engine_->num_executable();
+  metrics_.set_replicas(model_desc_->replica_nn_ids);
 
   // check argument sizes
   TF_RETURN_IF_ERROR(get_io_tensor_sizes(nullptr, node_def, "input"));
@@ -298,8 +337,625 @@ Status NeuronModel::initialize(const NodeDef& node_def,
 
 Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
                             const std::vector<Tensor>& input_tensors) {
-  uint64 start_time = Env::Default()->NowMicros();
+  metrics_.initialize(node_def.name());
+  RequestRecord record;
+  record.start_us = Env::Default()->NowMicros();
+  const google::protobuf::Map<std::string, AttrValue>& attr = node_def.attr();
+  std::shared_ptr<OutputStream> stream = nullptr;
+  uint64 stream_request = 0;
+  if (TF_PREDICT_FALSE(attr.count(kOutputStream))) {
+    stream = OutputStream::GetOutputStream(attr.at(kOutputStream).s());
+    stream_request = stream->begin_request();
+  }
+  Status status;
+  bool streams_shards = false;
+  if (attr.count(kPipelineStages)) {
+    status = compute_pipelined(ctx, node_def, input_tensors, &record);
+  } else if (attr.count(kPackingMaskInput)) {
+    status = compute_packed(ctx, node_def, input_tensors, &record);
+  } else if (attr.count(kInputPaddingAxis)) {
+    status = compute_padded(ctx, node_def, input_tensors, &record);
+  } else {
+    streams_shards = true;
+    status = compute_internal(ctx, node_def, input_tensors, &record,
+                              stream.get(), stream_request);
+  }
+  if (TF_PREDICT_FALSE(nullptr != stream)) {
+    // padded and packed outputs are only final once the whole request is done
+    if (status.ok() && !streams_shards) {
+      push_stream_chunk(stream.get(), stream_request, 0, record.batch_size,
+                        get_outputs(ctx));
+    }
+    stream->end_request(stream_request, status);
+  }
+  record.end_us = elapsed_us(record);
+  metrics_.record_latency(record.end_us);
+  metrics_.count_error(status);
+  FlightRecorder& flight_recorder = FlightRecorder::GetFlightRecorder();
+  if (TF_PREDICT_TRUE(flight_recorder.enabled())) {
+    record.status_code = status.code();
+    record.set_name(node_def.name());
+    flight_recorder.record(record);
+  }
+  return status;
+}
+
+Status NeuronModel::initialize_buckets(const NodeDef& node_def) {
+  tensorflow::mutex_lock lock(mutex_buckets_);
+  if (TF_PREDICT_TRUE(buckets_initialized_)) {
+    return buckets_status_;
+  }
+  buckets_initialized_ = true;
+  const google::protobuf::Map<std::string, AttrValue>& attr = node_def.attr();
+  AttrList& input_padding_axis = attr.at(kInputPaddingAxis).list();
+  AttrList& input_shapes = attr.at("input_shapes").list();
+  AttrList& output_shapes = attr.at("output_shapes").list();
+  std::vector<int64> output_padding_axis(output_shapes.shape_size(),
+                                         NO_PADDING_AXIS);
+  if (attr.count(kOutputPaddingAxis)) {
+    AttrList& axes = attr.at(kOutputPaddingAxis).list();
+    output_padding_axis.assign(axes.i().begin(), axes.i().end());
+  }
+  buckets_status_ = errors::InvalidArgument(
+      "invalid sequence-length buckets on ", node_def.name());
+  TFNN_ASSERT(
+      input_padding_axis.i_size() == input_shapes.shape_size() &&
+          (int64)output_padding_axis.size() == output_shapes.shape_size(),
+      buckets_status_);
+  TFNN_ASSERT(!attr.count(kInputShuffles), buckets_status_);
+
+  // the op's own executable is the bucket for the full sequence length
+  int64 full_length = -1;
+  for (auto idx = 0; idx < input_padding_axis.i_size(); ++idx) {
+    int64 axis = input_padding_axis.i(idx);
+    if (axis == NO_PADDING_AXIS) continue;
+    const TensorShapeProto& shape = input_shapes.shape(idx);
+    TFNN_ASSERT(0 <= axis && axis < shape.dim_size(), buckets_status_);
+    TFNN_ASSERT(full_length < 0 || full_length == shape.dim(axis).size(),
+                buckets_status_);
+    full_length = shape.dim(axis).size();
+  }
+  for (size_t idx = 0; idx < output_padding_axis.size(); ++idx) {
+    int64 axis = output_padding_axis[idx];
+    if (axis == NO_PADDING_AXIS) continue;
+    const TensorShapeProto& shape = output_shapes.shape(idx);
+    TFNN_ASSERT(0 <= axis && axis < shape.dim_size(), buckets_status_);
+    TFNN_ASSERT(full_length == shape.dim(axis).size(), buckets_status_);
+  }
+  if (attr.count(kBucketLengths)) {
+    AttrList& bucket_lengths = attr.at(kBucketLengths).list();
+    TFNN_ASSERT(attr.count(kBucketExecutables), buckets_status_);
+    AttrList& bucket_executables = attr.at(kBucketExecutables).list();
+    TFNN_ASSERT(bucket_lengths.i_size() == bucket_executables.s_size(),
+                buckets_status_);
+    int64 prev_length = 0;
+    for (auto bucket_idx = 0; bucket_idx < bucket_lengths.i_size();
+         ++bucket_idx) {
+      int64 length = bucket_lengths.i(bucket_idx);
+      TFNN_ASSERT(prev_length < length && length < full_length,
+                  buckets_status_);
+      prev_length = length;
+      LengthBucket bucket;
+      bucket.length = length;
+      bucket.node_def = node_def;
+      bucket.node_def.set_name(
+          strings::StrCat(node_def.name(), "/bucket_", length));
+      auto* bucket_attr = bucket.node_def.mutable_attr();
+      bucket_attr->erase(kInputPaddingAxis);
+      bucket_attr->erase(kOutputPaddingAxis);
+      bucket_attr->erase(kBucketLengths);
+      bucket_attr->erase(kBucketExecutables);
+      (*bucket_attr)["executable"].set_s(bucket_executables.s(bucket_idx));
+      AttrValue::ListValue* shapes =
+          (*bucket_attr)["input_shapes"].mutable_list();
+      for (auto idx = 0; idx < input_padding_axis.i_size(); ++idx) {
+        int64 axis = input_padding_axis.i(idx);
+        if (axis == NO_PADDING_AXIS) continue;
+        shapes->mutable_shape(idx)->mutable_dim(axis)->set_size(length);
+      }
+      shapes = (*bucket_attr)["output_shapes"].mutable_list();
+      for (size_t idx = 0; idx < output_padding_axis.size(); ++idx) {
+        int64 axis = output_padding_axis[idx];
+        if (axis == NO_PADDING_AXIS) continue;
+        shapes->mutable_shape(idx)->mutable_dim(axis)->set_size(length);
+      }
+      bucket.model.reset(new NeuronModel);
+      bucket.model->metrics_.initialize(bucket.node_def.name());
+      buckets_.push_back(std::move(bucket));
+    }
+  }
+  LengthBucket full_bucket;
+  full_bucket.length = full_length;
+  buckets_.push_back(std::move(full_bucket));
+  VLOG(1) << node_def.name() << " has " << buckets_.size()
+          << " sequence-length buckets up to " << full_length;
+  buckets_status_ = Status::OK();
+  return buckets_status_;
+}
+
+Status NeuronModel::compute_padded(OpKernelContext* ctx,
+                                   const NodeDef& node_def,
+                                   const std::vector<Tensor>& input_tensors,
+                                   RequestRecord* record) {
+  TF_RETURN_IF_ERROR(initialize_buckets(node_def));
+  const google::protobuf::Map<std::string, AttrValue>& attr = node_def.attr();
+  AttrList& input_padding_axis = attr.at(kInputPaddingAxis).list();
+  TFNN_ASSERT((int)input_tensors.size() == input_padding_axis.i_size(),
+              errors::InvalidArgument("incorrect number of input tensors"));
+  int64 length = -1;
+  for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
+    int64 axis = input_padding_axis.i(idx);
+    if (axis == NO_PADDING_AXIS) continue;
+    const Tensor& in_tensor = input_tensors.at(idx);
+    TFNN_ASSERT(axis < in_tensor.dims() &&
+                    (length < 0 || length == in_tensor.dim_size(axis)),
+                errors::InvalidArgument(
+                    "incorrect sequence length found on input tensor ", idx,
+                    " with shape ", in_tensor.shape().DebugString()));
+    length = in_tensor.dim_size(axis);
+  }
+
+  // pick the smallest bucket that fits the request
+  const LengthBucket* bucket = nullptr;
+  for (const LengthBucket& candidate : buckets_) {
+    if (candidate.length >= length) {
+      bucket = &candidate;
+      break;
+    }
+  }
+  TFNN_ASSERT(nullptr != bucket,
+              errors::InvalidArgument("sequence length ", length,
+                                      " exceeds the largest bucket ",
+                                      buckets_.back().length));
+  NeuronModel* model = bucket->model ? bucket->model.get() : this;
+  const NodeDef& bucket_def = bucket->model ? bucket->node_def : node_def;
+  VLOG(1) << "sequence length " << length << " runs in bucket "
+          << bucket->length;
+  if (length == bucket->length) {
+    return model->compute_internal(ctx, bucket_def, input_tensors, record);
+  }
+
+  // pad straight into shared memory, so that these are the staging copies
+  SharedMemoryAllocator* shm_allocator =
+      NeuronEngineManager::GetNeuronEngineManager().get_shm_allocator();
+  std::vector<Tensor> padded_inputs(input_tensors.size());
+  for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
+    const Tensor& in_tensor = input_tensors.at(idx);
+    int64 axis = input_padding_axis.i(idx);
+    if (axis == NO_PADDING_AXIS) {
+      padded_inputs[idx] = in_tensor;
+      continue;
+    }
+    TensorShape shape(in_tensor.shape());
+    shape.set_dim(axis, bucket->length);
+    AllocatorAttributes alloc_attr;
+    NeuronDevice::set_on_shm(&alloc_attr, shm_allocator->is_valid());
+    Tensor* padded = &padded_inputs[idx];
+    TF_RETURN_IF_ERROR(
+        ctx->allocate_temp(in_tensor.dtype(), shape, padded, alloc_attr));
+    TF_RETURN_IF_ERROR(tensor_pad_axis(padded, in_tensor, axis));
+  }
+  TF_RETURN_IF_ERROR(
+      model->compute_internal(ctx, bucket_def, padded_inputs, record));
+
+  // trim outputs back to the sequence length of the request
+  if (!attr.count(kOutputPaddingAxis)) {
+    return Status::OK();
+  }
+  AttrList& output_padding_axis = attr.at(kOutputPaddingAxis).list();
+  for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
+    int64 axis = output_padding_axis.i(idx);
+    if (axis == NO_PADDING_AXIS) continue;
+    Tensor padded = *ctx->mutable_output(idx);
+    TensorShape shape(padded.shape());
+    shape.set_dim(axis, length);
+    Tensor trimmed;
+    TF_RETURN_IF_ERROR(ctx->allocate_temp(padded.dtype(), shape, &trimmed));
+    TF_RETURN_IF_ERROR(tensor_copy_axis(&trimmed, 0, padded, 0, length, axis));
+    ctx->set_output(idx, trimmed);
+  }
+  return Status::OK();
+}
+
+Status NeuronModel::compute_packed(OpKernelContext* ctx,
+                                   const NodeDef& node_def,
+                                   const std::vector<Tensor>& input_tensors,
+                                   RequestRecord* record) {
+  const google::protobuf::Map<std::string, AttrValue>& attr = node_def.attr();
+  TFNN_ASSERT(attr.count(kInputPaddingAxis) && attr.count(kOutputPaddingAxis),
+              errors::InvalidArgument("packing needs ", kInputPaddingAxis,
+                                      " and ", kOutputPaddingAxis));
+  AttrList& input_padding_axis = attr.at(kInputPaddingAxis).list();
+  AttrList& output_padding_axis = attr.at(kOutputPaddingAxis).list();
+  AttrList& input_batch_axis = attr.at("input_batch_axis").list();
+  AttrList& output_batch_axis = attr.at("output_batch_axis").list();
+  AttrList& input_shapes = attr.at("input_shapes").list();
+  int64 mask_idx = attr.at(kPackingMaskInput).i();
+  // packed rows are told apart only by segment ids, so the model has to
+  // declare the input that takes them; it may be the mask input itself, but
+  // a 0/1 mask is never reinterpreted without this opt-in
+  TFNN_ASSERT(attr.count(kPackingSegmentIdsInput),
+              errors::InvalidArgument(
+                  node_def.name(), " sets ", kPackingMaskInput, " but not ",
+                  kPackingSegmentIdsInput, "; packing needs an input that "
+                  "takes per-token segment ids"));
+  int64 segment_idx = attr.at(kPackingSegmentIdsInput).i();
+  TFNN_ASSERT(
+      (int)input_tensors.size() == input_padding_axis.i_size() &&
+          input_batch_axis.i_size() == input_padding_axis.i_size() &&
+          output_padding_axis.i_size() == ctx->num_outputs() &&
+          output_batch_axis.i_size() == ctx->num_outputs() &&
+          0 <= mask_idx && mask_idx < (int64)input_tensors.size() &&
+          0 <= segment_idx && segment_idx < (int64)input_tensors.size(),
+      errors::InvalidArgument("invalid packing attributes on ",
+                              node_def.name()));
+
+  // only [batch, length, ...] tensors can be packed; anything else batched
+  // would need one value per packed row
+  for (auto idx = 0; idx < input_padding_axis.i_size(); ++idx) {
+    bool is_token = 0 == input_batch_axis.i(idx) &&
+                    1 == input_padding_axis.i(idx);
+    bool is_static = STATIC_BATCH_AXIS == input_batch_axis.i(idx) &&
+                     NO_PADDING_AXIS == input_padding_axis.i(idx);
+    TFNN_ASSERT(is_token || is_static,
+                errors::InvalidArgument("cannot pack input tensor ", idx));
+  }
+  for (auto idx = 0; idx < output_padding_axis.i_size(); ++idx) {
+    bool is_token = 0 == output_batch_axis.i(idx) &&
+                    1 == output_padding_axis.i(idx);
+    bool is_static = STATIC_BATCH_AXIS == output_batch_axis.i(idx) &&
+                     NO_PADDING_AXIS == output_padding_axis.i(idx);
+    TFNN_ASSERT(is_token || is_static,
+                errors::InvalidArgument("cannot unpack output tensor ", idx));
+  }
+  const TensorShapeProto& mask_shape = input_shapes.shape(mask_idx);
+  TFNN_ASSERT(1 == input_padding_axis.i(mask_idx) && 2 == mask_shape.dim_size(),
+              errors::InvalidArgument("packing mask input ", mask_idx,
+                                      " must be [batch, length]"));
+  const TensorShapeProto& segment_shape = input_shapes.shape(segment_idx);
+  TFNN_ASSERT(1 == input_padding_axis.i(segment_idx) &&
+                  2 == segment_shape.dim_size(),
+              errors::InvalidArgument("packing segment ids input ",
+                                      segment_idx, " must be [batch, length]"));
+
+  // plan the packing from the real lengths in the mask
+  const Tensor& mask = input_tensors.at(mask_idx);
+  std::vector<int64> lengths;
+  TF_RETURN_IF_ERROR(PackingPlan::lengths_from_mask(&lengths, mask));
+  PackingPlan plan;
+  TF_RETURN_IF_ERROR(plan.initialize(lengths, mask_shape.dim(1).size()));
+  VLOG(1) << "packed " << lengths.size() << " rows with " << plan.num_tokens()
+          << " tokens into " << plan.num_slots() << " slots of length "
+          << plan.slot_length();
+
+  // pack straight into shared memory, with segment ids in their own input
+  SharedMemoryAllocator* shm_allocator =
+      NeuronEngineManager::GetNeuronEngineManager().get_shm_allocator();
+  std::vector<Tensor> packed_inputs(input_tensors.size());
+  for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
+    const Tensor& in_tensor = input_tensors.at(idx);
+    if (NO_PADDING_AXIS == input_padding_axis.i(idx)) {
+      packed_inputs[idx] = in_tensor;
+      continue;
+    }
+    TFNN_ASSERT(in_tensor.dims() >= 2 &&
+                    in_tensor.dim_size(0) == (int64)lengths.size(),
+                errors::InvalidArgument(
+                    "incorrect shape found on input tensor ", idx, ", ",
+                    in_tensor.shape().DebugString()));
+    TensorShape shape(in_tensor.shape());
+    shape.set_dim(0, plan.num_slots());
+    shape.set_dim(1, plan.slot_length());
+    AllocatorAttributes alloc_attr;
+    NeuronDevice::set_on_shm(&alloc_attr, shm_allocator->is_valid());
+    Tensor* packed = &packed_inputs[idx];
+    TF_RETURN_IF_ERROR(
+        ctx->allocate_temp(in_tensor.dtype(), shape, packed, alloc_attr));
+    if ((int64)idx == segment_idx) {
+      TF_RETURN_IF_ERROR(plan.fill_segment_ids(packed));
+    } else {
+      TF_RETURN_IF_ERROR(plan.pack(packed, in_tensor));
+    }
+  }
+  TF_RETURN_IF_ERROR(compute_internal(ctx, node_def, packed_inputs, record));
+
+  // unpack outputs back to the rows of the request
+  for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
+    if (NO_PADDING_AXIS == output_padding_axis.i(idx)) continue;
+    Tensor packed = *ctx->mutable_output(idx);
+    TensorShape shape(packed.shape());
+    shape.set_dim(0, lengths.size());
+    shape.set_dim(1, mask.dim_size(1));
+    Tensor unpacked;
+    TF_RETURN_IF_ERROR(ctx->allocate_temp(packed.dtype(), shape, &unpacked));
+    TF_RETURN_IF_ERROR(plan.unpack(&unpacked, packed));
+    ctx->set_output(idx, unpacked);
+  }
+  return Status::OK();
+}
+
+Status NeuronModel::initialize_stages(const NodeDef& node_def) {
+  tensorflow::mutex_lock lock(mutex_stages_);
+  if (TF_PREDICT_TRUE(stages_initialized_)) {
+    return stages_status_;
+  }
+  stages_initialized_ = true;
+  AttrList& stage_defs = node_def.attr().at(kPipelineStages).list();
+  stages_status_ = errors::InvalidArgument("invalid pipeline stages on ",
+                                           node_def.name());
+  TFNN_ASSERT(stage_defs.s_size() > 0, stages_status_);
+  for (auto stage_idx = 0; stage_idx < stage_defs.s_size(); ++stage_idx) {
+    PipelineStage stage;
+    TFNN_ASSERT(stage.node_def.ParseFromString(stage_defs.s(stage_idx)),
+                stages_status_);
+    const NodeDef& stage_def = stage.node_def;
+    TFNN_ASSERT(!stage_def.attr().count(kPipelineStages) &&
+                    stage_def.attr().count("input_batch_axis") &&
+                    stage_def.attr().count("output_batch_axis") &&
+                    get_io_tensor_sizes(nullptr, stage_def, "input").ok() &&
+                    get_io_tensor_sizes(nullptr, stage_def, "output").ok(),
+                stages_status_);
+    if (stage_idx > 0) {
+      // every stage consumes exactly what the previous one produces
+      const google::protobuf::Map<std::string, AttrValue>& prev_attr =
+          stages_.back().node_def.attr();
+      AttrList& prev_dtypes = prev_attr.at("output_dtypes").list();
+      AttrList& prev_shapes = prev_attr.at("output_shapes").list();
+      AttrList& dtypes = stage_def.attr().at("input_dtypes").list();
+      AttrList& shapes = stage_def.attr().at("input_shapes").list();
+      TFNN_ASSERT(prev_dtypes.type_size() == dtypes.type_size(),
+                  stages_status_);
+      for (auto idx = 0; idx < dtypes.type_size(); ++idx) {
+        TFNN_ASSERT(prev_dtypes.type(idx) == dtypes.type(idx) &&
+                        TensorShape(prev_shapes.shape(idx)) ==
+                            TensorShape(shapes.shape(idx)),
+                    stages_status_);
+      }
+    }
+    stage.model.reset(new NeuronModel);
+    stage.model->metrics_.initialize(stage_def.name());
+    stages_.push_back(std::move(stage));
+  }
+  VLOG(1) << node_def.name() << " is a pipeline of " << stages_.size()
+          << " stages";
+  stages_status_ = Status::OK();
+  return stages_status_;
+}
+
+Status NeuronModel::infer_stage(const NodeDef& node_def,
+                                const std::vector<Tensor>& input_tensors,
+                                std::vector<Tensor>* output_tensors) {
+  TF_RETURN_IF_ERROR(check_input_tensors(input_tensors, node_def));
+  SharedMemoryAllocator* shm_allocator =
+      NeuronEngineManager::GetNeuronEngineManager().get_shm_allocator();
+  const google::protobuf::Map<std::string, AttrValue>& attr = node_def.attr();
+  AttrList& output_dtypes = attr.at("output_dtypes").list();
+  AttrList& output_shapes = attr.at("output_shapes").list();
+  bool use_shm = shm_allocator->is_valid();
+  for (const Tensor& tensor : input_tensors) {
+    use_shm &= tensor.NumElements() != 0;
+  }
+  for (auto idx = 0; idx < output_shapes.shape_size(); ++idx) {
+    use_shm &= TensorShape(output_shapes.shape(idx)).num_elements() != 0;
+  }
+
+  // tensors handed over from the previous stage are on shm already
+  std::vector<Tensor> input_shm_tensors;
+  if (TF_PREDICT_TRUE(use_shm)) {
+    input_shm_tensors.resize(input_tensors.size());
+    for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
+      const Tensor& tensor = input_tensors.at(idx);
+      if (shm_allocator->is_shm_tensor(tensor)) {
+        input_shm_tensors[idx] = tensor;
+      } else {
+        input_shm_tensors[idx] =
+            Tensor(shm_allocator, tensor.dtype(), tensor.shape());
+        TF_RETURN_IF_ERROR(tensor_copy(&input_shm_tensors[idx], tensor));
+      }
+    }
+  }
+  Allocator* output_allocator = use_shm ? shm_allocator : cpu_allocator();
+  output_tensors->clear();
+  for (auto idx = 0; idx < output_shapes.shape_size(); ++idx) {
+    output_tensors->emplace_back(output_allocator, output_dtypes.type(idx),
+                                 TensorShape(output_shapes.shape(idx)));
+  }
+  std::vector<Tensor*> output_ptrs;
+  for (Tensor& tensor : *output_tensors) {
+    output_ptrs.push_back(&tensor);
+  }
+  RuntimeIO runtime_io;
+  TF_RETURN_IF_ERROR(setup_runtime_io(&runtime_io, node_def, input_shm_tensors,
+                                      output_ptrs, model_desc_->nn_id,
+                                      shm_allocator, use_shm));
+  TF_RETURN_IF_ERROR(runtime_io.copy_input_tensors(input_tensors));
+  TF_RETURN_IF_ERROR(
+      neuron_engine_->infer(&runtime_io, model_desc_.get(), &metrics_));
+  if (TF_PREDICT_FALSE(!use_shm)) {
+    TF_RETURN_IF_ERROR(runtime_io.finish(&output_ptrs, {}, nullptr));
+  }
+  return Status::OK();
+}
+
+Status NeuronModel::compute_pipelined(OpKernelContext* ctx,
+                                      const NodeDef& node_def,
+                                      const std::vector<Tensor>& input_tensors,
+                                      RequestRecord* record) {
+  TF_RETURN_IF_ERROR(initialize_stages(node_def));
+  for (PipelineStage& stage : stages_) {
+    RIE_IGNORE_ABORTED(
+        stage.model->initialize(stage.node_def, ctx->session_handle()));
+    TFNN_ASSERT(nullptr != stage.model->model_desc_,
+                errors::Unavailable("pipeline stage ", stage.node_def.name(),
+                                    " is not loaded"));
+  }
+  bool sequential = false;
+  {
+    tensorflow::mutex_lock lock(mutex_stages_);
+    if (!stages_checked_) {
+      stages_checked_ = true;
+      // an engine index beyond the available NeuronCore groups is silently
+      // given a shared group by the engine manager
+      for (size_t idx = 1; idx < stages_.size() && !stages_sequential_;
+           ++idx) {
+        for (size_t prev = 0; prev < idx; ++prev) {
+          if (stages_[prev].model->neuron_engine_ ==
+              stages_[idx].model->neuron_engine_) {
+            LOG(WARNING) << node_def.name() << ": pipeline stages " << prev
+                         << " and " << idx << " share a NeuronCore group, "
+                         << "so the " << stages_.size() << " stages run "
+                         << "sequentially; set NEURONCORE_GROUP_SIZES to at "
+                         << "least " << stages_.size() << " groups to "
+                         << "pipeline them";
+            stages_sequential_ = true;
+            break;
+          }
+        }
+      }
+    }
+    sequential = stages_sequential_;
+  }
+  const google::protobuf::Map<std::string, AttrValue>& first_attr =
+      stages_.front().node_def.attr();
+  const google::protobuf::Map<std::string, AttrValue>& last_attr =
+      stages_.back().node_def.attr();
+  AttrList& input_shapes = first_attr.at("input_shapes").list();
+  AttrList& input_batch_axis = first_attr.at("input_batch_axis").list();
+  AttrList& output_shapes = last_attr.at("output_shapes").list();
+  AttrList& output_batch_axis = last_attr.at("output_batch_axis").list();
+  TFNN_ASSERT(
+      (int)input_tensors.size() == input_shapes.shape_size() &&
+          ctx->num_outputs() == output_shapes.shape_size(),
+      errors::InvalidArgument("incorrect number of tensors for pipeline ",
+                              node_def.name()));
+
+  // the compiled batch size of the stages is the micro-batch size
+  int64 batch_size = UNINIT_BATCH_SIZE;
+  int64 micro_batch_size = UNINIT_BATCH_SIZE;
+  std::vector<bool> is_batch_inputs(input_tensors.size());
+  for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
+    const Tensor& in_tensor = input_tensors.at(idx);
+    is_batch_inputs[idx] = (int)idx < input_batch_axis.i_size() &&
+                           0 == input_batch_axis.i(idx);
+    if (!is_batch_inputs[idx]) continue;
+    TFNN_ASSERT(in_tensor.dims() > 0 &&
+                    (UNINIT_BATCH_SIZE == batch_size ||
+                     batch_size == in_tensor.dim_size(0)),
+                errors::InvalidArgument(
+                    "incorrect batch size found on input tensor ", idx,
+                    " with shape ", in_tensor.shape().DebugString()));
+    batch_size = in_tensor.dim_size(0);
+    micro_batch_size = TensorShape(input_shapes.shape(idx)).dim_size(0);
+  }
+  if (UNINIT_BATCH_SIZE == batch_size) {
+    batch_size = micro_batch_size = 1;
+  }
+  TFNN_ASSERT(batch_size > 0 && micro_batch_size > 0,
+              errors::InvalidArgument("invalid batch size ", batch_size,
+                                      " for pipeline ", node_def.name()));
+  int64 num_micro_batches = (batch_size - 1) / micro_batch_size + 1;
+  record->batch_size = batch_size;
+  record->num_shards = num_micro_batches;
+  std::vector<bool> is_batch_outputs(ctx->num_outputs());
+  std::vector<Tensor*> output_tensors(ctx->num_outputs());
+  for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
+    TensorShape shape(output_shapes.shape(idx));
+    is_batch_outputs[idx] = idx < output_batch_axis.i_size() &&
+                            0 == output_batch_axis.i(idx) &&
+                            shape.dims() > 0;
+    if (is_batch_outputs[idx]) {
+      shape.set_dim(0, batch_size);
+    }
+    TF_RETURN_IF_ERROR(ctx->allocate_output(idx, shape, &output_tensors[idx]));
+  }
+  record->prepared_us = elapsed_us(*record);
+
+  // a micro-batch runs through every stage in one task; with several tasks
+  // in flight each engine works on a different micro-batch, so throughput
+  // approaches that of the slowest stage
+  // keep the runtime sessions of all stages alive for shared memory buffers
+  std::vector<std::shared_ptr<RuntimeSession> > sessions_alive;
+  for (PipelineStage& stage : stages_) {
+    sessions_alive.push_back(stage.model->neuron_engine_->get_session());
+  }
+  tensorflow::mutex mutex_status;
+  Status status_mb;
+  auto RunMicroBatches = [&](int64 start, int64 limit) {
+    for (int64 micro_batch = start; micro_batch < limit; ++micro_batch) {
+      int64 row_start = micro_batch * micro_batch_size;
+      int64 row_limit = std::min(row_start + micro_batch_size, batch_size);
+      Status status;
+      std::vector<Tensor> stage_tensors(input_tensors.size());
+      for (size_t idx = 0; idx < input_tensors.size() && status.ok(); ++idx) {
+        const Tensor& in_tensor = input_tensors.at(idx);
+        if (!is_batch_inputs[idx]) {
+          stage_tensors[idx] = in_tensor;
+        } else if (row_limit - row_start == micro_batch_size) {
+          stage_tensors[idx] = in_tensor.Slice(row_start, row_limit);
+        } else {
+          TensorShape shape(in_tensor.shape());
+          shape.set_dim(0, micro_batch_size);
+          stage_tensors[idx] = Tensor(in_tensor.dtype(), shape);
+          status = tensor_pad_axis(&stage_tensors[idx],
+                                   in_tensor.Slice(row_start, row_limit), 0);
+        }
+      }
+      for (PipelineStage& stage : stages_) {
+        if (!status.ok()) break;
+        std::vector<Tensor> stage_outputs;
+        status = stage.model->infer_stage(stage.node_def, stage_tensors,
+                                          &stage_outputs);
+        stage_tensors = std::move(stage_outputs);
+      }
+      for (size_t idx = 0; idx < output_tensors.size() && status.ok(); ++idx) {
+        if (is_batch_outputs[idx]) {
+          Tensor dst = output_tensors[idx]->Slice(row_start, row_limit);
+          status = tensor_copy(&dst, stage_tensors.at(idx));
+        } else if (0 == micro_batch) {
+          status = tensor_copy(output_tensors[idx], stage_tensors.at(idx));
+        }
+      }
+      if (TF_PREDICT_FALSE(!status.ok())) {
+        tensorflow::mutex_lock lock(mutex_status);
+        status_mb.Update(status);
+        return;
+      }
+    }
+  };
+  if (TF_PREDICT_FALSE(sequential)) {
+    RunMicroBatches(0, num_micro_batches);
+    record->inferred_us = elapsed_us(*record);
+    RIE_IGNORE_ABORTED(status_mb);
+    return Status::OK();
+  }
+  thread::ThreadPool* thread_pool =
+      ctx->device()->tensorflow_cpu_worker_threads()->workers;
+#if TF_VERSION_LESS_THAN(2, 0)
+  thread_pool->TransformRangeConcurrently(1, num_micro_batches,
+                                          std::move(RunMicroBatches));
+#else
+  auto strategy = thread::ThreadPool::SchedulingStrategy::kFixedBlockSize;
+  auto params = thread::ThreadPool::SchedulingParams(strategy, absl::nullopt,
+                                                     1);
+  thread_pool->ParallelFor(num_micro_batches, params,
+                           std::move(RunMicroBatches));
+#endif
+  record->inferred_us = elapsed_us(*record);
+  RIE_IGNORE_ABORTED(status_mb);
+  return Status::OK();
+}
+
+Status NeuronModel::compute_internal(OpKernelContext* ctx,
+                                     const NodeDef& node_def,
+                                     const std::vector<Tensor>& input_tensors,
+                                     RequestRecord* record,
+                                     OutputStream* stream,
+                                     uint64 stream_request) {
+  uint64 start_time = record->start_us;
 #define VLOG_TIME(msg) VLOG_TIME_BASE(start_time, 1, msg);
+  bool trace_sampled = Tracer::GetTracer().sample_request();
+  ScopedTraceRequest trace_request(trace_sampled);
+  TraceSpan compute_span("neuron_op");
   SharedMemoryAllocator* shm_allocator =
       NeuronEngineManager::GetNeuronEngineManager().get_shm_allocator();
   thread::ThreadPool* thread_pool =
@@ -338,7 +994,7 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
     }
   }
   bool use_dynamic_batch_size = false;
-  int64 input_copy_cost_per_unit = 0;
+  int64 input_bytes_per_row = 0;
   if (found_batch_axis) {
     AttrList& input_shapes = attr.at("input_shapes").list();
     for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
@@ -346,16 +1002,20 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
       const Tensor& in_tensor = input_tensors.at(idx);
       TensorShape shape(in_tensor.shape());
       TensorShape k_shape(input_shapes.shape(idx));
-      input_copy_cost_per_unit += k_shape.num_elements();
-      if (TF_PREDICT_TRUE(0 == input_batch_axis.i(idx))) {
+      input_bytes_per_row +=
+          k_shape.num_elements() * DataTypeSize(in_tensor.dtype());
+      int64 batch_axis = input_batch_axis.i(idx);
+      if (TF_PREDICT_TRUE(batch_axis != STATIC_BATCH_AXIS)) {
         TFNN_ASSERT(
-            shape.dims() > 0,
-            errors::InvalidArgument("no batch-dimension found on input tensor ",
+            0 <= batch_axis && batch_axis < shape.dims() &&
+                batch_axis < k_shape.dims(),
+            errors::InvalidArgument("no batch-dimension ", batch_axis,
+                                    " found on input tensor ",
                                     input_names.s(idx), " with shape ",
                                     shape.DebugString()));
         if (TF_PREDICT_TRUE(UNINIT_BATCH_SIZE == batch_size)) {
-          batch_size = shape.dim_size(0);
-          k_batch_size = k_shape.dim_size(0);
+          batch_size = shape.dim_size(batch_axis);
+          k_batch_size = k_shape.dim_size(batch_axis);
           TFNN_ASSERT(
               batch_size > 0,
               errors::Internal(
@@ -363,14 +1023,14 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
                   input_names.s(idx), " with shape ", shape.DebugString()));
         } else {
           TFNN_ASSERT(
-              batch_size == shape.dim_size(0),
+              batch_size == shape.dim_size(batch_axis),
               errors::InvalidArgument(
                   "incorrect batch size found on input tensor ",
                   input_names.s(idx), ", tensor shape ", shape.DebugString(),
                   ", internal batch size ", batch_size));
         }
-        shape.RemoveDim(0);
-        k_shape.RemoveDim(0);
+        shape.RemoveDim(batch_axis);
+        k_shape.RemoveDim(batch_axis);
         is_batch_tensor = batch_size != k_batch_size;
         use_dynamic_batch_size |= is_batch_tensor;
       }
@@ -382,22 +1042,26 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
               ", expected shape ", input_shapes.shape(idx).DebugString()));
       is_batch_inputs[idx] = is_batch_tensor;
     }
+    if (k_batch_size > 0) {
+      input_bytes_per_row /= k_batch_size;
+    }
     for (auto idx = 0; idx < output_names.s_size(); ++idx) {
       bool is_batch_tensor = false;
-      if (TF_PREDICT_TRUE(0 == output_batch_axis.i(idx))) {
+      int64 batch_axis = output_batch_axis.i(idx);
+      if (TF_PREDICT_TRUE(batch_axis != STATIC_BATCH_AXIS)) {
         TensorShape k_shape(output_shapes.shape(idx));
-        TFNN_ASSERT(k_shape.dims() > 0,
+        TFNN_ASSERT(0 <= batch_axis && batch_axis < k_shape.dims(),
                     errors::InvalidArgument(
-                        "no batch-dimension found on output tensor ",
-                        output_names.s(idx), " with Neuron shape ",
-                        k_shape.DebugString()));
+                        "no batch-dimension ", batch_axis,
+                        " found on output tensor ", output_names.s(idx),
+                        " with Neuron shape ", k_shape.DebugString()));
         TFNN_ASSERT(
-            k_batch_size == k_shape.dim_size(0),
+            k_batch_size == k_shape.dim_size(batch_axis),
             errors::InvalidArgument(
                 "incorrect batch size found on output tensor ",
                 output_names.s(idx), ", Neuron tensor shape ",
                 k_shape.DebugString(), ", Neuron batch size ", k_batch_size));
-        is_batch_tensor = batch_size != k_shape.dim_size(0);
+        is_batch_tensor = batch_size != k_shape.dim_size(batch_axis);
         use_dynamic_batch_size |= is_batch_tensor;
       }
       is_batch_outputs[idx] = is_batch_tensor;
@@ -405,24 +1069,65 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
   }
   TFNN_ASSERT(ctx->num_outputs() == output_names.s_size(),
               errors::InvalidArgument("incorrect number of output tensors"));
+  for (const Tensor& tensor : input_tensors) {
+    record->input_bytes += tensor.TotalBytes();
+  }
+  record->batch_size = batch_size > 0 ? batch_size : 0;
+
+  // serve repeated requests from the result cache without touching the device
+  uint64 cache_key = 0;
+  bool use_result_cache = result_cache_.enabled() &&
+                          ResultCache::compute_key(&cache_key, input_tensors);
+  if (use_result_cache) {
+    std::vector<Tensor> cached_outputs;
+    bool hit = result_cache_.lookup(cache_key, input_tensors, &cached_outputs);
+    metrics_.count_result_cache_lookup(hit);
+    if (hit) {
+      for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
+        ctx->set_output(idx, cached_outputs.at(idx));
+      }
+      record->cache_hit = true;
+      if (TF_PREDICT_FALSE(nullptr != stream)) {
+        push_stream_chunk(stream, stream_request, 0, record->batch_size,
+                          cached_outputs);
+      }
+      VLOG_TIME("exiting compute from result cache");
+      return Status::OK();
+    }
+  }
 
   // allocate output tensors
+  TraceSpan output_alloc_span("output_alloc");
   std::vector<Tensor*> output_tensors(ctx->num_outputs());
   int64_t pad_batch_size = 0;
   if (use_dynamic_batch_size) {
     pad_batch_size = ((batch_size - 1) / k_batch_size + 1) * k_batch_size;
     VLOG(1) << "batch_size=" << batch_size << ", k_batch_size=" << k_batch_size
             << ", pad_batch_size=" << pad_batch_size;
+    metrics_.count_rows(batch_size, pad_batch_size - batch_size);
     for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
       Tensor* batch_out_tensor = nullptr;
       TensorShape shape(output_shapes.shape(idx));
       if (TF_PREDICT_TRUE(is_batch_outputs[idx])) {
-        shape.set_dim(0, batch_size);
+        shape.set_dim(output_batch_axis.i(idx), batch_size);
       }
-      TF_RETURN_IF_ERROR(ctx->allocate_output(idx, shape, &batch_out_tensor));
+      // on shared memory so that a downstream NeuronOp can take it as is;
+      // every batch size needs a buffer of its own, so only while shared
+      // memory is within NEURON_SHM_MAX_MB
+      int64 num_bytes =
+          shape.num_elements() * DataTypeSize(ctx->expected_output_dtype(idx));
+      bool on_shm =
+          shm_allocator->is_valid() && shm_allocator->has_room_for(num_bytes);
+      AllocatorAttributes attr;
+      NeuronDevice::set_on_shm(&attr, on_shm);
+      TF_RETURN_IF_ERROR(
+          ctx->allocate_output(idx, shape, &batch_out_tensor, attr));
       output_tensors[idx] = batch_out_tensor;
     }
   } else {
+    if (batch_size > 0) {
+      metrics_.count_rows(batch_size, 0);
+    }
     for (auto idx = 0; idx < ctx->num_outputs(); ++idx) {
       AllocatorAttributes attr;
       NeuronDevice::set_on_shm(&attr, shm_allocator->is_valid());
@@ -430,9 +1135,15 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
                                               &output_tensors[idx], attr));
     }
   }
+  output_alloc_span.end();
 
   // initialize the model
   RIE_IGNORE_ABORTED(initialize(node_def, ctx->session_handle()));
+  TFNN_ASSERT(nullptr != model_desc_,
+              errors::Unavailable("model ", node_def.name(), " is not loaded"));
+  record->nn_id = model_desc_->nn_id;
+  record->use_shm = shm_allocator->is_valid();
+  record->prepared_us = elapsed_us(*record);
 
   // keep a shared pointer so that RuntimeSession outlives shared memory buffers
   std::shared_ptr<RuntimeSession> session_alive = neuron_engine_->get_session();
@@ -440,8 +1151,11 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
   // run inference
   if (use_dynamic_batch_size) {
     int64 end_start = k_batch_size - (pad_batch_size - batch_size);
-    bool run_profiler_in_shard = false;
+    // a sampled request profiles its first shard only
+    bool profile_first_shard = profile_.sample_request();
+    bool profiled_first_shard = false;
     Status status_sd;
+    std::atomic<bool> shard_aborted(false);
 #define SHARD_LOG_ERROR(status_sd, ...)                            \
   {                                                                \
     Status _status = (__VA_ARGS__);                                \
@@ -463,9 +1177,15 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
       status_sd = _status;                                            \
       return;                                                         \
     }                                                                 \
+    if (TF_PREDICT_FALSE(!_status.ok())) {                            \
+      shard_aborted = true;                                           \
+    }                                                                 \
   }
 #define SHARD_VLOG_TIME(msg) VLOG_TIME_BASE(start_time, 2, msg);
-    auto ShardFunc = [&](int64 dim0_start, int64 dim0_limit) {
+    auto RunShard = [&](int64 dim0_start, int64 dim0_limit) {
+      uint64 shard_start_time = Env::Default()->NowMicros();
+      ScopedTraceRequest shard_trace_request(trace_sampled);
+      TraceSpan shard_span("shard", dim0_start);
       SHARD_VLOG_TIME("entering shard");
       if (TF_PREDICT_FALSE(dim0_limit - dim0_start != k_batch_size)) {
         status_sd =
@@ -473,14 +1193,47 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
         return;
       }
       VLOG(2) << "Sharding " << dim0_start << " to " << dim0_limit;
+      int64 end_limit = dim0_limit < batch_size ? dim0_limit : batch_size;
+      bool use_shm = shm_allocator->is_valid();
+      for (const Tensor& tensor : input_tensors) {
+        use_shm &= tensor.NumElements() != 0;
+      }
+      for (size_t buf_size : output_tensor_sizes) {
+        use_shm &= buf_size != 0;
+      }
+      // inputs gathered or padded for this shard are staged directly on
+      // shared memory, unless they still have to be shuffled
+      AllocatorAttributes staging_attr;
+      NeuronDevice::set_on_shm(&staging_attr,
+                               use_shm && !attr.count(kInputShuffles));
       std::vector<Tensor> sliced_inputs(input_tensors.size());
       for (size_t idx = 0; idx < input_tensors.size(); ++idx) {
         const Tensor& in_tensor = input_tensors.at(idx);
-        if (TF_PREDICT_TRUE(is_batch_inputs[idx])) {
+        int batch_axis = input_batch_axis.i(idx);
+        if (TF_PREDICT_TRUE(is_batch_inputs[idx] && 0 != batch_axis)) {
+          // gather the shard with a strided copy along the batch axis
+          TensorShape shard_shape(in_tensor.shape());
+          shard_shape.set_dim(batch_axis, k_batch_size);
+          Tensor shard_tensor;
+          SHARD_LOG_ERROR(status_sd,
+                          ctx->allocate_temp(in_tensor.dtype(), shard_shape,
+                                             &shard_tensor, staging_attr));
+          if (TF_PREDICT_FALSE(dim0_limit > batch_size)) {
+            SHARD_LOG_ERROR(status_sd, tensor_memset(&shard_tensor, 0));
+          }
+          SHARD_LOG_ERROR(status_sd, tensor_copy_axis(
+                                         &shard_tensor, 0, in_tensor,
+                                         dim0_start, end_limit - dim0_start,
+                                         batch_axis));
+          sliced_inputs[idx] = shard_tensor;
+        } else if (TF_PREDICT_TRUE(is_batch_inputs[idx])) {
           if (TF_PREDICT_FALSE(dim0_limit > batch_size)) {
             TensorShape ps_shape(in_tensor.shape());
             ps_shape.set_dim(0, k_batch_size);
-            Tensor pad_end_slice(in_tensor.dtype(), ps_shape);
+            Tensor pad_end_slice;
+            SHARD_LOG_ERROR(status_sd,
+                            ctx->allocate_temp(in_tensor.dtype(), ps_shape,
+                                               &pad_end_slice, staging_attr));
             Tensor zero_slice = pad_end_slice.Slice(end_start, k_batch_size);
             SHARD_LOG_ERROR(status_sd, tensor_memset(&zero_slice, 0));
             Tensor end_slice = in_tensor.Slice(dim0_start, batch_size);
@@ -493,12 +1246,19 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
           sliced_inputs[idx] = in_tensor;
         }
       }
+      TraceSpan validate_span("validate_inputs");
       SHARD_LOG_ERROR(status_sd, check_input_tensors(sliced_inputs, node_def));
-      int64 end_limit = dim0_limit < batch_size ? dim0_limit : batch_size;
+      validate_span.end();
       std::vector<Tensor> sliced_outputs(output_tensors.size());
       for (size_t idx = 0; idx < sliced_outputs.size(); ++idx) {
         Tensor* out_tensor = output_tensors.at(idx);
-        if (TF_PREDICT_TRUE(is_batch_outputs[idx])) {
+        int batch_axis = output_batch_axis.i(idx);
+        if (TF_PREDICT_TRUE(is_batch_outputs[idx] && 0 != batch_axis)) {
+          // received whole and scattered along the batch axis after finish
+          TensorShape shard_shape(out_tensor->shape());
+          shard_shape.set_dim(batch_axis, k_batch_size);
+          sliced_outputs[idx] = Tensor(out_tensor->dtype(), shard_shape);
+        } else if (TF_PREDICT_TRUE(is_batch_outputs[idx])) {
           sliced_outputs[idx] = out_tensor->Slice(dim0_start, end_limit);
         } else {
           sliced_outputs[idx] = *out_tensor;
@@ -511,17 +1271,24 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
       RuntimeIO runtime_io;
       std::vector<Tensor> input_shm_tensors;
       std::vector<Tensor> output_shm_tensors;
-      bool use_shm = shm_allocator->is_valid();
-      for (const Tensor& tensor : sliced_inputs) {
-        use_shm &= tensor.NumElements() != 0;
-      }
-      for (size_t buf_size : output_tensor_sizes) {
-        use_shm &= buf_size != 0;
+      // staged inputs and whole inputs produced on shared memory, typically
+      // by an upstream NeuronOp, are passed to the runtime without a copy
+      std::vector<bool> need_copy_inputs(sliced_inputs.size(), true);
+      if (TF_PREDICT_TRUE(use_shm && !attr.count(kInputShuffles))) {
+        for (size_t idx = 0; idx < need_copy_inputs.size(); ++idx) {
+          const Tensor& tensor = sliced_inputs.at(idx);
+          need_copy_inputs[idx] = !shm_allocator->is_shm_tensor(tensor);
+        }
       }
+      TraceSpan shm_alloc_span("shm_alloc");
       if (TF_PREDICT_TRUE(use_shm)) {
         input_shm_tensors.resize(sliced_inputs.size());
         for (size_t idx = 0; idx < sliced_inputs.size(); ++idx) {
           const Tensor& tensor = sliced_inputs.at(idx);
+          if (!need_copy_inputs[idx]) {
+            input_shm_tensors[idx] = tensor;
+            continue;
+          }
           TensorShape shape = tensor.shape();
           DataType dtype = tensor.dtype();
           AllocatorAttributes attr;
@@ -536,7 +1303,7 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
           TensorShape shape(tensor.shape());
           if (TF_PREDICT_TRUE(is_batch_outputs[idx])) {
             if (TF_PREDICT_FALSE(dim0_limit > batch_size)) {
-              shape.set_dim(0, k_batch_size);
+              shape.set_dim(output_batch_axis.i(idx), k_batch_size);
             }
           }
           DataType dtype(tensor.dtype());
@@ -553,84 +1320,166 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
       }
       SHARD_LOG_IGNORE_ABORTED(
           status_sd, setup_runtime_io(&runtime_io, node_def, input_shm_tensors,
-                                      output_shm_ptrs, nn_id_, shm_allocator,
-                                      use_shm));
+                                      output_shm_ptrs, model_desc_->nn_id,
+                                      shm_allocator, use_shm));
+      shm_alloc_span.end();
 
       // copy input tensors with optional input_shuffles
       SHARD_VLOG_TIME("in shard before input copy");
-      std::vector<bool> need_copy_inputs(sliced_inputs.size(), true);
-      if (k_batch_size > 1 && runtime_io.use_shm()) {
+      TraceSpan input_copy_span("input_copy");
+      uint64 copy_start_time = Env::Default()->NowMicros();
+      if (k_batch_size > 1 && runtime_io.use_shm() &&
+          !attr.count(kInputShuffles)) {
+        // inputs batched along axis 0 are copied by rows in parallel, and
+        // every other input is copied once as a whole
+        std::vector<bool> copy_by_rows(sliced_inputs.size());
+        std::vector<bool> copy_whole(sliced_inputs.size());
+        for (size_t i = 0; i < sliced_inputs.size(); ++i) {
+          copy_by_rows[i] = need_copy_inputs[i] && is_batch_inputs[i] &&
+                            0 == input_batch_axis.i(i);
+          copy_whole[i] = need_copy_inputs[i] && !copy_by_rows[i];
+        }
         auto CopyInputShardFunc = [&](int64 dim0_start, int64 dim0_limit) {
           std::vector<Tensor> input_slices(sliced_inputs.size());
+          std::vector<Tensor> input_shm_slices(sliced_inputs.size());
           for (size_t i = 0; i < input_slices.size(); ++i) {
-            if (TF_PREDICT_TRUE(is_batch_inputs[i])) {
+            if (copy_by_rows[i]) {
               input_slices[i] = sliced_inputs[i].Slice(dim0_start, dim0_limit);
-            } else {
-              input_slices[i] = input_tensors[i];
-            }
-          }
-          std::vector<Tensor> input_shm_slices(sliced_inputs.size());
-          for (size_t i = 0; i < input_shm_slices.size(); ++i) {
-            Tensor& shm_tensor = input_shm_tensors.at(i);
-            if (TF_PREDICT_TRUE(is_batch_inputs[i])) {
-              input_shm_slices[i] = shm_tensor.Slice(dim0_start, dim0_limit);
-            } else {
-              input_shm_slices[i] = shm_tensor;
+              input_shm_slices[i] =
+                  input_shm_tensors.at(i).Slice(dim0_start, dim0_limit);
             }
           }
           SHARD_LOG_IGNORE_ABORTED(
               status_sd, copy_input_tensors_with_shuffle(
                              ctx, node_def, nullptr, input_slices,
-                             need_copy_inputs,&runtime_io, &input_shm_slices));
+                             copy_by_rows, &runtime_io, &input_shm_slices));
         };
-        h2d_transfer_pool_.ParallelFor(k_batch_size, input_copy_cost_per_unit,
+        int64 copy_cost_per_row =
+            shard_cost_.input_copy_cost_per_row(input_bytes_per_row);
+        h2d_transfer_pool_.ParallelFor(k_batch_size, copy_cost_per_row,
                                        std::move(CopyInputShardFunc));
+        SHARD_LOG_IGNORE_ABORTED(
+            status_sd, copy_input_tensors_with_shuffle(
+                           ctx, node_def, &h2d_transfer_pool_, sliced_inputs,
+                           copy_whole, &runtime_io, &input_shm_tensors));
       } else {
         SHARD_LOG_IGNORE_ABORTED(
             status_sd, copy_input_tensors_with_shuffle(
                            ctx, node_def, &h2d_transfer_pool_, sliced_inputs,
                            need_copy_inputs, &runtime_io, &input_shm_tensors));
       }
+      input_copy_span.end();
+      uint64 copy_time = Env::Default()->NowMicros() - copy_start_time;
+      metrics_.record_input_copy(copy_time);
+      shard_cost_.record_input_copy(k_batch_size, copy_time);
 
       // run inference
       SHARD_VLOG_TIME("in shard before infer");
-      if (TF_PREDICT_FALSE(run_profiler_in_shard)) {
+      uint64 infer_start_time = Env::Default()->NowMicros();
+      if (TF_PREDICT_FALSE(profile_first_shard && 0 == dim0_start)) {
         VLOG(1) << "enabling profiler in shard";
+        profiled_first_shard = true;
         SHARD_LOG_IGNORE_ABORTED(
             status_sd,
-            neuron_engine_->infer_with_profiling(&runtime_io, &profile_));
+            neuron_engine_->infer_with_profiling(
+                &runtime_io, model_desc_.get(), &metrics_, &profile_));
       } else {
-        SHARD_LOG_IGNORE_ABORTED(status_sd, neuron_engine_->infer(&runtime_io));
+        SHARD_LOG_IGNORE_ABORTED(
+            status_sd,
+            neuron_engine_->infer(&runtime_io, model_desc_.get(), &metrics_));
       }
       SHARD_VLOG_TIME("in shard after infer");
+      // engine lock and semaphore waits depend on other requests in flight,
+      // not on this shard, so they stay out of its measured cost
+      uint64 infer_wait_time = Env::Default()->NowMicros() - infer_start_time -
+                               runtime_io.get_device_us();
+      TraceSpan output_copy_span("output_copy");
+      copy_start_time = Env::Default()->NowMicros();
       SHARD_LOG_IGNORE_ABORTED(
           status_sd, runtime_io.finish(&output_ptrs, output_shm_tensors,
                                        &h2d_transfer_pool_));
+      for (size_t idx = 0; idx < sliced_outputs.size(); ++idx) {
+        int batch_axis = output_batch_axis.i(idx);
+        if (TF_PREDICT_TRUE(is_batch_outputs[idx] && 0 != batch_axis)) {
+          SHARD_LOG_ERROR(status_sd, tensor_copy_axis(
+                                         output_tensors.at(idx), dim0_start,
+                                         sliced_outputs.at(idx), 0,
+                                         end_limit - dim0_start, batch_axis));
+        }
+      }
+      if (TF_PREDICT_FALSE(nullptr != stream && !shard_aborted)) {
+        std::vector<Tensor> chunk_outputs(output_tensors.size());
+        for (size_t idx = 0; idx < chunk_outputs.size(); ++idx) {
+          Tensor* out_tensor = output_tensors.at(idx);
+          int batch_axis = output_batch_axis.i(idx);
+          if (!is_batch_outputs[idx]) {
+            chunk_outputs[idx] = *out_tensor;
+          } else if (0 == batch_axis) {
+            chunk_outputs[idx] = out_tensor->Slice(dim0_start, end_limit);
+          } else if (end_limit == dim0_limit) {
+            chunk_outputs[idx] = sliced_outputs.at(idx);
+          } else {
+            TensorShape shape(sliced_outputs.at(idx).shape());
+            shape.set_dim(batch_axis, end_limit - dim0_start);
+            Tensor trimmed(out_tensor->dtype(), shape);
+            SHARD_LOG_ERROR(status_sd, tensor_copy_axis(
+                                           &trimmed, 0, sliced_outputs.at(idx),
+                                           0, end_limit - dim0_start,
+                                           batch_axis));
+            chunk_outputs[idx] = trimmed;
+          }
+        }
+        push_stream_chunk(stream, stream_request, dim0_start, end_limit,
+                          std::move(chunk_outputs));
+      }
+      uint64 shard_end_time = Env::Default()->NowMicros();
+      metrics_.record_output_copy(shard_end_time - copy_start_time);
+      shard_cost_.record_shard(
+          k_batch_size, shard_end_time - shard_start_time - infer_wait_time);
       SHARD_VLOG_TIME("in shard exit");
     };
+    // a block of several consecutive shards runs sequentially in one task
+    auto ShardFunc = [&](int64 dim0_start, int64 dim0_limit) {
+      for (int64 start = dim0_start; start < dim0_limit;
+           start += k_batch_size) {
+        RunShard(start, std::min(start + k_batch_size, dim0_limit));
+      }
+    };
 #undef SHARD_LOG_IGNORE_ABORTED
 #undef SHARD_LOG_ERROR
 #undef SHARD_VLOG_TIME
-    if (TF_PREDICT_FALSE(profile_.enabled_)) {
-      run_profiler_in_shard = true;
-      ShardFunc(0, k_batch_size);
-      run_profiler_in_shard = false;
-      RIE_IGNORE_ABORTED(status_sd);
-    }
+    // no more shards in flight than the replicas can take, and no blocks too
+    // cheap to be worth a thread pool task
+    int64 num_shards = pad_batch_size / k_batch_size;
+    int64 shards_per_block = shard_cost_.shards_per_block(
+        num_shards, k_batch_size, model_desc_->capacity, input_bytes_per_row);
+    int64 block_size = shards_per_block * k_batch_size;
+    VLOG(1) << "running " << num_shards << " shards in blocks of "
+            << shards_per_block;
     VLOG_TIME("before sharding");
 #if TF_VERSION_LESS_THAN(2, 0)
-    thread_pool->TransformRangeConcurrently(k_batch_size, pad_batch_size,
+    thread_pool->TransformRangeConcurrently(block_size, pad_batch_size,
                                             std::move(ShardFunc));
 #else
+    // block size is already chosen from measured shard costs above; blocks
+    // must stay aligned to whole shards, which kAdaptive would not respect
     auto strategy = thread::ThreadPool::SchedulingStrategy::kFixedBlockSize;
-    int64 cost_per_unit = estimated_cost_;
-    auto params = thread::ThreadPool::SchedulingParams(strategy, cost_per_unit,
-                                                       k_batch_size);
+    auto params = thread::ThreadPool::SchedulingParams(strategy, absl::nullopt,
+                                                       block_size);
     thread_pool->ParallelFor(pad_batch_size, params, std::move(ShardFunc));
 #endif
+    if (TF_PREDICT_FALSE(profile_first_shard && !profiled_first_shard)) {
+      // first shard failed early; give the profiling slot back
+      profile_.stop_session();
+    }
+    record->num_shards = num_shards;
+    record->inferred_us = elapsed_us(*record);
     RIE_IGNORE_ABORTED(status_sd);
+    use_result_cache &= status_sd.ok() && !shard_aborted;
   } else {
+    TraceSpan validate_span("validate_inputs");
     TF_RETURN_IF_ERROR(check_input_tensors(input_tensors, node_def));
+    validate_span.end();
     std::vector<bool> need_copy_inputs(input_tensors.size(), true);
     bool need_input_shuffles = attr.count(kInputShuffles);
     if (TF_PREDICT_TRUE(shm_allocator->is_valid() && !need_input_shuffles)) {
@@ -650,6 +1499,7 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
     for (size_t buf_size : output_tensor_sizes) {
       use_shm &= buf_size != 0;
     }
+    TraceSpan shm_alloc_span("shm_alloc");
     if (TF_PREDICT_TRUE(use_shm)) {
       input_shm_tensors.resize(input_tensors.size());
       for (size_t idx = 0; idx < input_shm_tensors.size(); ++idx) {
@@ -668,27 +1518,58 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
     }
     RIE_IGNORE_ABORTED(setup_runtime_io(&runtime_io, node_def,
                                         input_shm_tensors, output_tensors,
-                                        nn_id_, shm_allocator, use_shm));
+                                        model_desc_->nn_id, shm_allocator,
+                                        use_shm));
+    shm_alloc_span.end();
 
     // copy input tensors with optional input_shuffles
+    TraceSpan input_copy_span("input_copy");
+    uint64 copy_start_time = Env::Default()->NowMicros();
     RIE_IGNORE_ABORTED(copy_input_tensors_with_shuffle(
         ctx, node_def, thread_pool, input_tensors, need_copy_inputs, &runtime_io,
         &input_shm_tensors));
+    input_copy_span.end();
+    metrics_.record_input_copy(Env::Default()->NowMicros() - copy_start_time);
+    record->num_shards = 1;
+    record->use_shm = runtime_io.use_shm();
+    record->input_copied_us = elapsed_us(*record);
 
     // run inference
     VLOG_TIME("before infer");
-    if (TF_PREDICT_FALSE(profile_.enabled_)) {
-      VLOG(1) << "profile enabled -- lock stop/start/infer altogether";
-      RIE_IGNORE_ABORTED(
-          neuron_engine_->infer_with_profiling(&runtime_io, &profile_));
+    Status infer_status;
+    if (TF_PREDICT_FALSE(profile_.sample_request())) {
+      VLOG(1) << "profiling this request";
+      infer_status = neuron_engine_->infer_with_profiling(
+          &runtime_io, model_desc_.get(), &metrics_, &profile_);
     } else {
-      RIE_IGNORE_ABORTED(neuron_engine_->infer(&runtime_io));
+      infer_status =
+          neuron_engine_->infer(&runtime_io, model_desc_.get(), &metrics_);
     }
+    record->replica_nn_id = runtime_io.get_nn_id();
+    record->inferred_us = elapsed_us(*record);
+    RIE_IGNORE_ABORTED(infer_status);
     VLOG_TIME("after infer");
     if (TF_PREDICT_FALSE(!shm_allocator->is_valid())) {
-      RIE_IGNORE_ABORTED(
-          runtime_io.finish(&output_tensors, output_shm_tensors, thread_pool));
+      TraceSpan output_copy_span("output_copy");
+      copy_start_time = Env::Default()->NowMicros();
+      Status finish_status =
+          runtime_io.finish(&output_tensors, output_shm_tensors, thread_pool);
+      metrics_.record_output_copy(Env::Default()->NowMicros() -
+                                  copy_start_time);
+      RIE_IGNORE_ABORTED(finish_status);
+      infer_status.Update(finish_status);
     }
+    use_result_cache &= infer_status.ok();
+    if (TF_PREDICT_FALSE(nullptr != stream && infer_status.ok())) {
+      push_stream_chunk(stream, stream_request, 0, record->batch_size,
+                        get_outputs(ctx));
+    }
+  }
+  if (use_result_cache) {
+    result_cache_.insert(cache_key, input_tensors, output_tensors);
+  }
+  for (const Tensor* tensor : output_tensors) {
+    record->output_bytes += tensor->TotalBytes();
   }
   VLOG_TIME("exiting compute");
 #undef VLOG_TIME
@@ -698,11 +1579,11 @@ Status NeuronModel::compute(OpKernelContext* ctx, const NodeDef& node_def,
 NeuronModel::~NeuronModel() {
   VLOG(1) << "calling NeuronModel destructor";
   tensorflow::mutex_lock lock(mutex_model_);
-  if (nullptr == neuron_engine_) {
+  if (nullptr == neuron_engine_ || nullptr == model_desc_) {
     VLOG(1) << "neuron_engine_ not available; not tearing down";
     return;
   }
-  neuron_engine_->unload(nn_id_);
+  neuron_engine_->unload(model_desc_.get());
   VLOG(1) << "unload from NeuronModel::~NeuronModel";
   NeuronEngineManager::GetNeuronEngineManager().clear_if_empty();
   VLOG(1) << "NeuronModel destructor done";
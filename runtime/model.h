@@ -17,6 +17,11 @@ limitations under the License.
 #define TENSORFLOW_NEURON_RUNTIME_MODEL_H_
 
 #include "engine.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "output_stream.h"
+#include "result_cache.h"
+#include "shard_cost.h"
 #include "tensorflow/core/framework/op_kernel.h"
 
 namespace tensorflow {
@@ -31,11 +36,57 @@ class NeuronModel {
 
  private:
   Status initialize(const NodeDef& node_def, const std::string& session_handle);
+  Status compute_internal(OpKernelContext* ctx, const NodeDef& node_def,
+                          const std::vector<Tensor>& input_tensors,
+                          RequestRecord* record,
+                          OutputStream* stream = nullptr,
+                          uint64 stream_request = 0);
+  Status compute_padded(OpKernelContext* ctx, const NodeDef& node_def,
+                        const std::vector<Tensor>& input_tensors,
+                        RequestRecord* record);
+  Status initialize_buckets(const NodeDef& node_def);
+  Status compute_packed(OpKernelContext* ctx, const NodeDef& node_def,
+                        const std::vector<Tensor>& input_tensors,
+                        RequestRecord* record);
+  Status compute_pipelined(OpKernelContext* ctx, const NodeDef& node_def,
+                           const std::vector<Tensor>& input_tensors,
+                           RequestRecord* record);
+  Status initialize_stages(const NodeDef& node_def);
+  // Runs one inference at exactly the compiled shapes without an
+  // OpKernelContext; outputs are allocated on shared memory when possible
+  Status infer_stage(const NodeDef& node_def,
+                     const std::vector<Tensor>& input_tensors,
+                     std::vector<Tensor>* output_tensors);
+  // A stage of a pipelined NeuronOp, loaded on its own engine
+  struct PipelineStage {
+    NodeDef node_def;
+    std::unique_ptr<NeuronModel> model;
+  };
+  // A sequence-length bucket; the last one is this model itself, with a null
+  // `model` and the NodeDef passed to compute.
+  struct LengthBucket {
+    int64 length = 0;
+    NodeDef node_def;
+    std::unique_ptr<NeuronModel> model;
+  };
   tensorflow::mutex mutex_model_;
   NeuronEngine* neuron_engine_ = nullptr;
-  uint32_t nn_id_ = NRT_INVALID_NN_ID;
-  int64 estimated_cost_ = 0;
+  ModelDescriptorPtr model_desc_ = nullptr;
   ProfilerInterface profile_;
+  ResultCache result_cache_;
+  ModelMetrics metrics_;
+  ShardCostModel shard_cost_;
+  tensorflow::mutex mutex_buckets_;
+  bool buckets_initialized_ = false;
+  Status buckets_status_;
+  std::vector<LengthBucket> buckets_;  // in ascending length
+  tensorflow::mutex mutex_stages_;
+  bool stages_initialized_ = false;
+  Status stages_status_;
+  std::vector<PipelineStage> stages_;
+  // stages that share a NeuronCore group cannot overlap
+  bool stages_checked_ = false;
+  bool stages_sequential_ = false;
   thread::ThreadPool h2d_transfer_pool_;
 };
 
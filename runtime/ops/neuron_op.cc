@@ -14,6 +14,7 @@ limitations under the License.
 ==============================================================================*/
 
 #include "tensorflow/core/framework/op.h"
+#include "tensorflow/core/framework/common_shape_fns.h"
 #include "tensorflow/core/framework/shape_inference.h"
 
 namespace tensorflow {
@@ -36,6 +37,11 @@ static Status NeuronOpShape(shape_inference::InferenceContext* ctx) {
   }
   std::vector<int> output_batch_axis;
   TF_RETURN_IF_ERROR(ctx->GetAttr("output_batch_axis", &output_batch_axis));
+  // outputs trimmed to the sequence length of the request
+  std::vector<int> output_padding_axis;
+  if (!ctx->GetAttr("_output_padding_axis", &output_padding_axis).ok()) {
+    output_padding_axis.clear();
+  }
   for (int idx = 0; idx < ctx->num_outputs(); ++idx) {
     TensorShapeProto shape_proto;
     output_shapes[idx].AsProto(&shape_proto);
@@ -55,6 +61,13 @@ static Status NeuronOpShape(shape_inference::InferenceContext* ctx) {
         }
       }
     }
+    if (idx < output_padding_axis.size()) {
+      int axis = output_padding_axis[idx];
+      if (0 <= axis && axis < shape_proto.dim_size()) {
+        shape_proto.mutable_dim(axis)->set_size(
+            shape_inference::InferenceContext::kUnknownDim);
+      }
+    }
     PartialTensorShape shape(shape_proto);
     shape_inference::ShapeHandle handle;
     TF_RETURN_IF_ERROR(ctx->MakeShapeFromPartialTensorShape(shape, &handle));
@@ -80,6 +93,32 @@ REGISTER_OP("NeuronOp")
     .Output("output_tensors: output_dtypes")
     .SetShapeFn(NeuronOpShape);
 
+// Reads the next chunk that a NeuronOp with _output_stream = stream_name
+// pushed, along with the id of the NeuronOp request it belongs to; fails with
+// OutOfRange at the end of each NeuronOp request.
+REGISTER_OP("NeuronOutputStream")
+    .SetIsStateful()
+    .Attr("stream_name: string")
+    .Attr("output_dtypes: list(type) >= 0")
+    .Output("row_start: int64")
+    .Output("request_id: int64")
+    .Output("output_tensors: output_dtypes")
+    .SetShapeFn(shape_inference::UnknownShape);
+
+// Writes the spans currently held by the tracer to `path`, or to
+// NEURON_TRACE_FILE if `path` is empty.
+REGISTER_OP("NeuronDumpTrace")
+    .SetIsStateful()
+    .Attr("path: string = ''")
+    .SetShapeFn(shape_inference::NoOutputs);
+
+// Writes the flight recorder's window of recent requests to
+// NEURON_FLIGHT_RECORDER_DIR, or to the log.
+REGISTER_OP("NeuronDumpFlightRecorder")
+    .SetIsStateful()
+    .Attr("reason: string = 'requested'")
+    .SetShapeFn(shape_inference::NoOutputs);
+
 }  // namespace tensorflow
 
 // model_config format:
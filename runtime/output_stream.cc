@@ -0,0 +1,127 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#include "output_stream.h"
+#include <algorithm>
+#include <unordered_map>
+#include "env.h"
+#include "tensorflow/core/lib/core/errors.h"
+
+namespace tensorflow {
+namespace neuron {
+
+static const size_t DEFAULT_CAPACITY = 64;
+
+std::shared_ptr<OutputStream> OutputStream::GetOutputStream(
+    const std::string& name) {
+  static tensorflow::mutex mutex;
+  static auto* streams =
+      new std::unordered_map<std::string, std::shared_ptr<OutputStream> >;
+  tensorflow::mutex_lock lock(mutex);
+  std::shared_ptr<OutputStream>& stream = (*streams)[name];
+  if (nullptr == stream) {
+    size_t capacity = DEFAULT_CAPACITY;
+    std::string capacity_str = env_get("NEURON_OUTPUT_STREAM_CAPACITY");
+    if (!capacity_str.empty()) {
+      int parsed = stoi_no_throw(capacity_str);
+      if (parsed > 0) {
+        capacity = parsed;
+      }
+    }
+    stream = std::make_shared<OutputStream>(name, capacity);
+  }
+  return stream;
+}
+
+void OutputStream::push(StreamChunk chunk) {
+  Reader reader;
+  {
+    tensorflow::mutex_lock lock(mutex_);
+    if (TF_PREDICT_FALSE(chunk.request_id <= dropped_request_)) {
+      return;
+    }
+    if (readers_.empty()) {
+      if (TF_PREDICT_FALSE(chunks_.size() >= capacity_)) {
+        LOG(WARNING) << "output stream " << name_ << " is full; dropping the "
+                     << "chunks of requests up to " << request_count_;
+        chunks_.clear();
+        dropped_request_ = request_count_;
+        overflow_status_ = errors::ResourceExhausted(
+            "output stream ", name_, " overflowed; requests up to ",
+            dropped_request_, " were dropped");
+        return;
+      }
+      chunks_.push_back(std::move(chunk));
+      return;
+    }
+    reader = std::move(readers_.front().second);
+    readers_.pop_front();
+  }
+  reader(chunk);
+}
+
+void OutputStream::end_request(uint64 request_id, const Status& status) {
+  StreamChunk chunk;
+  chunk.request_id = request_id;
+  chunk.end = true;
+  chunk.status = status;
+  push(std::move(chunk));
+}
+
+void OutputStream::read(uint64 reader_id, Reader reader) {
+  StreamChunk chunk;
+  {
+    tensorflow::mutex_lock lock(mutex_);
+    if (TF_PREDICT_FALSE(!overflow_status_.ok())) {
+      chunk.request_id = dropped_request_;
+      chunk.end = true;
+      chunk.status = overflow_status_;
+      overflow_status_ = Status::OK();
+    } else if (chunks_.empty()) {
+      readers_.emplace_back(reader_id, std::move(reader));
+      return;
+    } else {
+      chunk = std::move(chunks_.front());
+      chunks_.pop_front();
+    }
+  }
+  reader(chunk);
+}
+
+void OutputStream::cancel(uint64 reader_id) {
+  Reader reader;
+  {
+    tensorflow::mutex_lock lock(mutex_);
+    auto found = std::find_if(
+        readers_.begin(), readers_.end(),
+        [reader_id](const std::pair<uint64, Reader>& waiting) {
+          return waiting.first == reader_id;
+        });
+    if (found == readers_.end()) {
+      return;
+    }
+    reader = std::move(found->second);
+    readers_.erase(found);
+  }
+  StreamChunk chunk;
+  chunk.end = true;
+  chunk.status = errors::Cancelled("read from output stream ", name_,
+                                   " was cancelled");
+  reader(chunk);
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,91 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_OUTPUT_STREAM_H_
+#define TENSORFLOW_NEURON_RUNTIME_OUTPUT_STREAM_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "macros.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Rows [row_start, row_limit) of every output of one NeuronOp request, or
+// the end of that request when `end` is set
+struct StreamChunk {
+  uint64 request_id = 0;
+  int64 row_start = 0;
+  int64 row_limit = 0;
+  std::vector<Tensor> outputs;
+  bool end = false;
+  Status status;
+};
+
+// Named, process-wide stream of output shards. A NeuronOp with the
+// _output_stream attribute pushes each shard of a dynamic batch here as soon
+// as it completes, so that a NeuronOutputStream reader can start on it while
+// later shards are still on the device. The NeuronOp itself still returns
+// the complete outputs.
+//
+// At most NEURON_OUTPUT_STREAM_CAPACITY (default 64) chunks are buffered.
+// Inference is never stalled by a slow reader: when a chunk does not fit, the
+// buffered chunks are discarded, the next read fails with ResourceExhausted,
+// and all chunks of the requests begun so far are dropped, so that a reader
+// never sees a request with missing chunks.
+class OutputStream {
+ public:
+  typedef std::function<void(const StreamChunk&)> Reader;
+  static std::shared_ptr<OutputStream> GetOutputStream(const std::string& name);
+  OutputStream(const std::string& name, size_t capacity)
+      : name_(name), capacity_(capacity) {}
+  uint64 begin_request() { return ++request_count_; }
+  void push(StreamChunk chunk);
+  void end_request(uint64 request_id, const Status& status);
+  uint64 new_reader_id() { return ++reader_count_; }
+  // Calls `reader` with the next chunk, immediately if one is buffered and
+  // otherwise from the thread that pushes it
+  void read(uint64 reader_id, Reader reader);
+  // Calls a still-waiting reader with an end chunk carrying a Cancelled
+  // status; does nothing if it already got its chunk
+  void cancel(uint64 reader_id);
+
+ private:
+  const std::string name_;
+  const size_t capacity_;
+  std::atomic<uint64> request_count_{0};
+  std::atomic<uint64> reader_count_{0};
+  tensorflow::mutex mutex_;
+  std::deque<StreamChunk> chunks_;
+  std::deque<std::pair<uint64, Reader> > readers_;
+  // set on overflow and reported by the next read
+  Status overflow_status_;
+  // chunks of requests up to this one are dropped after an overflow
+  uint64 dropped_request_ = 0;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(OutputStream);
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_OUTPUT_STREAM_H_
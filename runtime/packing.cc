@@ -0,0 +1,209 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#include "packing.h"
+#include <algorithm>
+#include "tensor_util.h"
+
+namespace tensorflow {
+namespace neuron {
+
+Status PackingPlan::initialize(const std::vector<int64>& lengths,
+                               int64 slot_length) {
+  if (TF_PREDICT_FALSE(slot_length <= 0)) {
+    return errors::InvalidArgument("invalid packing slot length ",
+                                   slot_length);
+  }
+  slot_length_ = slot_length;
+  num_tokens_ = 0;
+  placements_.assign(lengths.size(), Placement());
+  segment_ids_.assign(lengths.size(), 0);
+  std::vector<size_t> order(lengths.size());
+  for (size_t row = 0; row < order.size(); ++row) {
+    order[row] = row;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+    return lengths[lhs] > lengths[rhs];
+  });
+  std::vector<int64> slot_used;
+  std::vector<int64> slot_rows;
+  for (size_t row : order) {
+    int64 length = lengths[row];
+    if (TF_PREDICT_FALSE(length < 0 || length > slot_length)) {
+      return errors::InvalidArgument("row ", row, " of length ", length,
+                                     " does not fit in a slot of length ",
+                                     slot_length);
+    }
+    if (0 == length) {
+      continue;
+    }
+    size_t slot = 0;
+    while (slot < slot_used.size() && slot_used[slot] + length > slot_length) {
+      ++slot;
+    }
+    if (slot == slot_used.size()) {
+      slot_used.push_back(0);
+      slot_rows.push_back(0);
+    }
+    Placement& placement = placements_[row];
+    placement.slot = slot;
+    placement.offset = slot_used[slot];
+    placement.length = length;
+    slot_used[slot] += length;
+    segment_ids_[row] = ++slot_rows[slot];
+    num_tokens_ += length;
+  }
+  // an all-empty batch still runs one slot of padding
+  num_slots_ = std::max<int64>(slot_used.size(), 1);
+  return Status::OK();
+}
+
+Status PackingPlan::lengths_from_mask(std::vector<int64>* lengths,
+                                      const Tensor& mask) {
+  if (TF_PREDICT_FALSE(mask.dims() != 2)) {
+    return errors::InvalidArgument("packing mask must be [batch, length], got ",
+                                   mask.shape().DebugString());
+  }
+  std::vector<int64> values;
+  TF_RETURN_IF_ERROR(tensor_to_int64s(&values, mask));
+  int64 length = mask.dim_size(1);
+  lengths->assign(mask.dim_size(0), 0);
+  for (int64 row = 0; row < mask.dim_size(0); ++row) {
+    const int64* row_values = values.data() + row * length;
+    for (int64 pos = length; pos > 0; --pos) {
+      if (0 != row_values[pos - 1]) {
+        lengths->at(row) = pos;
+        break;
+      }
+    }
+  }
+  return Status::OK();
+}
+
+// Size in bytes of one token of a [batch, length, ...] tensor
+static Status get_token_bytes(int64* token_bytes, const Tensor& packed,
+                              const Tensor& unpacked) {
+  if (TF_PREDICT_FALSE(!DataTypeCanUseMemcpy(packed.dtype()) ||
+                       packed.dtype() != unpacked.dtype() ||
+                       packed.dims() < 2 ||
+                       packed.dims() != unpacked.dims())) {
+    return errors::InvalidArgument("cannot pack ",
+                                   unpacked.shape().DebugString(), " into ",
+                                   packed.shape().DebugString());
+  }
+  *token_bytes = DataTypeSize(packed.dtype());
+  for (int dim = 2; dim < packed.dims(); ++dim) {
+    if (TF_PREDICT_FALSE(packed.dim_size(dim) != unpacked.dim_size(dim))) {
+      return errors::InvalidArgument("cannot pack ",
+                                     unpacked.shape().DebugString(), " into ",
+                                     packed.shape().DebugString());
+    }
+    *token_bytes *= packed.dim_size(dim);
+  }
+  return Status::OK();
+}
+
+Status PackingPlan::pack(Tensor* dst, const Tensor& src) const {
+  int64 token_bytes = 0;
+  TF_RETURN_IF_ERROR(get_token_bytes(&token_bytes, *dst, src));
+  if (TF_PREDICT_FALSE(src.dim_size(0) != (int64)placements_.size() ||
+                       dst->dim_size(0) < num_slots_ ||
+                       dst->dim_size(1) != slot_length_)) {
+    return errors::InvalidArgument("cannot pack ", src.shape().DebugString(),
+                                   " into ", dst->shape().DebugString());
+  }
+  int64 src_row_bytes = src.dim_size(1) * token_bytes;
+  const char* char_src = src.tensor_data().data();
+  char* char_dst = const_cast<char*>(dst->tensor_data().data());
+  TF_RETURN_IF_ERROR(tensor_memset(dst, 0));
+  for (size_t row = 0; row < placements_.size(); ++row) {
+    const Placement& placement = placements_[row];
+    if (TF_PREDICT_FALSE(placement.length > src.dim_size(1))) {
+      return errors::InvalidArgument("row ", row, " of length ",
+                                     placement.length, " exceeds tensor shape ",
+                                     src.shape().DebugString());
+    }
+    int64 dst_token = placement.slot * slot_length_ + placement.offset;
+    fast_memcpy(char_dst + dst_token * token_bytes,
+                char_src + row * src_row_bytes, placement.length * token_bytes,
+                nullptr);
+  }
+  return Status::OK();
+}
+
+Status PackingPlan::unpack(Tensor* dst, const Tensor& src) const {
+  int64 token_bytes = 0;
+  TF_RETURN_IF_ERROR(get_token_bytes(&token_bytes, src, *dst));
+  if (TF_PREDICT_FALSE(dst->dim_size(0) != (int64)placements_.size() ||
+                       src.dim_size(0) < num_slots_ ||
+                       src.dim_size(1) != slot_length_)) {
+    return errors::InvalidArgument("cannot unpack ", src.shape().DebugString(),
+                                   " into ", dst->shape().DebugString());
+  }
+  int64 dst_row_bytes = dst->dim_size(1) * token_bytes;
+  const char* char_src = src.tensor_data().data();
+  char* char_dst = const_cast<char*>(dst->tensor_data().data());
+  for (size_t row = 0; row < placements_.size(); ++row) {
+    const Placement& placement = placements_[row];
+    int64 length = std::min(placement.length, dst->dim_size(1));
+    int64 src_token = placement.slot * slot_length_ + placement.offset;
+    char* row_dst = char_dst + row * dst_row_bytes;
+    fast_memcpy(row_dst, char_src + src_token * token_bytes,
+                length * token_bytes, nullptr);
+    std::fill_n(row_dst + length * token_bytes,
+                dst_row_bytes - length * token_bytes, 0);
+  }
+  return Status::OK();
+}
+
+template <typename T>
+static void fill_segment_ids_impl(Tensor* ids, int64 slot_length,
+                                  const std::vector<PackingPlan::Placement>& p,
+                                  const std::vector<int64>& segment_ids) {
+  T* ids_ptr =
+      reinterpret_cast<T*>(const_cast<char*>(ids->tensor_data().data()));
+  std::fill_n(ids_ptr, ids->NumElements(), static_cast<T>(0));
+  for (size_t row = 0; row < p.size(); ++row) {
+    T* row_ptr = ids_ptr + p[row].slot * slot_length + p[row].offset;
+    std::fill_n(row_ptr, p[row].length, static_cast<T>(segment_ids[row]));
+  }
+}
+
+Status PackingPlan::fill_segment_ids(Tensor* ids) const {
+  if (TF_PREDICT_FALSE(ids->dims() != 2 || ids->dim_size(0) < num_slots_ ||
+                       ids->dim_size(1) != slot_length_)) {
+    return errors::InvalidArgument("invalid packing segment ids shape ",
+                                   ids->shape().DebugString());
+  }
+  switch (ids->dtype()) {
+    case DT_INT32:
+      fill_segment_ids_impl<int32>(ids, slot_length_, placements_,
+                                   segment_ids_);
+      break;
+    case DT_INT64:
+      fill_segment_ids_impl<int64>(ids, slot_length_, placements_,
+                                   segment_ids_);
+      break;
+    default:
+      return errors::InvalidArgument(
+          "expected int32 or int64 packing segment ids, got ",
+          DataTypeString(ids->dtype()));
+  }
+  return Status::OK();
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
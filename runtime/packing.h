@@ -0,0 +1,70 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_PACKING_H_
+#define TENSORFLOW_NEURON_RUNTIME_PACKING_H_
+
+#include <vector>
+#include "macros.h"
+#include "tensorflow/core/framework/tensor.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Plans how the rows of a ragged batch are packed into fixed-length slots of
+// a compiled [batch, length, ...] executable, so that several short
+// sequences share one slot instead of each being padded to the full length.
+// Rows are placed first-fit decreasing; each row keeps its real tokens
+// contiguous at some offset of one slot.
+class PackingPlan {
+ public:
+  struct Placement {
+    int64 slot = 0;
+    int64 offset = 0;
+    int64 length = 0;
+  };
+  PackingPlan() {}
+  Status initialize(const std::vector<int64>& lengths, int64 slot_length);
+  int64 num_slots() const { return num_slots_; }
+  int64 slot_length() const { return slot_length_; }
+  int64 num_tokens() const { return num_tokens_; }
+  const std::vector<Placement>& placements() const { return placements_; }
+  // Real length of each row of a right-padded [batch, length] mask, i.e. the
+  // position after its last nonzero entry
+  static Status lengths_from_mask(std::vector<int64>* lengths,
+                                  const Tensor& mask);
+  // src is [batch, length, ...] and dst is [num_slots, slot_length, ...];
+  // unused tokens of dst are zero-filled
+  Status pack(Tensor* dst, const Tensor& src) const;
+  // Inverse of pack; tokens of dst beyond the length of each row are zeroed
+  Status unpack(Tensor* dst, const Tensor& src) const;
+  // Fills a [num_slots, slot_length] tensor with the 1-based index, within
+  // its slot, of the row that owns each token, and 0 for padding
+  Status fill_segment_ids(Tensor* ids) const;
+
+ private:
+  int64 num_slots_ = 0;
+  int64 slot_length_ = 0;
+  int64 num_tokens_ = 0;
+  std::vector<Placement> placements_;  // indexed by row
+  std::vector<int64> segment_ids_;     // 1-based index of a row in its slot
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(PackingPlan);
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_PACKING_H_
@@ -14,35 +14,102 @@ limitations under the License.
 ==============================================================================*/
 
 #include "profiler.h"
+#include <fcntl.h>
+#include <spawn.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include "env.h"
 #include "macros.h"
 #include "tensorflow/core/lib/core/errors.h"
 #include "tensorflow/core/platform/env.h"
 
+extern char** environ;
+
 namespace tensorflow {
 namespace neuron {
 
-template <typename... Args>
-Status subprocess_run(Args... args) {
-  pid_t fork_pid;
-  SYS_FAIL_RETURN((fork_pid = fork()) < 0, "fork");
-  if (0 == fork_pid) {
-    execlp(args..., (char*)NULL);
-    LOG(ERROR) << "execlp failed";
-    _exit(1);
-  } else {
-    int status;
-    SYS_FAIL_RETURN(waitpid(fork_pid, &status, 0) < 0, "waitpid");
-    if (!(WIFEXITED(status) && 0 == WEXITSTATUS(status))) {
-      return errors::Internal("child process did not exit gracefully");
-    }
+// posix_spawn does not duplicate the parent's page tables the way fork does,
+// which matters with many GB of shared memory mapped. If stdout_path is not
+// empty, the child's stdout is redirected into that file.
+static Status subprocess_run(const std::vector<std::string>& args,
+                             const std::string& stdout_path = "") {
+  std::vector<char*> argv;
+  for (const std::string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  posix_spawn_file_actions_t file_actions;
+  SYS_FAIL_RETURN(0 != posix_spawn_file_actions_init(&file_actions),
+                  "posix_spawn_file_actions_init");
+  if (!stdout_path.empty()) {
+    posix_spawn_file_actions_addopen(&file_actions, STDOUT_FILENO,
+                                     stdout_path.c_str(),
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  pid_t pid;
+  int ret = posix_spawnp(&pid, argv[0], &file_actions, nullptr, argv.data(),
+                         environ);
+  posix_spawn_file_actions_destroy(&file_actions);
+  if (0 != ret) {
+    return errors::Internal("posix_spawnp ", args[0], " failed with error ",
+                            std::strerror(ret));
+  }
+  int status;
+  SYS_FAIL_RETURN(waitpid(pid, &status, 0) < 0, "waitpid");
+  if (!(WIFEXITED(status) && 0 == WEXITSTATUS(status))) {
+    return errors::Internal("child process did not exit gracefully");
   }
   return Status::OK();
 }
 
+// Single background thread that runs all neuron-profile commands in order,
+// so that inference threads never spawn or wait for subprocesses themselves.
+class ProfilerService {
+ public:
+  static ProfilerService& GetProfilerService() {
+    // leaked on purpose; profiler interfaces may outlive static destruction
+    static ProfilerService* service = new ProfilerService;
+    return *service;
+  }
+  void schedule(std::function<void()> task) {
+    tensorflow::mutex_lock lock(mutex_);
+    tasks_.push_back(std::move(task));
+    cond_task_.notify_one();
+  }
+
+ private:
+  ProfilerService() {
+    thread_.reset(Env::Default()->StartThread(
+        ThreadOptions(), "neuron_profiler", [this] { run(); }));
+  }
+  void run() {
+    while (true) {
+      std::function<void()> task;
+      {
+        tensorflow::mutex_lock lock(mutex_);
+        while (tasks_.empty()) {
+          cond_task_.wait(lock);
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+  tensorflow::mutex mutex_;
+  tensorflow::condition_variable cond_task_;
+  std::deque<std::function<void()> > tasks_;
+  std::unique_ptr<Thread> thread_;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(ProfilerService);
+};
+
 static std::string mangle_op_name(const std::string& op_name) {
   std::string new_op_name(op_name);
   for (size_t idx = 0; idx < new_op_name.length(); ++idx) {
@@ -53,11 +120,56 @@ static std::string mangle_op_name(const std::string& op_name) {
   return new_op_name;
 }
 
+ProfilerInterface::~ProfilerInterface() {
+  // background session work refers to this object
+  tensorflow::mutex_lock lock(mutex_);
+  while (SESSION_IDLE != session_state_) {
+    int ready = SESSION_READY;
+    if (session_state_.compare_exchange_strong(ready, SESSION_PROFILING)) {
+      // started but never used by a request
+      stop_session();
+    }
+    cond_session_done_.wait(lock);
+  }
+}
+
 void ProfilerInterface::initialize(const std::string& profile_dir,
                                    const std::string& op_name) {
   profile_dir_ = profile_dir;
   mangled_op_name_ = mangle_op_name(op_name);
   enabled_ = !profile_dir_.empty();
+  int sample_every =
+      stoi_no_throw(env_get("NEURON_PROFILE_SAMPLE_EVERY", "1"));
+  sample_every_ = sample_every > 0 ? sample_every : 1;
+  int interval_ms = stoi_no_throw(env_get("NEURON_PROFILE_INTERVAL_MS", ""));
+  interval_us_ = interval_ms > 0 ? (uint64)interval_ms * 1000 : 0;
+}
+
+bool ProfilerInterface::sample_request() {
+  if (TF_PREDICT_TRUE(!enabled_)) {
+    return false;
+  }
+  int ready = SESSION_READY;
+  if (TF_PREDICT_FALSE(SESSION_READY == session_state_ &&
+                       session_state_.compare_exchange_strong(
+                           ready, SESSION_PROFILING))) {
+    return true;
+  }
+  if (0 != request_count_.fetch_add(1, std::memory_order_relaxed) %
+               sample_every_) {
+    return false;
+  }
+  if (interval_us_ > 0) {
+    uint64 now_us = Env::Default()->NowMicros();
+    uint64 last_us = last_sample_us_.load(std::memory_order_relaxed);
+    if (now_us - last_us < interval_us_ ||
+        !last_sample_us_.compare_exchange_strong(last_us, now_us)) {
+      return false;
+    }
+  }
+  // claim the single session slot; concurrent requests run unprofiled
+  int idle = SESSION_IDLE;
+  return session_state_.compare_exchange_strong(idle, SESSION_CLAIMED);
 }
 
 void ProfilerInterface::dump_info(const std::string& graph_def,
@@ -76,33 +188,64 @@ void ProfilerInterface::dump_info(const std::string& graph_def,
   std::ofstream(filename_neff, std::ios::binary) << executable;
 }
 
-void ProfilerInterface::start_session(const std::string& nrtd_address,
-                                      const uint32_t nn_id) {
+bool ProfilerInterface::start_session(const std::string& nrtd_address,
+                                      uint32_t* nn_id) {
   if (!enabled_) {
     VLOG(1) << "Skipping start_session as profiler is not enabled";
-    return;
+    return false;
+  }
+  if (SESSION_PROFILING == session_state_) {
+    *nn_id = session_nn_id_;
+    return true;
   }
   std::ostringstream filename_stream;
-  filename_stream << profile_dir_ << "/" << mangled_op_name_ << "-" << nn_id
+  filename_stream << profile_dir_ << "/" << mangled_op_name_ << "-" << *nn_id
                   << "-" << session_id_ << ".ntff";
   session_filename_ = filename_stream.str();
+  session_nn_id_ = *nn_id;
   std::ostringstream cmd_stream;
   cmd_stream << "neuron-profile start-session -s " << session_filename_
-             << " -a " << nrtd_address << " " << nn_id;
+             << " -a " << nrtd_address << " " << *nn_id;
   VLOG(1) << "Starting profiling session by " << cmd_stream.str();
-  std::ostringstream nn_id_stream;
-  nn_id_stream << nn_id;
+  // the session must be running before a request is posted, so this request
+  // goes unprofiled and a later one picks up the session once it is ready
+  std::vector<std::string> args = {"neuron-profile", "start-session",
+                                   "-s",             session_filename_,
+                                   "-a",             nrtd_address,
+                                   std::to_string(*nn_id)};
+  session_state_ = SESSION_STARTING;
+  ProfilerService::GetProfilerService().schedule([this, args] {
+    Status status = subprocess_run(args);
+    tensorflow::mutex_lock lock(mutex_);
+    if (status.ok()) {
+      session_id_++;
+      session_state_ = SESSION_READY;
+    } else {
+      session_filename_ = "";
+      LOG(WARNING) << "neuron-profile start-session failed. "
+                   << "Did you install aws-neuron-tools?";
+      session_state_ = SESSION_IDLE;
+    }
+    cond_session_done_.notify_all();
+  });
+  return false;
+}
+
+static void stop_and_show_session(const std::string& session_filename) {
   Status status =
-      subprocess_run("neuron-profile", "neuron-profile", "start-session", "-s",
-                     session_filename_.c_str(), "-a", nrtd_address.c_str(),
-                     nn_id_stream.str().c_str());
+      subprocess_run({"neuron-profile", "stop-session", "-s", session_filename});
+  if (!status.ok()) {
+    LOG(ERROR) << "neuron-profile stop-session failed";
+  }
+  std::string summary_filename = session_filename + ".txt";
+  status = subprocess_run(
+      {"neuron-profile", "show-session", "-s", session_filename},
+      summary_filename);
   if (!status.ok()) {
-    session_filename_ = "";
-    LOG(WARNING) << "neuron-profile start-session failed. "
-                 << "Did you install aws-neuron-tools?";
+    LOG(ERROR) << "neuron-profile show-session failed";
     return;
   }
-  session_id_++;
+  VLOG(1) << "wrote profiling summary to " << summary_filename;
 }
 
 void ProfilerInterface::stop_session() {
@@ -110,23 +253,26 @@ void ProfilerInterface::stop_session() {
     VLOG(1) << "Skipping stop_session as profiler is not enabled";
     return;
   }
-  if (!session_filename_.empty()) {
-    std::ostringstream cmd_stream;
-    cmd_stream << "neuron-profile stop-session -s " << session_filename_;
-    VLOG(1) << "Stopping profiling session by " << cmd_stream.str();
-    Status status =
-        subprocess_run("neuron-profile", "neuron-profile", "stop-session", "-s",
-                       session_filename_.c_str());
-    if (!status.ok()) {
-      LOG(ERROR) << "neuron-profile stop-session failed";
-    }
-    status = subprocess_run("neuron-profile", "neuron-profile", "show-session",
-                            "-s", session_filename_.c_str());
-    if (!status.ok()) {
-      LOG(ERROR) << "neuron-profile show-session failed";
-    }
-    session_filename_ = "";
+  int claimed = SESSION_CLAIMED;
+  if (session_state_.compare_exchange_strong(claimed, SESSION_IDLE)) {
+    // the request failed before it could start a session
+    tensorflow::mutex_lock lock(mutex_);
+    cond_session_done_.notify_all();
+    return;
   }
+  std::string session_filename = session_filename_;
+  session_filename_ = "";
+  auto finish_session = [this, session_filename] {
+    if (!session_filename.empty()) {
+      VLOG(1) << "Stopping profiling session by neuron-profile stop-session -s "
+              << session_filename;
+      stop_and_show_session(session_filename);
+    }
+    tensorflow::mutex_lock lock(mutex_);
+    session_state_ = SESSION_IDLE;
+    cond_session_done_.notify_all();
+  };
+  ProfilerService::GetProfilerService().schedule(std::move(finish_session));
 }
 
 }  // namespace neuron
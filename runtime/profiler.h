@@ -16,21 +16,56 @@ limitations under the License.
 #ifndef TENSORFLOW_NEURON_RUNTIME_PROFILER_H_
 #define TENSORFLOW_NEURON_RUNTIME_PROFILER_H_
 
+#include <atomic>
 #include "macros.h"
+#include "tensorflow/core/platform/mutex.h"
 
 namespace tensorflow {
 namespace neuron {
 
+// Captures neuron-profile sessions into the NEURON_PROFILE directory. At most
+// one session is in flight per op; sample_request() picks which requests get
+// profiled, every NEURON_PROFILE_SAMPLE_EVERY-th request (default 1) and at
+// most one per NEURON_PROFILE_INTERVAL_MS window if that is set. All
+// neuron-profile commands run on a shared profiler service thread, so no
+// request ever waits for one: a sampled request only starts a session in the
+// background, and the first request after the session is up gets profiled.
+// Stopping a session and writing its show-session summary (<session>.ntff.txt)
+// happen in the background as well.
 class ProfilerInterface {
  public:
   ProfilerInterface() {}
+  ~ProfilerInterface();
   void initialize(const std::string& profile_dir, const std::string& op_name);
   void dump_info(const std::string& graph_def, const StringPiece& executable);
-  void start_session(const std::string& nrtd_address, const uint32_t nn_id);
+  // Returns true if the calling request should go through
+  // NeuronEngine::infer_with_profiling, in which case it must call
+  // start_session, and stop_session if start_session returns true or is
+  // never reached
+  bool sample_request();
+  // Returns true, with *nn_id set to the model the running session is
+  // attached to, if the calling request is to be profiled. Otherwise starts a
+  // session on *nn_id in the background and returns false.
+  bool start_session(const std::string& nrtd_address, uint32_t* nn_id);
   void stop_session();
   bool enabled_ = false;
 
  private:
+  tensorflow::mutex mutex_;
+  tensorflow::condition_variable cond_session_done_;
+  enum SessionState {
+    SESSION_IDLE,
+    SESSION_CLAIMED,    // a sampled request is about to start a session
+    SESSION_STARTING,   // start-session is running in the background
+    SESSION_READY,      // waiting for a request to profile
+    SESSION_PROFILING,  // profiling a request, or stopping afterwards
+  };
+  std::atomic<int> session_state_{SESSION_IDLE};
+  uint32_t session_nn_id_ = 0;
+  uint64 sample_every_ = 1;
+  uint64 interval_us_ = 0;
+  std::atomic<uint64> request_count_{0};
+  std::atomic<uint64> last_sample_us_{0};
   int session_id_ = 0;
   std::string mangled_op_name_ = "";
   std::string profile_dir_ = "";
@@ -0,0 +1,185 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "result_cache.h"
+#include <cstring>
+#include "env.h"
+#include "tensorflow/core/framework/tensor_util.h"
+#include "tensorflow/core/lib/hash/hash.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace neuron {
+
+static const int64 DEFAULT_MAX_MB = 256;
+
+ResultCache::ResultCache() {
+  int max_entries = stoi_no_throw(env_get("NEURON_RESULT_CACHE_SIZE", "0"));
+  int max_mb = stoi_no_throw(env_get("NEURON_RESULT_CACHE_MAX_MB", ""));
+  int ttl_ms = stoi_no_throw(env_get("NEURON_RESULT_CACHE_TTL_MS", ""));
+  max_entries_ = max_entries > 0 ? max_entries : 0;
+  max_bytes_ = (size_t)(max_mb > 0 ? max_mb : DEFAULT_MAX_MB) * 1024 * 1024;
+  ttl_us_ = ttl_ms > 0 ? (uint64)ttl_ms * 1000 : 0;
+}
+
+ResultCache::~ResultCache() {
+  if (enabled()) {
+    LOG(INFO) << "result cache for " << op_name_ << ": "
+              << debug_string_unsafe();
+  }
+}
+
+void ResultCache::initialize(const std::string& op_name) {
+  tensorflow::mutex_lock lock(mutex_);
+  op_name_ = op_name;
+  if (enabled()) {
+    VLOG(1) << "result cache for " << op_name_ << " enabled with "
+            << max_entries_ << " entries, " << max_bytes_ << " bytes, ttl "
+            << ttl_us_ << " us";
+  }
+}
+
+bool ResultCache::compute_key(uint64* key, const std::vector<Tensor>& inputs) {
+  uint64 hash = inputs.size();
+  for (const Tensor& tensor : inputs) {
+    if (TF_PREDICT_FALSE(!DataTypeCanUseMemcpy(tensor.dtype()))) {
+      return false;
+    }
+    hash = Hash64Combine(hash, tensor.dtype());
+    for (int64 dim_size : tensor.shape().dim_sizes()) {
+      hash = Hash64Combine(hash, dim_size);
+    }
+    StringPiece data = tensor.tensor_data();
+    hash = Hash64(data.data(), data.size(), hash);
+  }
+  *key = hash;
+  return true;
+}
+
+static bool same_tensors(const std::vector<Tensor>& lhs,
+                         const std::vector<Tensor>& rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  for (size_t idx = 0; idx < lhs.size(); ++idx) {
+    const Tensor& left = lhs.at(idx);
+    const Tensor& right = rhs.at(idx);
+    if (left.dtype() != right.dtype() || left.shape() != right.shape()) {
+      return false;
+    }
+    StringPiece left_data = left.tensor_data();
+    StringPiece right_data = right.tensor_data();
+    if (left_data.size() != right_data.size() ||
+        0 != std::memcmp(left_data.data(), right_data.data(),
+                         left_data.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ResultCache::lookup(uint64 key, const std::vector<Tensor>& inputs,
+                         std::vector<Tensor>* outputs) {
+  tensorflow::mutex_lock lock(mutex_);
+  auto found = key_to_entry_.find(key);
+  if (found == key_to_entry_.end()) {
+    ++num_misses_;
+    return false;
+  }
+  EntryIter iter = found->second;
+  if (ttl_us_ > 0 &&
+      Env::Default()->NowMicros() - iter->insert_time_us > ttl_us_) {
+    erase_unsafe(iter);
+    ++num_expirations_;
+    ++num_misses_;
+    return false;
+  }
+  if (TF_PREDICT_FALSE(!same_tensors(iter->inputs, inputs))) {
+    VLOG(1) << "result cache hash collision on key " << key;
+    ++num_misses_;
+    return false;
+  }
+  lru_list_.splice(lru_list_.begin(), lru_list_, iter);
+  *outputs = iter->outputs;
+  ++num_hits_;
+  VLOG(1) << "result cache hit for " << op_name_ << ": "
+          << debug_string_unsafe();
+  return true;
+}
+
+void ResultCache::insert(uint64 key, const std::vector<Tensor>& inputs,
+                         const std::vector<Tensor*>& outputs) {
+  size_t total_bytes = 0;
+  for (const Tensor& tensor : inputs) {
+    total_bytes += tensor.TotalBytes();
+  }
+  for (const Tensor* tensor : outputs) {
+    total_bytes += tensor->TotalBytes();
+  }
+  if (total_bytes > max_bytes_) {
+    VLOG(1) << "not caching " << total_bytes << " bytes of tensors";
+    return;
+  }
+
+  // deep copy outside the lock; outputs may live in shared memory, and
+  // inputs may be reused by the caller
+  Entry entry;
+  entry.key = key;
+  entry.total_bytes = total_bytes;
+  entry.inputs.reserve(inputs.size());
+  for (const Tensor& tensor : inputs) {
+    entry.inputs.push_back(tensor::DeepCopy(tensor));
+  }
+  entry.outputs.reserve(outputs.size());
+  for (const Tensor* tensor : outputs) {
+    entry.outputs.push_back(tensor::DeepCopy(*tensor));
+  }
+  entry.insert_time_us = Env::Default()->NowMicros();
+
+  tensorflow::mutex_lock lock(mutex_);
+  auto found = key_to_entry_.find(key);
+  if (found != key_to_entry_.end()) {
+    erase_unsafe(found->second);
+  }
+  while (!lru_list_.empty() &&
+         ((int64)lru_list_.size() >= max_entries_ ||
+          total_bytes_ + total_bytes > max_bytes_)) {
+    erase_unsafe(std::prev(lru_list_.end()));
+    ++num_evictions_;
+  }
+  lru_list_.push_front(std::move(entry));
+  key_to_entry_[key] = lru_list_.begin();
+  total_bytes_ += total_bytes;
+}
+
+void ResultCache::erase_unsafe(EntryIter iter) {
+  total_bytes_ -= iter->total_bytes;
+  key_to_entry_.erase(iter->key);
+  lru_list_.erase(iter);
+}
+
+std::string ResultCache::debug_string_unsafe() {
+  uint64 num_lookups = num_hits_ + num_misses_;
+  double hit_rate = num_lookups > 0 ? (double)num_hits_ / num_lookups : 0.0;
+  return strings::StrCat("hits=", num_hits_, ", misses=", num_misses_,
+                         ", hit_rate=", hit_rate, ", entries=",
+                         lru_list_.size(), ", bytes=", total_bytes_,
+                         ", evictions=", num_evictions_,
+                         ", expirations=", num_expirations_);
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,77 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_RESULT_CACHE_H_
+#define TENSORFLOW_NEURON_RUNTIME_RESULT_CACHE_H_
+
+#include <list>
+#include <unordered_map>
+#include "macros.h"
+#include "tensorflow/core/framework/tensor.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Bounded LRU cache from input tensor contents to output tensors, so that
+// repeated identical requests can skip the device entirely. Entries are keyed
+// by a 64-bit hash of input dtypes, shapes and bytes; the inputs themselves
+// are kept too so that a hash collision is a miss rather than a wrong result.
+// Disabled unless NEURON_RESULT_CACHE_SIZE (max number of entries) is
+// positive; NEURON_RESULT_CACHE_MAX_MB bounds the total tensor bytes held and
+// NEURON_RESULT_CACHE_TTL_MS, if set, expires entries by age.
+class ResultCache {
+ public:
+  ResultCache();
+  ~ResultCache();
+  void initialize(const std::string& op_name);
+  bool enabled() const { return max_entries_ > 0; }
+  // Returns false if any input cannot be hashed (e.g. DT_STRING)
+  static bool compute_key(uint64* key, const std::vector<Tensor>& inputs);
+  bool lookup(uint64 key, const std::vector<Tensor>& inputs,
+              std::vector<Tensor>* outputs);
+  void insert(uint64 key, const std::vector<Tensor>& inputs,
+              const std::vector<Tensor*>& outputs);
+
+ private:
+  struct Entry {
+    uint64 key;
+    uint64 insert_time_us;
+    size_t total_bytes;
+    std::vector<Tensor> inputs;
+    std::vector<Tensor> outputs;
+  };
+  typedef std::list<Entry>::iterator EntryIter;
+  void erase_unsafe(EntryIter iter);
+  std::string debug_string_unsafe();
+  tensorflow::mutex mutex_;
+  std::string op_name_ = "";
+  int64 max_entries_ = 0;
+  size_t max_bytes_ = 0;
+  uint64 ttl_us_ = 0;
+  size_t total_bytes_ = 0;
+  std::list<Entry> lru_list_;  // most recently used at front
+  std::unordered_map<uint64, EntryIter> key_to_entry_;
+  uint64 num_hits_ = 0;
+  uint64 num_misses_ = 0;
+  uint64 num_evictions_ = 0;
+  uint64 num_expirations_ = 0;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(ResultCache);
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_RESULT_CACHE_H_
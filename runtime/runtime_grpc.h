@@ -88,6 +88,10 @@ class RuntimeIO {
     request_.mutable_h_nn()->set_id(nn_id);
   }
   uint32_t get_nn_id() { return request_.mutable_h_nn()->id(); }
+  // Microseconds from infer_post to the end of infer_wait, excluding engine
+  // lock and semaphore waits; set by NeuronEngine
+  uint64 get_device_us() { return device_us_; }
+  void set_device_us(uint64 device_us) { device_us_ = device_us; }
   Status finish(std::vector<Tensor*>* output_tensors,
                 const std::vector<Tensor>& output_shm_tensors,
                 thread::ThreadPool* thread_pool);
@@ -109,6 +113,7 @@ class RuntimeIO {
   grpc::Status wait_status_;
   AttrList* output_names_;
   bool use_shm_ = false;
+  uint64 device_us_ = 0;
   TFN_DISALLOW_COPY_MOVE_ASSIGN(RuntimeIO);
 };
 
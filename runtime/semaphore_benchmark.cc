@@ -0,0 +1,88 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// Contention benchmark for replica slot semaphores. Each thread repeatedly
+// acquires one unit, holds it for a short busy-wait that stands in for
+// infer_post, and releases it.
+//
+// Usage: semaphore_benchmark [capacity] [iterations_per_thread] [hold_ns]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "counting_semaphore.h"
+#include "semaphore.h"
+
+namespace tensorflow {
+namespace neuron {
+
+static void busy_wait_ns(int64 ns) {
+  auto start = std::chrono::steady_clock::now();
+  while (std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+             .count() < ns) {
+  }
+}
+
+template <typename Sem>
+static double run(Sem* sem, int num_threads, int64 iterations, int64 hold_ns) {
+  std::vector<std::thread> threads;
+  auto start = std::chrono::steady_clock::now();
+  for (int tid = 0; tid < num_threads; ++tid) {
+    threads.emplace_back([=] {
+      for (int64 iter = 0; iter < iterations; ++iter) {
+        auto reservation = sem->ScopedAcquire(1);
+        busy_wait_ns(hold_ns);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  double seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+  return num_threads * iterations / seconds;
+}
+
+static int benchmark_main(int argc, char** argv) {
+  int64 capacity = argc > 1 ? std::atoll(argv[1]) : 4;
+  int64 iterations = argc > 2 ? std::atoll(argv[2]) : 100000;
+  int64 hold_ns = argc > 3 ? std::atoll(argv[3]) : 200;
+  std::printf("capacity %lld, %lld iterations per thread, hold %lld ns\n",
+              (long long)capacity, (long long)iterations, (long long)hold_ns);
+  std::printf("%8s %16s %16s %16s\n", "threads", "xla (ops/s)",
+              "counting (ops/s)", "fair (ops/s)");
+  for (int num_threads : {1, 2, 4, 8, 16, 32, 64}) {
+    xla::Semaphore xla_sem(capacity);
+    CountingSemaphore counting_sem(capacity);
+    CountingSemaphore fair_sem(capacity, /*fair=*/true);
+    double xla_ops = run(&xla_sem, num_threads, iterations, hold_ns);
+    double counting_ops = run(&counting_sem, num_threads, iterations, hold_ns);
+    double fair_ops = run(&fair_sem, num_threads, iterations, hold_ns);
+    std::printf("%8d %16.0f %16.0f %16.0f\n", num_threads, xla_ops,
+                counting_ops, fair_ops);
+  }
+  return 0;
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+int main(int argc, char** argv) {
+  return tensorflow::neuron::benchmark_main(argc, argv);
+}
@@ -0,0 +1,78 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "shard_cost.h"
+#include <algorithm>
+
+namespace tensorflow {
+namespace neuron {
+
+// weight of a new sample is 1 / 2^AVERAGE_SHIFT
+static const int AVERAGE_SHIFT = 3;
+// initial guess: host memcpy bandwidth of ~4 bytes per ns
+static const int64 BYTES_PER_NS = 4;
+// a thread pool task below this cost is not worth its scheduling overhead
+static const int64 MIN_BLOCK_COST_NS = 50000;
+
+void ShardCostModel::update(std::atomic<int64>* average_ns, int64 rows,
+                            uint64 elapsed_us) {
+  if (TF_PREDICT_FALSE(rows <= 0)) {
+    return;
+  }
+  int64 sample = (int64)elapsed_us * 1000 / rows;
+  int64 average = average_ns->load(std::memory_order_relaxed);
+  int64 new_average = 0 == average
+                          ? sample
+                          : average + ((sample - average) >> AVERAGE_SHIFT);
+  average_ns->store(std::max(new_average, (int64)1),
+                    std::memory_order_relaxed);
+}
+
+void ShardCostModel::record_input_copy(int64 rows, uint64 elapsed_us) {
+  update(&input_copy_ns_per_row_, rows, elapsed_us);
+}
+
+void ShardCostModel::record_shard(int64 rows, uint64 elapsed_us) {
+  update(&shard_ns_per_row_, rows, elapsed_us);
+}
+
+int64 ShardCostModel::input_copy_cost_per_row(int64 bytes_per_row) {
+  int64 cost = input_copy_ns_per_row_.load(std::memory_order_relaxed);
+  return cost > 0 ? cost : std::max(bytes_per_row / BYTES_PER_NS, (int64)1);
+}
+
+int64 ShardCostModel::shard_cost_per_row(int64 bytes_per_row) {
+  int64 cost = shard_ns_per_row_.load(std::memory_order_relaxed);
+  return cost > 0 ? cost : input_copy_cost_per_row(bytes_per_row);
+}
+
+int64 ShardCostModel::shards_per_block(int64 num_shards, int64 rows_per_shard,
+                                       int64 capacity, int64 bytes_per_row) {
+  if (TF_PREDICT_FALSE(num_shards <= 1)) {
+    return 1;
+  }
+  capacity = std::max(capacity, (int64)1);
+  int64 by_capacity = (num_shards + capacity - 1) / capacity;
+  if (0 == shard_ns_per_row_.load(std::memory_order_relaxed)) {
+    // device time is unknown until a shard has run; don't serialize on a guess
+    return by_capacity;
+  }
+  int64 shard_cost = shard_cost_per_row(bytes_per_row) * rows_per_shard;
+  int64 by_cost = (MIN_BLOCK_COST_NS + shard_cost - 1) / shard_cost;
+  return std::min(std::max(by_capacity, by_cost), num_shards);
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
@@ -0,0 +1,58 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_SHARD_COST_H_
+#define TENSORFLOW_NEURON_RUNTIME_SHARD_COST_H_
+
+#include <atomic>
+#include "macros.h"
+#include "tensorflow/core/framework/types.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// Online cost model for sharding a dynamic batch across replicas. It keeps
+// moving averages of the measured per-row cost of input copies and of whole
+// shards (copy in, inference, copy out), in nanoseconds, so that thread pool
+// scheduling uses observed costs instead of static guesses. Shard samples
+// exclude time spent waiting for the engine lock or a replica. Updates are
+// lock-free and may occasionally drop a sample under contention.
+class ShardCostModel {
+ public:
+  ShardCostModel() {}
+  void record_input_copy(int64 rows, uint64 elapsed_us);
+  void record_shard(int64 rows, uint64 elapsed_us);
+  // Falls back to a bandwidth estimate from bytes_per_row before the first
+  // measurement
+  int64 input_copy_cost_per_row(int64 bytes_per_row);
+  // Number of consecutive shards each thread pool task should run, such that
+  // no more than `capacity` shards are in flight at once and each task is
+  // worth scheduling
+  int64 shards_per_block(int64 num_shards, int64 rows_per_shard,
+                         int64 capacity, int64 bytes_per_row);
+
+ private:
+  static void update(std::atomic<int64>* average_ns, int64 rows,
+                     uint64 elapsed_us);
+  int64 shard_cost_per_row(int64 bytes_per_row);
+  std::atomic<int64> input_copy_ns_per_row_{0};
+  std::atomic<int64> shard_ns_per_row_{0};
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(ShardCostModel);
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_SHARD_COST_H_
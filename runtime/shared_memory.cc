@@ -18,6 +18,7 @@ limitations under the License.
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include "env.h"
+#include "metrics.h"
 #include "tensorflow/core/platform/env.h"
 
 namespace tensorflow {
@@ -133,8 +134,13 @@ std::string SharedMemoryBuffer::debug_string() {
       .error_message();
 }
 
+static const size_t DEFAULT_MAX_MB = 1024;
+
 SharedMemoryAllocator::SharedMemoryAllocator()
-    : single_allocation_warning_count_(0) {}
+    : single_allocation_warning_count_(0) {
+  int max_mb = stoi_no_throw(env_get("NEURON_SHM_MAX_MB", ""));
+  max_mapped_bytes_ = (size_t)(max_mb > 0 ? max_mb : DEFAULT_MAX_MB) << 20;
+}
 
 Status SharedMemoryAllocator::initialize(const uint64_t session_id,
                                          const std::string& nrtd_address) {
@@ -176,8 +182,12 @@ SharedMemoryPtr SharedMemoryAllocator::allocate_shm(const size_t alignment,
       SharedMemoryPtr shm_ptr = buffer_vec_[free_buffer_id];
       if (TF_PREDICT_TRUE(shm_ptr->is_valid())) {
         free_buffer_id_set->erase(free_buffer_id);
+        free_buffer_lru_.erase(free_buffer_lru_pos_[free_buffer_id]);
+        free_buffer_lru_pos_.erase(free_buffer_id);
+        free_bytes_ -= size;
         VLOG(1) << "reusing already allocated shm buffer "
                 << shm_ptr->debug_string();
+        count_shm_allocation(/*reused=*/true);
         return shm_ptr;
       }
     }
@@ -185,12 +195,16 @@ SharedMemoryPtr SharedMemoryAllocator::allocate_shm(const size_t alignment,
     auto iter = free_buffer_id_set->begin();
     size_t free_buffer_id = *iter;
     free_buffer_id_set->erase(iter);
+    free_buffer_lru_.erase(free_buffer_lru_pos_[free_buffer_id]);
+    free_buffer_lru_pos_.erase(free_buffer_id);
+    free_bytes_ -= size;
     SharedMemoryPtr shm_ptr = buffer_vec_[free_buffer_id];
     VLOG(1) << "reusing already allocated shm buffer "
             << shm_ptr->debug_string();
     return shm_ptr;
   }
   VLOG(1) << "allocating a new shm buffer";
+  count_shm_allocation(/*reused=*/false);
   size_t id = buffer_vec_.size();
   SharedMemoryPtr shm_ptr = std::make_shared<SharedMemoryBuffer>(
       id, session_id_, alignment, size, runtime_);
@@ -201,13 +215,20 @@ SharedMemoryPtr SharedMemoryAllocator::allocate_shm(const size_t alignment,
                << " will not be available in Neuron runtime";
     return shm_ptr;
   }
+  // only buffers that are actually mapped count against NEURON_SHM_MAX_MB
+  mapped_bytes_ += shm_ptr->get_size();
+  evict_free_buffers_unsafe();
   VLOG(1) << "successfully allocated shm buffer " << shm_ptr->debug_string();
   return shm_ptr;
 }
 
 void SharedMemoryAllocator::free_shm_unsafe(SharedMemoryPtr shm) {
   if (TF_PREDICT_FALSE(!shm->is_valid())) {
+    // never counted in mapped_bytes_, so release it rather than caching it
     LOG(ERROR) << "freeing invalid shm buffer " << shm->debug_string();
+    ptr_to_id_.erase(shm->get_ptr());
+    buffer_vec_[shm->get_id()] = nullptr;
+    return;
   }
   VLOG(1) << "freeing shm buf " << shm->get_path();
   size_t size = shm->get_size();
@@ -217,6 +238,37 @@ void SharedMemoryAllocator::free_shm_unsafe(SharedMemoryPtr shm) {
                                     std::forward_as_tuple());
   }
   size_to_free_buffer_id_[size].insert(shm->get_id());
+  free_buffer_lru_pos_[shm->get_id()] =
+      free_buffer_lru_.insert(free_buffer_lru_.end(), shm->get_id());
+  free_bytes_ += size;
+  evict_free_buffers_unsafe();
+}
+
+void SharedMemoryAllocator::evict_free_buffers_unsafe() {
+  while (mapped_bytes_ > max_mapped_bytes_ && !free_buffer_lru_.empty()) {
+    size_t id = free_buffer_lru_.front();
+    free_buffer_lru_.pop_front();
+    free_buffer_lru_pos_.erase(id);
+    SharedMemoryPtr shm = buffer_vec_[id];
+    size_t size = shm->get_size();
+    size_to_free_buffer_id_[size].erase(id);
+    ptr_to_id_.erase(shm->get_ptr());
+    // ids index buffer_vec_, so the slot stays but the buffer is unmapped
+    buffer_vec_[id] = nullptr;
+    mapped_bytes_ -= size;
+    free_bytes_ -= size;
+    VLOG(1) << "evicted shm buffer " << shm->debug_string();
+  }
+}
+
+bool SharedMemoryAllocator::has_room_for(size_t num_bytes) {
+  tensorflow::mutex_lock lock(mutex_);
+  if (size_to_free_buffer_id_.count(num_bytes) &&
+      size_to_free_buffer_id_[num_bytes].size()) {
+    return true;
+  }
+  // free buffers can be evicted to make room
+  return mapped_bytes_ - free_bytes_ + num_bytes <= max_mapped_bytes_;
 }
 
 // Individual allocations large than this amount will trigger a warning.
@@ -265,8 +317,19 @@ size_t SharedMemoryAllocator::AllocatedSizeSlow(const void* ptr) const {
 }
 
 bool SharedMemoryAllocator::is_shm_tensor(const Tensor& tensor) {
-  return DataTypeCanUseMemcpy(tensor.dtype()) &&
-         ptr_to_id_.count(tensor.tensor_data().data());
+  if (!DataTypeCanUseMemcpy(tensor.dtype())) {
+    return false;
+  }
+  StringPiece data = tensor.tensor_data();
+  tensorflow::mutex_lock lock(mutex_);
+  auto iter = ptr_to_id_.find(data.data());
+  if (iter == ptr_to_id_.end()) {
+    return false;
+  }
+  // a slice that starts at the head of a buffer shares its pointer but not
+  // its size, and cannot be handed to the runtime by path
+  SharedMemoryPtr shm = buffer_vec_[iter->second];
+  return shm->is_valid() && shm->get_size() == data.size();
 }
 
 SharedMemoryPtr SharedMemoryAllocator::get_shm_ptr(const Tensor& tensor) {
@@ -16,6 +16,7 @@ limitations under the License.
 #ifndef TENSORFLOW_NEURON_RUNTIME_SHARED_MEMORY_H_
 #define TENSORFLOW_NEURON_RUNTIME_SHARED_MEMORY_H_
 
+#include <list>
 #include "macros.h"
 #include "runtime_grpc.h"
 #include "tensorflow/core/platform/mutex.h"
@@ -62,10 +63,16 @@ class SharedMemoryAllocator : public Allocator {
   size_t AllocatedSizeSlow(const void* ptr) const override;
   bool is_shm_tensor(const Tensor& tensor);
   SharedMemoryPtr get_shm_ptr(const Tensor& tensor);
+  // Whether a buffer of num_bytes can be handed out without keeping more than
+  // NEURON_SHM_MAX_MB mapped; optional users of shared memory check this and
+  // fall back to regular memory when it returns false.
+  bool has_room_for(size_t num_bytes);
 
  private:
   SharedMemoryPtr allocate_shm(const size_t alignment, const size_t size);
   void free_shm_unsafe(SharedMemoryPtr shm);
+  // Unmaps least recently freed buffers while over the mapped byte limit.
+  void evict_free_buffers_unsafe();
   tensorflow::mutex mutex_;
   uint64_t session_id_ = RuntimeSession::INVALID_ID;
   std::shared_ptr<RuntimeGRPC> runtime_ = nullptr;
@@ -74,6 +81,11 @@ class SharedMemoryAllocator : public Allocator {
   std::unordered_map<size_t, std::unordered_set<size_t> >
       size_to_free_buffer_id_;
   std::unordered_map<const void*, size_t> ptr_to_id_;
+  std::list<size_t> free_buffer_lru_;  // least recently freed first
+  std::unordered_map<size_t, std::list<size_t>::iterator> free_buffer_lru_pos_;
+  size_t mapped_bytes_ = 0;
+  size_t free_bytes_ = 0;
+  size_t max_mapped_bytes_ = 0;
   std::atomic<int> single_allocation_warning_count_;
   TFN_DISALLOW_COPY_MOVE_ASSIGN(SharedMemoryAllocator);
 };
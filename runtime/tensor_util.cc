@@ -103,6 +103,106 @@ Status tensor_copy(Tensor* dst, const Tensor& src, ThreadPool* pool) {
   return tensor_memcpy(dst, src.tensor_data(), pool);
 }
 
+// Views `dst` and `src` as [outer, dim_size(axis), inner] byte arrays, after
+// checking that they agree on everything but `axis`.
+static Status get_axis_layout(int64* outer, int64* inner_bytes,
+                              const Tensor& dst, const Tensor& src, int axis,
+                              const char* name) {
+  RETURN_ERROR_IF_CANNOT_MEMCPY(src.dtype(), name);
+  if (TF_PREDICT_FALSE(dst.dtype() != src.dtype())) {
+    return errors::InvalidArgument(name, ": data type mismatch ", dst.dtype(),
+                                   " vs ", src.dtype());
+  }
+  int num_dims = src.dims();
+  if (TF_PREDICT_FALSE(dst.dims() != num_dims || axis < 0 ||
+                       axis >= num_dims)) {
+    return errors::InvalidArgument(name, ": invalid axis ", axis,
+                                   " for shapes ", dst.shape().DebugString(),
+                                   " and ", src.shape().DebugString());
+  }
+  *outer = 1;
+  *inner_bytes = DataTypeSize(src.dtype());
+  for (int dim = 0; dim < num_dims; ++dim) {
+    if (dim == axis) continue;
+    if (TF_PREDICT_FALSE(dst.dim_size(dim) != src.dim_size(dim))) {
+      return errors::InvalidArgument(
+          name, ": shapes ", dst.shape().DebugString(), " and ",
+          src.shape().DebugString(), " differ outside of axis ", axis);
+    }
+    if (dim < axis) {
+      *outer *= src.dim_size(dim);
+    } else {
+      *inner_bytes *= src.dim_size(dim);
+    }
+  }
+  return Status::OK();
+}
+
+Status tensor_copy_axis(Tensor* dst, int64 dst_start, const Tensor& src,
+                        int64 src_start, int64 length, int axis,
+                        ThreadPool* pool) {
+  int64 outer = 0;
+  int64 inner_bytes = 0;
+  TF_RETURN_IF_ERROR(get_axis_layout(&outer, &inner_bytes, *dst, src, axis,
+                                     "tensor_copy_axis"));
+  if (TF_PREDICT_FALSE(length < 0 || src_start < 0 || dst_start < 0 ||
+                       src_start + length > src.dim_size(axis) ||
+                       dst_start + length > dst->dim_size(axis))) {
+    return errors::InvalidArgument(
+        "tensor_copy_axis: range out of bounds, src_start ", src_start,
+        ", dst_start ", dst_start, ", length ", length, ", axis ", axis);
+  }
+  int64 src_stride = src.dim_size(axis) * inner_bytes;
+  int64 dst_stride = dst->dim_size(axis) * inner_bytes;
+  int64 chunk_size = length * inner_bytes;
+  if (0 == outer || 0 == chunk_size) {
+    return Status::OK();
+  }
+  const char* char_src = src.tensor_data().data() + src_start * inner_bytes;
+  char* char_dst =
+      const_cast<char*>(dst->tensor_data().data()) + dst_start * inner_bytes;
+  if (1 == outer) {
+    fast_memcpy(char_dst, char_src, chunk_size, pool);
+  } else if (nullptr == pool) {
+    for (int64 idx = 0; idx < outer; ++idx) {
+      fast_memcpy(char_dst + idx * dst_stride, char_src + idx * src_stride,
+                  chunk_size, nullptr);
+    }
+  } else {
+    auto memcpy_shard = [&](int64 start, int64 limit) {
+      for (int64 idx = start; idx < limit; ++idx) {
+        fast_memcpy(char_dst + idx * dst_stride, char_src + idx * src_stride,
+                    chunk_size, nullptr);
+      }
+    };
+    pool->ParallelFor(outer, chunk_size, std::move(memcpy_shard));
+  }
+  return Status::OK();
+}
+
+Status tensor_pad_axis(Tensor* dst, const Tensor& src, int axis) {
+  int64 outer = 0;
+  int64 inner_bytes = 0;
+  TF_RETURN_IF_ERROR(get_axis_layout(&outer, &inner_bytes, *dst, src, axis,
+                                     "tensor_pad_axis"));
+  if (TF_PREDICT_FALSE(src.dim_size(axis) > dst->dim_size(axis))) {
+    return errors::InvalidArgument("tensor_pad_axis: cannot pad shape ",
+                                   src.shape().DebugString(), " to ",
+                                   dst->shape().DebugString());
+  }
+  int64 chunk_size = src.dim_size(axis) * inner_bytes;
+  int64 dst_stride = dst->dim_size(axis) * inner_bytes;
+  const char* char_src = src.tensor_data().data();
+  char* char_dst = const_cast<char*>(dst->tensor_data().data());
+  for (int64 idx = 0; idx < outer; ++idx) {
+    fast_memcpy(char_dst, char_src, chunk_size, nullptr);
+    std::fill_n(char_dst + chunk_size, dst_stride - chunk_size, 0);
+    char_src += chunk_size;
+    char_dst += dst_stride;
+  }
+  return Status::OK();
+}
+
 Status tensor_memcpy(Tensor* dst, const StringPiece& src, ThreadPool* pool) {
   RETURN_ERROR_IF_CANNOT_MEMCPY(dst->dtype(), "tensor_memcpy");
   int64 src_size = src.size();
@@ -148,5 +248,26 @@ Status tensor_shuffle(Tensor* dst, const Tensor& src, const TensorProto& shf) {
   return Status::OK();
 }
 
+Status tensor_to_int64s(std::vector<int64>* dst, const Tensor& src) {
+  int64 num_elements = src.NumElements();
+  dst->resize(num_elements);
+  switch (src.dtype()) {
+    case DT_INT32: {
+      auto flat = src.flat<int32>();
+      std::copy_n(flat.data(), num_elements, dst->begin());
+      break;
+    }
+    case DT_INT64: {
+      auto flat = src.flat<int64>();
+      std::copy_n(flat.data(), num_elements, dst->begin());
+      break;
+    }
+    default:
+      return errors::InvalidArgument("expected int32 or int64 tensor, got ",
+                                     DataTypeString(src.dtype()));
+  }
+  return Status::OK();
+}
+
 }  // namespace neuron
 }  // namespace tensorflow
@@ -28,7 +28,17 @@ void fast_memcpy(void* dst, const void* src, int64 count, ThreadPool* pool);
 Status tensor_memcpy(Tensor* dst, const StringPiece& src, ThreadPool* pool);
 Status tensor_memset(Tensor* dst, int ch);
 Status tensor_copy(Tensor* dst, const Tensor& src, ThreadPool* pool = nullptr);
+// Copies `length` slices along `axis` of `src`, starting at `src_start`, into
+// `dst` starting at `dst_start`. All other dimensions must match; the copy is
+// one contiguous memcpy per index of the dimensions before `axis`.
+Status tensor_copy_axis(Tensor* dst, int64 dst_start, const Tensor& src,
+                        int64 src_start, int64 length, int axis,
+                        ThreadPool* pool = nullptr);
+// Copies `src` into the leading part of `dst` along `axis` and zero-fills the
+// rest of that axis, in a single pass over `dst`.
+Status tensor_pad_axis(Tensor* dst, const Tensor& src, int axis);
 Status tensor_shuffle(Tensor* dst, const Tensor& src, const TensorProto& shf);
+Status tensor_to_int64s(std::vector<int64>* dst, const Tensor& src);
 
 }  // namespace neuron
 }  // namespace tensorflow
@@ -0,0 +1,172 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "tracer.h"
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include "env.h"
+#include "tensorflow/core/lib/core/errors.h"
+#include "tensorflow/core/lib/strings/strcat.h"
+#include "tensorflow/core/platform/env.h"
+
+namespace tensorflow {
+namespace neuron {
+
+static const int DEFAULT_BUFFER_SIZE = 4096;
+static const int64 kMinCalibrationNs = 1000000;
+
+static int64 steady_now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+Tracer& Tracer::GetTracer() {
+  static Tracer tracer;
+  return tracer;
+}
+
+bool& Tracer::thread_sampled() {
+  static thread_local bool sampled = false;
+  return sampled;
+}
+
+Tracer::Tracer() {
+  trace_file_ = env_get("NEURON_TRACE_FILE", "");
+  enabled_ = !trace_file_.empty();
+  int sample_every = stoi_no_throw(env_get("NEURON_TRACE_SAMPLE_EVERY", "1"));
+  sample_every_ = sample_every > 0 ? sample_every : 1;
+  int buffer_size = stoi_no_throw(env_get("NEURON_TRACE_BUFFER_SIZE", ""));
+  buffer_size_ = buffer_size > 0 ? buffer_size : DEFAULT_BUFFER_SIZE;
+  int flush_seconds = stoi_no_throw(env_get("NEURON_TRACE_FLUSH_SECONDS", ""));
+  flush_interval_us_ = flush_seconds > 0 ? flush_seconds * 1000000ull : 0;
+  last_flush_us_ = Env::Default()->NowMicros();
+  ref_ticks_ = now_ticks();
+  ref_steady_ns_ = steady_now_ns();
+  if (enabled_) {
+    LOG(INFO) << "tracing every " << sample_every_
+              << " NeuronOp request(s) into " << trace_file_;
+  }
+}
+
+Tracer::~Tracer() {
+  if (enabled_) {
+    TF_LOG_IF_ERROR(dump());
+  }
+}
+
+bool Tracer::sample_request() {
+  if (TF_PREDICT_TRUE(!enabled_)) {
+    return false;
+  }
+  maybe_flush();
+  return 0 == request_count_.fetch_add(1, std::memory_order_relaxed) %
+                  sample_every_;
+}
+
+// Periodic flushes are driven by incoming requests rather than by a thread of
+// their own, and the file is written in the background.
+void Tracer::maybe_flush() {
+  if (TF_PREDICT_TRUE(0 == flush_interval_us_)) {
+    return;
+  }
+  uint64 now_us = Env::Default()->NowMicros();
+  uint64 last_us = last_flush_us_.load(std::memory_order_relaxed);
+  if (now_us - last_us >= flush_interval_us_ &&
+      last_flush_us_.compare_exchange_strong(last_us, now_us)) {
+    Env::Default()->SchedClosure([this] { TF_LOG_IF_ERROR(dump()); });
+  }
+}
+
+Tracer::ThreadBuffer* Tracer::get_thread_buffer() {
+  static thread_local ThreadBuffer* thread_buffer = nullptr;
+  if (TF_PREDICT_FALSE(nullptr == thread_buffer)) {
+    std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+    buffer->tid = syscall(SYS_gettid);
+    buffer->spans.resize(buffer_size_);
+    thread_buffer = buffer.get();
+    tensorflow::mutex_lock lock(mutex_);
+    thread_buffers_.push_back(std::move(buffer));
+  }
+  return thread_buffer;
+}
+
+void Tracer::record(const char* name, uint64 start_ticks, uint64 end_ticks,
+                    uint64 arg) {
+  ThreadBuffer* buffer = get_thread_buffer();
+  uint64 head = buffer->head.load(std::memory_order_relaxed);
+  Span& span = buffer->spans[head % buffer->spans.size()];
+  span.name = name;
+  span.start_ticks = start_ticks;
+  span.end_ticks = end_ticks;
+  span.arg = arg;
+  buffer->head.store(head + 1, std::memory_order_release);
+}
+
+Status Tracer::dump(const std::string& path) {
+  if (path.empty()) {
+    return errors::InvalidArgument("no trace file specified");
+  }
+  // calibrate ticks against the steady clock over at least a millisecond, so
+  // that a dump right after start up never divides by an empty interval
+  int64 elapsed_ns = steady_now_ns() - ref_steady_ns_;
+  if (TF_PREDICT_FALSE(elapsed_ns < kMinCalibrationNs)) {
+    Env::Default()->SleepForMicroseconds(
+        (kMinCalibrationNs - std::max(elapsed_ns, (int64)0)) / 1000 + 1);
+  }
+  uint64 elapsed_ticks = now_ticks() - ref_ticks_;
+  elapsed_ns = std::max(steady_now_ns() - ref_steady_ns_, (int64)1);
+  double ticks_per_us = 1000.0 * (double)elapsed_ticks / (double)elapsed_ns;
+  if (TF_PREDICT_FALSE(ticks_per_us <= 0.0)) {
+    return errors::Internal("cannot calibrate trace timestamps");
+  }
+  int64 pid = getpid();
+  std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  tensorflow::mutex_lock lock(mutex_);
+  for (const auto& buffer : thread_buffers_) {
+    size_t capacity = buffer->spans.size();
+    uint64 head = buffer->head.load(std::memory_order_acquire);
+    uint64 begin = head > capacity ? head - capacity : 0;
+    std::vector<Span> spans;
+    spans.reserve(head - begin);
+    for (uint64 idx = begin; idx < head; ++idx) {
+      spans.push_back(buffer->spans[idx % capacity]);
+    }
+    // spans the owner thread overwrote while we were copying are torn, and so
+    // is the slot at new_head, which it may be writing before publishing it
+    uint64 new_head = buffer->head.load(std::memory_order_acquire);
+    uint64 valid_begin = new_head >= capacity ? new_head - capacity + 1 : 0;
+    for (uint64 idx = std::max(begin, valid_begin); idx < head; ++idx) {
+      const Span& span = spans[idx - begin];
+      double ts = (double)(int64)(span.start_ticks - ref_ticks_) / ticks_per_us;
+      double dur = (double)(span.end_ticks - span.start_ticks) / ticks_per_us;
+      strings::StrAppend(&json, first ? "" : ",", "{\"name\":\"", span.name,
+                         "\",\"ph\":\"X\",\"pid\":", pid,
+                         ",\"tid\":", buffer->tid, ",\"ts\":", ts,
+                         ",\"dur\":", dur, ",\"args\":{\"arg\":", span.arg,
+                         "}}");
+      first = false;
+    }
+  }
+  json += "]}";
+  TF_RETURN_IF_ERROR(WriteStringToFile(Env::Default(), path, json));
+  VLOG(1) << "wrote trace to " << path;
+  return Status::OK();
+}
+
+}  // namespace neuron
+}  // namespace tensorflow
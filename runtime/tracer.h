@@ -0,0 +1,144 @@
+/* Copyright Amazon Web Services and its Affiliates. All Rights Reserved.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_NEURON_RUNTIME_TRACER_H_
+#define TENSORFLOW_NEURON_RUNTIME_TRACER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "macros.h"
+#include "tensorflow/core/lib/core/status.h"
+#include "tensorflow/core/platform/mutex.h"
+
+namespace tensorflow {
+namespace neuron {
+
+// In-process tracer for the inference pipeline. Spans are timestamped with
+// the TSC and appended to a per-thread ring buffer without any locking, and
+// are converted to Chrome trace JSON (loadable in chrome://tracing or
+// Perfetto) only when dumped.
+//
+// Enabled by NEURON_TRACE_FILE=<path>; the trace is written there when the
+// process exits, when dump() is called (tfn.diagnostics.dump_trace() from
+// Python), and every NEURON_TRACE_FLUSH_SECONDS seconds if that is set, so
+// long-running servers need not exit to produce a trace. Each write replaces
+// the file with the spans currently held. NEURON_TRACE_SAMPLE_EVERY=N traces
+// only every Nth NeuronOp request, and NEURON_TRACE_BUFFER_SIZE sets the
+// number of spans kept per thread.
+class Tracer {
+ public:
+  static Tracer& GetTracer();
+  bool enabled() const { return enabled_; }
+  // Decides whether the next request is traced; cheap when tracing is off.
+  bool sample_request();
+  void record(const char* name, uint64 start_ticks, uint64 end_ticks,
+              uint64 arg);
+  Status dump(const std::string& path);
+  Status dump() { return dump(trace_file_); }
+  static inline uint64 now_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+  // Whether spans on the calling thread belong to a sampled request
+  static bool& thread_sampled();
+
+ private:
+  struct Span {
+    const char* name;
+    uint64 start_ticks;
+    uint64 end_ticks;
+    uint64 arg;
+  };
+  struct ThreadBuffer {
+    int64 tid;
+    std::vector<Span> spans;
+    std::atomic<uint64> head{0};  // total number of spans ever recorded
+  };
+  Tracer();
+  ~Tracer();
+  ThreadBuffer* get_thread_buffer();
+  void maybe_flush();
+  bool enabled_ = false;
+  std::string trace_file_ = "";
+  uint64 sample_every_ = 1;
+  size_t buffer_size_ = 0;
+  std::atomic<uint64> request_count_{0};
+  uint64 flush_interval_us_ = 0;
+  std::atomic<uint64> last_flush_us_{0};
+  // tick <-> wall clock reference taken at construction for conversion
+  uint64 ref_ticks_ = 0;
+  int64 ref_steady_ns_ = 0;
+  tensorflow::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer> > thread_buffers_;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(Tracer);
+};
+
+// Marks spans recorded by the calling thread, for the lifetime of this
+// object, as belonging to a sampled request.
+class ScopedTraceRequest {
+ public:
+  explicit ScopedTraceRequest(bool sampled)
+      : saved_(Tracer::thread_sampled()) {
+    Tracer::thread_sampled() = sampled;
+  }
+  ~ScopedTraceRequest() { Tracer::thread_sampled() = saved_; }
+
+ private:
+  bool saved_;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(ScopedTraceRequest);
+};
+
+// Records a span from construction to destruction if the current request is
+// sampled. `name` must be a string literal.
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name, uint64 arg = 0)
+      : name_(name), arg_(arg) {
+    if (TF_PREDICT_FALSE(Tracer::thread_sampled())) {
+      start_ticks_ = Tracer::now_ticks();
+    }
+  }
+  ~TraceSpan() { end(); }
+  void set_arg(uint64 arg) { arg_ = arg; }
+  void end() {
+    if (TF_PREDICT_FALSE(0 != start_ticks_)) {
+      Tracer::GetTracer().record(name_, start_ticks_, Tracer::now_ticks(),
+                                 arg_);
+      start_ticks_ = 0;
+    }
+  }
+
+ private:
+  const char* name_;
+  uint64 arg_;
+  uint64 start_ticks_ = 0;
+  TFN_DISALLOW_COPY_MOVE_ASSIGN(TraceSpan);
+};
+
+}  // namespace neuron
+}  // namespace tensorflow
+
+#endif  // TENSORFLOW_NEURON_RUNTIME_TRACER_H_